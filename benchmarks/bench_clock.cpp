@@ -0,0 +1,20 @@
+#include <benchmark/benchmark.h>
+#include <skye/clock.hpp>
+
+#include <chrono>
+
+// Cost of one timestamp with each clock that can back phase timing.
+template <typename Clock>
+void BM_Clock_Now(benchmark::State& state)
+{
+    for (auto _ : state) {
+        const auto now = Clock::now();
+        benchmark::DoNotOptimize(now);
+    }
+}
+
+BENCHMARK_TEMPLATE(BM_Clock_Now, std::chrono::steady_clock);
+BENCHMARK_TEMPLATE(BM_Clock_Now, skye::coarse_clock);
+#if defined(SKYE_HAS_TSC_CLOCK)
+BENCHMARK_TEMPLATE(BM_Clock_Now, skye::tsc_clock);
+#endif
@@ -0,0 +1,118 @@
+#include "../tests/test.hpp"
+#include "loopback.hpp"
+
+#include <benchmark/benchmark.h>
+#include <boost/algorithm/string/case_conv.hpp>
+#include <boost/asio.hpp>
+#include <skye/service.hpp>
+
+#include <algorithm>
+#include <string>
+#include <string_view>
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+namespace {
+
+constexpr std::size_t kEchoSize = 1024;
+
+// Same as the hello example
+asio::awaitable<skye::response> hello(skye::request req)
+{
+    skye::response res{http::status::ok, req.version()};
+    res.set(http::field::content_type, "application/json");
+    res.body() = "{\"hello\": \"world\"}";
+
+    co_return res;
+}
+
+// POST routes of the echo example
+asio::awaitable<skye::response> echo(skye::request req)
+{
+    skye::response res{http::status::ok, req.version()};
+    res.set(http::field::content_type, "text/plain");
+    res.body() = std::move(req.body());
+
+    if (req.target() == "/reverse") {
+        std::reverse(res.body().begin(), res.body().end());
+    } else if (req.target() == "/uppercase") {
+        boost::algorithm::to_upper(res.body());
+    } else {
+        res.result(http::status::not_found);
+    }
+
+    co_return res;
+}
+
+} // namespace
+
+// GET /hello
+//
+// Small JSON response over N keep alive loopback connections.
+//
+void BM_Loopback_Hello(benchmark::State& state)
+{
+    const bench::LoopbackServer server{hello};
+
+    bench::run_loopback(
+        state, server.port(), bench::make_request(http::verb::get, "/hello"));
+}
+
+BENCHMARK(BM_Loopback_Hello)->Arg(1)->Arg(16)->Arg(128)->UseRealTime();
+
+// GET /hello
+//
+// Same as BM_Loopback_Hello over a Unix domain socket in the abstract
+// namespace, e.g. a sidecar proxy in the same pod.
+//
+void BM_Loopback_Hello_Unix(benchmark::State& state)
+{
+    const asio::local::stream_protocol::endpoint endpoint{
+        std::string_view{"\0skye-bench", 11}};
+
+    const bench::LoopbackServer server{endpoint, hello};
+
+    bench::run_loopback(
+        state, endpoint, bench::make_request(http::verb::get, "/hello"));
+}
+
+BENCHMARK(BM_Loopback_Hello_Unix)->Arg(1)->Arg(16)->Arg(128)->UseRealTime();
+
+// POST /reverse
+//
+// Echo a 1KB body back in reverse order.
+//
+void BM_Loopback_Echo_Reverse(benchmark::State& state)
+{
+    const bench::LoopbackServer server{echo};
+
+    bench::run_loopback(
+        state, server.port(),
+        bench::make_request(
+            http::verb::post, "/reverse",
+            test::make_random_string<std::string>(kEchoSize)));
+}
+
+BENCHMARK(BM_Loopback_Echo_Reverse)->Arg(1)->Arg(16)->Arg(128)->UseRealTime();
+
+// POST /uppercase
+//
+// Echo a 1KB body back in upper case.
+//
+void BM_Loopback_Echo_Uppercase(benchmark::State& state)
+{
+    const bench::LoopbackServer server{echo};
+
+    bench::run_loopback(
+        state, server.port(),
+        bench::make_request(
+            http::verb::post, "/uppercase",
+            test::make_random_string<std::string>(kEchoSize)));
+}
+
+BENCHMARK(BM_Loopback_Echo_Uppercase)
+    ->Arg(1)
+    ->Arg(16)
+    ->Arg(128)
+    ->UseRealTime();
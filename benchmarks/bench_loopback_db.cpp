@@ -0,0 +1,123 @@
+#include "loopback.hpp"
+
+#include <benchmark/benchmark.h>
+#include <boost/asio.hpp>
+#include <fmt/core.h>
+#include <skye/service.hpp>
+#include <sqlite3.h>
+
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+namespace {
+
+constexpr int kNumRow = 10000;
+
+struct SQLiteDeleter {
+    void operator()(sqlite3* ptr) const
+    {
+        sqlite3_close(ptr);
+    }
+
+    void operator()(sqlite3_stmt* ptr) const
+    {
+        sqlite3_finalize(ptr);
+    }
+};
+
+/**
+  In memory copy of the World table from the database example, so the benchmark
+  does not depend on a database file.
+*/
+class World {
+public:
+    World()
+    {
+        sqlite3* db = nullptr;
+        const int ec = sqlite3_open(":memory:", &db);
+        db_.reset(db);
+        check(ec);
+
+        const auto sql = fmt::format(
+            "CREATE TABLE world (id INTEGER PRIMARY KEY, randomNumber INTEGER);"
+            "WITH RECURSIVE seq(id) AS (SELECT 1 UNION ALL SELECT id + 1 FROM "
+            "seq LIMIT {0}) INSERT INTO world SELECT id, abs(random()) % {0} + "
+            "1 FROM seq;",
+            kNumRow);
+        check(sqlite3_exec(db, sql.c_str(), nullptr, nullptr, nullptr));
+
+        sqlite3_stmt* stmt = nullptr;
+        check(sqlite3_prepare_v2(
+            db, "SELECT * FROM world WHERE id=?;", -1, &stmt, nullptr));
+        stmt_.reset(stmt);
+    }
+
+    std::string get_random()
+    {
+        auto* stmt = stmt_.get();
+
+        std::string result;
+        if ((sqlite3_bind_int(stmt, 1, dist_(engine_)) == SQLITE_OK) &&
+            (sqlite3_step(stmt) == SQLITE_ROW)) {
+            result = fmt::format(
+                "{{\"id\":{},\"randomNumber\":{}}}",
+                sqlite3_column_int(stmt, 0), sqlite3_column_int(stmt, 1));
+        }
+
+        sqlite3_reset(stmt);
+
+        return result;
+    }
+
+private:
+    static void check(int ec)
+    {
+        if (ec != SQLITE_OK) {
+            throw std::runtime_error{sqlite3_errstr(ec)};
+        }
+    }
+
+    std::unique_ptr<sqlite3, SQLiteDeleter> db_;
+    std::unique_ptr<sqlite3_stmt, SQLiteDeleter> stmt_;
+    std::mt19937 engine_{std::random_device{}()};
+    std::uniform_int_distribution<int> dist_{1, kNumRow};
+};
+
+} // namespace
+
+// GET /db
+//
+// Query a random row on a one thread pool, the same as the database example.
+//
+void BM_Loopback_Database(benchmark::State& state)
+{
+    const auto world = std::make_shared<World>();
+
+    const auto handler =
+        [world](skye::request req) -> asio::awaitable<skye::response> {
+        skye::response res{http::status::ok, req.version()};
+        res.set(http::field::content_type, "application/json");
+        res.body() = world->get_random();
+
+        co_return res;
+    };
+
+    asio::thread_pool pool{1};
+
+    {
+        const bench::LoopbackServer server{
+            skye::make_co_handler(pool, handler)};
+
+        bench::run_loopback(
+            state, server.port(), bench::make_request(http::verb::get, "/db"));
+    }
+
+    pool.join();
+}
+
+BENCHMARK(BM_Loopback_Database)->Arg(1)->Arg(16)->Arg(128)->UseRealTime();
@@ -0,0 +1,123 @@
+#include "../tests/mock_sock.hpp"
+#include "corpus.hpp"
+
+#include <benchmark/benchmark.h>
+#include <boost/asio.hpp>
+#include <boost/beast/http.hpp>
+#include <skye/session.hpp>
+
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <string>
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+namespace {
+
+// Keep alive requests in one session, i.e. one benchmark iteration
+constexpr int kNumRequest = 16;
+
+std::string repeat(const std::string& req, int count)
+{
+    std::string data;
+    data.reserve(req.size() * static_cast<std::size_t>(count));
+    for (int i = 0; i < count; ++i) {
+        data += req;
+    }
+
+    return data;
+}
+
+} // namespace
+
+// Corpus request x 16
+//
+// Parse the pipelined requests through session() and respond with a small
+// body. Reports bytes and requests parsed per second.
+//
+void BM_Session_Corpus(benchmark::State& state, std::string (*make)())
+{
+    using buffer = std::string;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using tcp_socket = default_token::as_default_on_t<
+        test::MockSock<buffer, asio::io_context::executor_type>>;
+
+    constexpr auto kBody = "ok";
+
+    const buffer data = repeat(make(), kNumRequest);
+
+    const auto handler =
+        [](skye::request req) -> asio::awaitable<skye::response> {
+        skye::response res{http::status::ok, req.version()};
+        res.set(http::field::content_type, "text/plain");
+        res.body() = kBody;
+
+        co_return res;
+    };
+
+    asio::io_context ctx;
+    tcp_socket s{ctx.get_executor()};
+    s.set_rx(data);
+
+    for (auto _ : state) {
+        s.clear_tx();
+
+        co_spawn(
+            ctx.get_executor(), skye::session(s, handler, false), [](auto ptr) {
+                if (ptr) {
+                    std::rethrow_exception(ptr);
+                }
+            });
+
+        const auto count = ctx.run();
+        ctx.restart();
+
+        assert(s.get_tx().ends_with(kBody));
+
+        benchmark::DoNotOptimize(count);
+    }
+
+    state.SetBytesProcessed(
+        state.iterations() * static_cast<std::int64_t>(data.size()));
+    state.SetItemsProcessed(state.iterations() * kNumRequest);
+}
+
+BENCHMARK_CAPTURE(BM_Session_Corpus, minimal, bench::corpus::minimal);
+BENCHMARK_CAPTURE(BM_Session_Corpus, browser, bench::corpus::browser);
+BENCHMARK_CAPTURE(BM_Session_Corpus, api, bench::corpus::api);
+BENCHMARK_CAPTURE(BM_Session_Corpus, proxy, bench::corpus::proxy);
+BENCHMARK_CAPTURE(BM_Session_Corpus, chunked, bench::corpus::chunked);
+
+// Corpus request
+//
+// Parser only, no session or socket. The gap to BM_Session_Corpus is the cost
+// of the session loop and the response.
+//
+void BM_Parse_Corpus(benchmark::State& state, std::string (*make)())
+{
+    const std::string data = make();
+
+    for (auto _ : state) {
+        http::request_parser<http::string_body> parser;
+        parser.eager(true);
+
+        boost::system::error_code ec;
+        const auto n = parser.put(asio::buffer(data), ec);
+
+        assert(!ec && parser.is_done());
+
+        benchmark::DoNotOptimize(n);
+    }
+
+    state.SetBytesProcessed(
+        state.iterations() * static_cast<std::int64_t>(data.size()));
+    state.SetItemsProcessed(state.iterations());
+}
+
+BENCHMARK_CAPTURE(BM_Parse_Corpus, minimal, bench::corpus::minimal);
+BENCHMARK_CAPTURE(BM_Parse_Corpus, browser, bench::corpus::browser);
+BENCHMARK_CAPTURE(BM_Parse_Corpus, api, bench::corpus::api);
+BENCHMARK_CAPTURE(BM_Parse_Corpus, proxy, bench::corpus::proxy);
+BENCHMARK_CAPTURE(BM_Parse_Corpus, chunked, bench::corpus::chunked);
@@ -0,0 +1,119 @@
+#include <benchmark/benchmark.h>
+#include <skye/query_params.hpp>
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace {
+
+// Request targets modeled on database style endpoints
+constexpr std::array<std::string_view, 6> kTargets = {
+    "/db",
+    "/queries?queries=20",
+    "/updates?queries=500&cache=false",
+    "/users/42/posts?limit=10&offset=200&sort=date&order=desc",
+    "/search?q=caf%C3%A9+au+lait&page=3&per_page=25&lang=en-US",
+    "/v1/items?id=123456789&fields=id%2Cname%2Cprice&include=tags&ts="
+    "1684000000&sig=9f86d081884c7d659a2feaa0c55ad015"};
+
+} // namespace
+
+// Typed lookup of every numeric parameter plus one string parameter.
+void BM_Query_Params(benchmark::State& state)
+{
+    for (auto _ : state) {
+        for (const auto target : kTargets) {
+            const skye::query_params params{target};
+
+            const auto queries = params.get<int>("queries");
+            const auto limit = params.get<int>("limit");
+            const auto page = params.get<int>("page");
+            const auto sort = params.get<std::string_view>("sort");
+
+            benchmark::DoNotOptimize(queries);
+            benchmark::DoNotOptimize(limit);
+            benchmark::DoNotOptimize(page);
+            benchmark::DoNotOptimize(sort);
+        }
+    }
+
+    state.SetItemsProcessed(
+        state.iterations() * static_cast<std::int64_t>(kTargets.size()));
+}
+
+BENCHMARK(BM_Query_Params);
+
+// Percent decode a value into a small stack buffer.
+void BM_Query_Params_Decode(benchmark::State& state)
+{
+    std::array<char, 64> buf{};
+
+    for (auto _ : state) {
+        for (const auto target : kTargets) {
+            const skye::query_params params{target};
+
+            const auto q = params.get("q", buf);
+            const auto fields = params.get("fields", buf);
+
+            benchmark::DoNotOptimize(q);
+            benchmark::DoNotOptimize(fields);
+        }
+    }
+
+    state.SetItemsProcessed(
+        state.iterations() * static_cast<std::int64_t>(kTargets.size()));
+}
+
+BENCHMARK(BM_Query_Params_Decode);
+
+// Baseline, the usual handler code that splits the query string into a map of
+// std::string and converts with std::stoi.
+void BM_Query_String_Map(benchmark::State& state)
+{
+    const auto to_int = [](const auto& map, const std::string& key) {
+        const auto itr = map.find(key);
+        return (itr != map.end()) ? std::stoi(itr->second) : 0;
+    };
+
+    for (auto _ : state) {
+        for (const auto target : kTargets) {
+            std::unordered_map<std::string, std::string> map;
+
+            const std::string str{target};
+            const auto pos = str.find('?');
+            std::string::size_type first =
+                (pos == std::string::npos) ? str.size() : pos + 1;
+            while (first < str.size()) {
+                auto last = str.find('&', first);
+                if (last == std::string::npos) {
+                    last = str.size();
+                }
+
+                const auto pair = str.substr(first, last - first);
+                const auto eq = pair.find('=');
+                map[pair.substr(0, eq)] =
+                    (eq == std::string::npos) ? "" : pair.substr(eq + 1);
+
+                first = last + 1;
+            }
+
+            const int queries = to_int(map, "queries");
+            const int limit = to_int(map, "limit");
+            const int page = to_int(map, "page");
+            const auto sort = map["sort"];
+
+            benchmark::DoNotOptimize(queries);
+            benchmark::DoNotOptimize(limit);
+            benchmark::DoNotOptimize(page);
+            benchmark::DoNotOptimize(sort);
+        }
+    }
+
+    state.SetItemsProcessed(
+        state.iterations() * static_cast<std::int64_t>(kTargets.size()));
+}
+
+BENCHMARK(BM_Query_String_Map);
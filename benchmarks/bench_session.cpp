@@ -4,6 +4,7 @@
 #include <benchmark/benchmark.h>
 #include <boost/asio.hpp>
 #include <skye/session.hpp>
+#include <skye/shared_body.hpp>
 
 #include <cassert>
 #include <exception>
@@ -44,6 +45,8 @@ void BM_Session_Get(benchmark::State& state)
     s.set_rx(data);
 
     for (auto _ : state) {
+        s.clear_tx();
+
         co_spawn(
             ctx.get_executor(), skye::session(s, handler, false), [](auto ptr) {
                 if (ptr) {
@@ -52,6 +55,7 @@ void BM_Session_Get(benchmark::State& state)
             });
 
         const auto count = ctx.run();
+        ctx.restart();
 
         assert(s.get_tx().ends_with(body));
 
@@ -61,6 +65,129 @@ void BM_Session_Get(benchmark::State& state)
 
 BENCHMARK(BM_Session_Get)->Range(1 << 8, 1 << 20);
 
+// GET / HTTP/1.1
+//
+// Reponds with N random characters from a shared body. The response refers to
+// the cached bytes instead of copying them.
+//
+void BM_Session_Get_Shared(benchmark::State& state)
+{
+    using buffer = std::string;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using tcp_socket = default_token::as_default_on_t<
+        test::MockSock<buffer, asio::io_context::executor_type>>;
+
+    constexpr auto kContentType = "text/plain";
+
+    const buffer data = "GET / HTTP/1.1\r\n\r\n";
+    const skye::shared_buffer body{test::make_random_string<buffer>(
+        static_cast<std::size_t>(state.range(0)))};
+
+    const auto handler =
+        [&body](skye::request req) -> asio::awaitable<skye::shared_response> {
+        assert(req.body().empty());
+
+        skye::shared_response res{http::status::ok, req.version()};
+        res.set(http::field::content_type, kContentType);
+        res.body() = body;
+
+        co_return res;
+    };
+
+    asio::io_context ctx;
+    tcp_socket s{ctx.get_executor()};
+    s.set_rx(data);
+
+    for (auto _ : state) {
+        s.clear_tx();
+
+        co_spawn(
+            ctx.get_executor(), skye::session(s, handler, false), [](auto ptr) {
+                if (ptr) {
+                    std::rethrow_exception(ptr);
+                }
+            });
+
+        const auto count = ctx.run();
+        ctx.restart();
+
+        assert(s.get_tx().ends_with(body.view()));
+
+        benchmark::DoNotOptimize(count);
+    }
+}
+
+BENCHMARK(BM_Session_Get_Shared)->Range(1 << 8, 1 << 20);
+
+// GET / HTTP/1.1
+// Host: ...
+//
+// Request headers arrive N bytes per read, like small TCP segments. Reports the
+// number of reads and writes per request.
+//
+void BM_Session_Get_Fragment(benchmark::State& state)
+{
+    using buffer = std::string;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using tcp_socket = default_token::as_default_on_t<
+        test::MockSock<buffer, asio::io_context::executor_type>>;
+
+    constexpr auto kContentType = "application/json";
+    constexpr auto kBody = "{\"hello\": \"world\"}";
+
+    const buffer data =
+        "GET /hello HTTP/1.1\r\n"
+        "Host: localhost:8080\r\n"
+        "User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 "
+        "Firefox/115.0\r\n"
+        "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,*/*;"
+        "q=0.8\r\n"
+        "Accept-Language: en-US,en;q=0.5\r\n"
+        "Accept-Encoding: gzip, deflate, br\r\n"
+        "Connection: keep-alive\r\n\r\n";
+
+    const auto handler =
+        [](skye::request req) -> asio::awaitable<skye::response> {
+        skye::response res{http::status::ok, req.version()};
+        res.set(http::field::content_type, kContentType);
+        res.body() = kBody;
+
+        co_return res;
+    };
+
+    asio::io_context ctx;
+    tcp_socket s{ctx.get_executor()};
+    s.set_rx(data);
+    s.set_read_size(static_cast<std::size_t>(state.range(0)));
+
+    for (auto _ : state) {
+        s.clear_tx();
+
+        co_spawn(
+            ctx.get_executor(), skye::session(s, handler, false), [](auto ptr) {
+                if (ptr) {
+                    std::rethrow_exception(ptr);
+                }
+            });
+
+        const auto count = ctx.run();
+        ctx.restart();
+
+        assert(s.get_tx().ends_with(kBody));
+
+        benchmark::DoNotOptimize(count);
+    }
+
+    state.counters["reads"] = benchmark::Counter(
+        static_cast<double>(s.num_read()),
+        benchmark::Counter::kAvgIterations);
+    state.counters["writes"] = benchmark::Counter(
+        static_cast<double>(s.num_write()),
+        benchmark::Counter::kAvgIterations);
+}
+
+BENCHMARK(BM_Session_Get_Fragment)->Arg(1)->Arg(16)->Arg(64)->Arg(1460);
+
 namespace skye {
 
 template <typename AsyncStream, typename Handler, typename Reporter>
@@ -173,6 +300,8 @@ void BM_Session_Parser_Get(benchmark::State& state)
     s.set_rx(data);
 
     for (auto _ : state) {
+        s.clear_tx();
+
         co_spawn(
             ctx.get_executor(), skye::session_parser(s, handler, false),
             [](auto ptr) {
@@ -182,6 +311,7 @@ void BM_Session_Parser_Get(benchmark::State& state)
             });
 
         const auto count = ctx.run();
+        ctx.restart();
 
         assert(s.get_tx().ends_with(body));
 
@@ -231,6 +361,8 @@ void BM_Session_Post(benchmark::State& state)
     s.set_rx(data);
 
     for (auto _ : state) {
+        s.clear_tx();
+
         co_spawn(
             ctx.get_executor(), skye::session(s, handler, false), [](auto ptr) {
                 if (ptr) {
@@ -239,6 +371,7 @@ void BM_Session_Post(benchmark::State& state)
             });
 
         const auto count = ctx.run();
+        ctx.restart();
 
         assert(s.get_tx().ends_with(kBody));
 
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "histogram.hpp"
+
+#include <boost/asio.hpp>
+#include <fmt/format.h>
+
+#include <chrono>
+#include <iterator>
+#include <string>
+#include <utility>
+
+namespace bench {
+
+namespace asio = boost::asio;
+
+using clock_type = std::chrono::steady_clock;
+using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+using tcp_socket = default_token::as_default_on_t<asio::ip::tcp::socket>;
+using steady_timer = default_token::as_default_on_t<asio::steady_timer>;
+
+/**
+  Condition variable for coroutines on one thread. The waiter checks its
+  condition before it waits, there is no suspension point in between so the
+  notify is never lost.
+*/
+class Event {
+public:
+    explicit Event(asio::any_io_executor ex) : timer_{std::move(ex)}
+    {
+    }
+
+    asio::awaitable<void> wait()
+    {
+        timer_.expires_at(clock_type::time_point::max());
+        co_await timer_.async_wait();
+    }
+
+    void notify()
+    {
+        timer_.cancel();
+    }
+
+private:
+    steady_timer timer_;
+};
+
+/// Append latency percentiles in microseconds as a JSON object.
+inline void format_latency(std::string& out, const Histogram& h)
+{
+    const auto us = [](auto ns) { return static_cast<double>(ns) / 1e3; };
+
+    fmt::format_to(
+        std::back_inserter(out),
+        R"({{"mean":{:.3f},"p50":{:.3f},"p90":{:.3f},"p99":{:.3f},)"
+        R"("p999":{:.3f},"p9999":{:.3f},"max":{:.3f}}})",
+        us(h.mean()), us(h.percentile(50)), us(h.percentile(90)),
+        us(h.percentile(99)), us(h.percentile(99.9)),
+        us(h.percentile(99.99)), us(h.max()));
+}
+
+} // namespace bench
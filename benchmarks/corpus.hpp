@@ -0,0 +1,163 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <string_view>
+
+namespace bench {
+
+/**
+  Request shapes modeled on real traffic behind a reverse proxy. Header values
+  are fixed so results are comparable between runs, sizes are in the comments.
+  Use these to measure parser changes instead of an empty GET request.
+*/
+namespace corpus {
+
+namespace detail {
+
+// Deterministic filler for cookies, tokens and bodies
+inline std::string make_text(std::size_t size, std::string_view alphabet)
+{
+    std::string str(size, 0);
+    for (std::size_t i = 0; i < size; ++i) {
+        str[i] = alphabet[(i * 7 + i / alphabet.size()) % alphabet.size()];
+    }
+
+    return str;
+}
+
+inline std::string make_token(std::size_t size)
+{
+    return make_text(
+        size, "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789");
+}
+
+// name1=value1; name2=value2; ...
+inline std::string make_cookie(std::size_t size)
+{
+    std::string cookie;
+    for (int i = 0; cookie.size() < size; ++i) {
+        if (i > 0) {
+            cookie += "; ";
+        }
+        cookie += "_c" + std::to_string(i) + "=" + make_token(40);
+    }
+
+    return cookie;
+}
+
+} // namespace detail
+
+/// Baseline, the smallest valid HTTP/1.1 request. 18 bytes.
+inline std::string minimal()
+{
+    return "GET / HTTP/1.1\r\n\r\n";
+}
+
+/// Desktop browser page load with a session cookie. About 1.5 KB.
+inline std::string browser()
+{
+    return "GET /account/orders?page=2 HTTP/1.1\r\n"
+           "Host: shop.example.com\r\n"
+           "Connection: keep-alive\r\n"
+           "sec-ch-ua: \"Chromium\";v=\"124\", \"Google Chrome\";v=\"124\", "
+           "\"Not-A.Brand\";v=\"99\"\r\n"
+           "sec-ch-ua-mobile: ?0\r\n"
+           "sec-ch-ua-platform: \"Linux\"\r\n"
+           "Upgrade-Insecure-Requests: 1\r\n"
+           "User-Agent: Mozilla/5.0 (X11; Linux x86_64) AppleWebKit/537.36 "
+           "(KHTML, like Gecko) Chrome/124.0.0.0 Safari/537.36\r\n"
+           "Accept: text/html,application/xhtml+xml,application/xml;q=0.9,"
+           "image/avif,image/webp,image/apng,*/*;q=0.8,"
+           "application/signed-exchange;v=b3;q=0.7\r\n"
+           "Sec-Fetch-Site: same-origin\r\n"
+           "Sec-Fetch-Mode: navigate\r\n"
+           "Sec-Fetch-User: ?1\r\n"
+           "Sec-Fetch-Dest: document\r\n"
+           "Referer: https://shop.example.com/account/orders?page=1\r\n"
+           "Accept-Encoding: gzip, deflate, br, zstd\r\n"
+           "Accept-Language: en-US,en;q=0.9\r\n"
+           "Cookie: " +
+           detail::make_cookie(700) + "\r\n\r\n";
+}
+
+/// JSON API call with a bearer token and a small body. About 1 KB.
+inline std::string api()
+{
+    const std::string body =
+        R"({"user_id":48213,"items":[{"sku":"A-1042","qty":2},)"
+        R"({"sku":"B-2210","qty":1}],"currency":"USD","coupon":null})";
+
+    return "POST /v2/orders HTTP/1.1\r\n"
+           "Host: api.example.com\r\n"
+           "User-Agent: example-sdk-python/3.12.1 urllib3/2.2.1\r\n"
+           "Accept: application/json\r\n"
+           "Accept-Encoding: gzip, deflate\r\n"
+           "Authorization: Bearer " +
+           detail::make_token(640) +
+           "\r\n"
+           "Content-Type: application/json\r\n"
+           "Idempotency-Key: 6f1c2a9e-8d4b-4f7a-9c3e-2b1d0e5f7a88\r\n"
+           "Content-Length: " +
+           std::to_string(body.size()) + "\r\n\r\n" + body;
+}
+
+/**
+  Browser request after our reverse proxy added forwarding and trace context
+  headers. About 3.5 KB.
+*/
+inline std::string proxy()
+{
+    return "GET /api/v1/feed?limit=50&cursor=eyJpZCI6MTIzNDU2fQ HTTP/1.1\r\n"
+           "Host: www.example.com\r\n"
+           "X-Forwarded-For: 203.0.113.195, 70.41.3.18, 150.172.238.178\r\n"
+           "X-Forwarded-Proto: https\r\n"
+           "X-Forwarded-Host: www.example.com\r\n"
+           "X-Forwarded-Port: 443\r\n"
+           "X-Real-IP: 203.0.113.195\r\n"
+           "Forwarded: for=203.0.113.195;proto=https;by=10.0.0.12\r\n"
+           "Via: 1.1 edge-proxy-7 (envoy), 1.1 lb-internal-2\r\n"
+           "X-Request-Id: 9b2f4c1e-7a3d-4e8b-b6f0-1c2d3e4f5a6b\r\n"
+           "traceparent: 00-4bf92f3577b34da6a3ce929d0e0e4736-"
+           "00f067aa0ba902b7-01\r\n"
+           "tracestate: congo=t61rcWkgMzE,rojo=00f067aa0ba902b7\r\n"
+           "X-Envoy-Expected-Rq-Timeout-Ms: 15000\r\n"
+           "X-Envoy-Attempt-Count: 1\r\n"
+           "User-Agent: Mozilla/5.0 (Macintosh; Intel Mac OS X 14_4_1) "
+           "AppleWebKit/605.1.15 (KHTML, like Gecko) Version/17.4.1 "
+           "Safari/605.1.15\r\n"
+           "Accept: application/json, text/plain, */*\r\n"
+           "Accept-Encoding: gzip, deflate, br\r\n"
+           "Accept-Language: en-GB,en;q=0.9\r\n"
+           "Authorization: Bearer " +
+           detail::make_token(512) +
+           "\r\n"
+           "Cookie: " +
+           detail::make_cookie(2200) + "\r\n\r\n";
+}
+
+/// File upload in 1 KB chunks, e.g. from a streaming client. About 8.5 KB.
+inline std::string chunked()
+{
+    constexpr int kNumChunk = 8;
+    constexpr std::size_t kChunkSize = 1024;
+
+    std::string req = "POST /upload/images HTTP/1.1\r\n"
+                      "Host: upload.example.com\r\n"
+                      "User-Agent: curl/8.5.0\r\n"
+                      "Accept: */*\r\n"
+                      "Content-Type: application/octet-stream\r\n"
+                      "Transfer-Encoding: chunked\r\n\r\n";
+
+    const auto chunk = detail::make_token(kChunkSize);
+    for (int i = 0; i < kNumChunk; ++i) {
+        req += "400\r\n" + chunk + "\r\n";
+    }
+    req += "0\r\n\r\n";
+
+    return req;
+}
+
+} // namespace corpus
+
+} // namespace bench
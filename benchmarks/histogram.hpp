@@ -0,0 +1,176 @@
+#pragma once
+
+#include <algorithm>
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace bench {
+
+/**
+  High dynamic range histogram of integer values, e.g. latency in nanoseconds.
+  Log linear buckets with 3 significant digits for any value, the same layout as
+  HdrHistogram.
+
+  Values below 2048 have their own bucket. Above that each power of two range
+  has 1024 buckets so the relative error is under 0.1%.
+
+  http://hdrhistogram.org/
+*/
+class Histogram {
+public:
+    Histogram() : counts_(bucket_index(kMaxValue) + 1)
+    {
+    }
+
+    void record(std::uint64_t value, std::uint64_t count = 1)
+    {
+        value = std::min(value, kMaxValue);
+
+        counts_[bucket_index(value)] += count;
+        total_count_ += count;
+        total_value_ += static_cast<double>(value) * static_cast<double>(count);
+        min_ = std::min(min_, value);
+        max_ = std::max(max_, value);
+    }
+
+    /**
+      Record a value and back fill the samples a closed loop client did not send
+      while it waited for this one. A load generator that waits for a response
+      before it sends the next request stops measuring exactly when the server
+      stalls, i.e. coordinated omission.
+    */
+    void record_corrected(std::uint64_t value, std::uint64_t expected_interval)
+    {
+        record(value);
+
+        if (expected_interval == 0) {
+            return;
+        }
+
+        for (std::uint64_t missing = value - std::min(value, expected_interval);
+             missing >= expected_interval; missing -= expected_interval) {
+            record(missing);
+        }
+    }
+
+    void add(const Histogram& other)
+    {
+        for (std::size_t i = 0; i < counts_.size(); ++i) {
+            counts_[i] += other.counts_[i];
+        }
+
+        total_count_ += other.total_count_;
+        total_value_ += other.total_value_;
+        min_ = std::min(min_, other.min_);
+        max_ = std::max(max_, other.max_);
+    }
+
+    /**
+      Copy of this histogram with each sample corrected for coordinated omission
+      as if it was recorded with record_corrected.
+    */
+    [[nodiscard]] Histogram
+    corrected(std::uint64_t expected_interval) const
+    {
+        Histogram result;
+        for (std::size_t i = 0; i < counts_.size(); ++i) {
+            if (counts_[i] == 0) {
+                continue;
+            }
+
+            const std::uint64_t value = highest_equivalent(i);
+            result.record(value, counts_[i]);
+
+            if (expected_interval == 0) {
+                continue;
+            }
+
+            for (std::uint64_t missing =
+                     value - std::min(value, expected_interval);
+                 missing >= expected_interval; missing -= expected_interval) {
+                result.record(missing, counts_[i]);
+            }
+        }
+
+        return result;
+    }
+
+    /// Value at percentile q in [0, 100].
+    [[nodiscard]] std::uint64_t percentile(double q) const
+    {
+        if (total_count_ == 0) {
+            return 0;
+        }
+
+        const auto rank = static_cast<std::uint64_t>(std::max(
+            1.0, q / 100.0 * static_cast<double>(total_count_) + 0.5));
+
+        std::uint64_t count = 0;
+        for (std::size_t i = 0; i < counts_.size(); ++i) {
+            count += counts_[i];
+            if (count >= rank) {
+                return std::min(highest_equivalent(i), max_);
+            }
+        }
+
+        return max_;
+    }
+
+    [[nodiscard]] std::uint64_t count() const
+    {
+        return total_count_;
+    }
+
+    [[nodiscard]] double mean() const
+    {
+        return (total_count_ > 0)
+                   ? total_value_ / static_cast<double>(total_count_)
+                   : 0.0;
+    }
+
+    [[nodiscard]] std::uint64_t min() const
+    {
+        return (total_count_ > 0) ? min_ : 0;
+    }
+
+    [[nodiscard]] std::uint64_t max() const
+    {
+        return max_;
+    }
+
+private:
+    static constexpr int kSubBits = 11;
+    static constexpr std::uint64_t kSubCount = std::uint64_t{1} << kSubBits;
+    static constexpr std::uint64_t kHalfCount = kSubCount / 2;
+
+    // One hour in nanoseconds is about 2^42
+    static constexpr std::uint64_t kMaxValue = (std::uint64_t{1} << 42) - 1;
+
+    static std::size_t bucket_index(std::uint64_t value)
+    {
+        const int width = static_cast<int>(std::bit_width(value));
+        const int shift = std::max(0, width - kSubBits);
+
+        return static_cast<std::size_t>(
+            static_cast<std::uint64_t>(shift) * kHalfCount + (value >> shift));
+    }
+
+    static std::uint64_t highest_equivalent(std::size_t index)
+    {
+        const std::uint64_t i = index;
+        const std::uint64_t shift = (i < kSubCount) ? 0 : i / kHalfCount - 1;
+
+        return ((i - shift * kHalfCount + 1) << shift) - 1;
+    }
+
+    std::vector<std::uint64_t> counts_;
+    std::uint64_t total_count_{};
+    double total_value_{};
+    std::uint64_t min_{std::numeric_limits<std::uint64_t>::max()};
+    std::uint64_t max_{};
+};
+
+} // namespace bench
@@ -0,0 +1,408 @@
+//
+// skye-load, HTTP load generator
+//
+// Drive a HTTP server over N keep alive connections and report latency
+// percentiles as JSON.
+//
+// - Closed loop, the default. Each connection sends its next request as soon as
+//   a response arrives, i.e. max throughput. Latency is measured from the send
+//   time, the corrected histogram back fills the requests that a stalled
+//   connection did not send.
+// - Open loop, --rate N. Requests are sent at a constant arrival rate of N per
+//   second across all connections. Latency is measured from the time the
+//   request was scheduled to be sent, not when it was actually sent, so a
+//   stalled server shows up in the tail and not as a lower request rate.
+//
+// Usage:
+//
+//   skye-load --port 8080 --target /hello --connections 128 --duration 30
+//   skye-load --port 8080 --target /db --rate 50000 --pipeline 4
+//
+#include "client.hpp"
+#include "histogram.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <fmt/format.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace {
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+using bench::clock_type;
+using bench::Event;
+using bench::steady_timer;
+using bench::tcp_socket;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    std::string port = "8080";
+    std::string target = "/";
+    std::string method = "GET";
+    std::string body;
+    int connections = 64;
+    int threads = 1;
+    int pipeline = 1;
+    double rate = 0;
+    double duration = 10;
+    double warmup = 1;
+};
+
+// Results from one thread, merged at the end of the run.
+struct Stats {
+    bench::Histogram latency;
+    std::uint64_t num_request{};
+    std::uint64_t num_error{};
+    std::uint64_t num_status_error{};
+    std::uint64_t bytes_read{};
+};
+
+struct Schedule {
+    clock_type::time_point start;
+    clock_type::time_point measure;
+    clock_type::time_point deadline;
+    // Time between requests on one connection, zero for closed loop
+    clock_type::duration interval;
+};
+
+struct Connection {
+    explicit Connection(asio::any_io_executor ex)
+        : socket{ex}, timer{ex}, writable{ex}, readable{ex}
+    {
+    }
+
+    tcp_socket socket;
+    steady_timer timer;
+    // Scheduled send time of each request waiting for a response
+    std::deque<clock_type::time_point> in_flight;
+    Event writable;
+    Event readable;
+    bool writing{true};
+    bool done{false};
+};
+
+asio::awaitable<void> write_loop(
+    Connection& conn, const std::string& request, const Schedule& schedule,
+    clock_type::duration offset, int pipeline, Stats& stats)
+{
+    for (std::uint64_t i = 0;; ++i) {
+        auto intended = clock_type::now();
+        if (schedule.interval.count() > 0) {
+            intended = schedule.start + offset +
+                       schedule.interval * static_cast<std::int64_t>(i);
+            if (intended >= schedule.deadline) {
+                break;
+            }
+
+            if (intended > clock_type::now()) {
+                conn.timer.expires_at(intended);
+                co_await conn.timer.async_wait();
+            }
+        } else if (intended >= schedule.deadline) {
+            break;
+        }
+
+        while (std::ssize(conn.in_flight) >= pipeline && !conn.done) {
+            co_await conn.writable.wait();
+        }
+
+        if (conn.done) {
+            break;
+        }
+
+        // Closed loop, the request is scheduled once the pipeline has room
+        if (schedule.interval.count() == 0) {
+            intended = clock_type::now();
+        }
+
+        conn.in_flight.push_back(intended);
+        conn.readable.notify();
+
+        auto [ec, n] =
+            co_await asio::async_write(conn.socket, asio::buffer(request));
+        if (ec) {
+            ++stats.num_error;
+            break;
+        }
+    }
+
+    conn.writing = false;
+    conn.readable.notify();
+}
+
+asio::awaitable<void>
+read_loop(Connection& conn, const Schedule& schedule, Stats& stats)
+{
+    boost::beast::flat_buffer buffer;
+
+    for (;;) {
+        while (conn.in_flight.empty() && conn.writing) {
+            co_await conn.readable.wait();
+        }
+
+        if (conn.in_flight.empty()) {
+            break;
+        }
+
+        http::response<http::string_body> res;
+        auto [ec, n] = co_await http::async_read(conn.socket, buffer, res);
+        if (ec) {
+            ++stats.num_error;
+            break;
+        }
+
+        const auto now = clock_type::now();
+        const auto intended = conn.in_flight.front();
+        conn.in_flight.pop_front();
+        conn.writable.notify();
+
+        if (intended < schedule.measure) {
+            continue;
+        }
+
+        stats.latency.record(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                now - intended)
+                .count()));
+        ++stats.num_request;
+        stats.bytes_read += n;
+        if (res.result_int() >= 400) {
+            ++stats.num_status_error;
+        }
+    }
+
+    conn.done = true;
+    conn.writable.notify();
+}
+
+asio::awaitable<void> connection(
+    asio::ip::tcp::resolver::results_type endpoints, const std::string& request,
+    const Schedule& schedule, clock_type::duration offset, int pipeline,
+    Stats& stats)
+{
+    Connection conn{co_await asio::this_coro::executor};
+
+    auto [ec, endpoint] = co_await asio::async_connect(conn.socket, endpoints);
+    if (ec) {
+        ++stats.num_error;
+        co_return;
+    }
+
+    conn.socket.set_option(asio::ip::tcp::no_delay{true}, ec);
+
+    co_spawn(
+        conn.socket.get_executor(),
+        write_loop(conn, request, schedule, offset, pipeline, stats),
+        asio::detached);
+
+    co_await read_loop(conn, schedule, stats);
+
+    // Wait for the writer to exit before the connection goes away
+    conn.socket.close(ec);
+    conn.timer.cancel();
+    while (conn.writing) {
+        co_await conn.readable.wait();
+    }
+}
+
+std::string make_request(const Options& options)
+{
+    http::request<http::string_body> req{
+        http::string_to_verb(options.method), options.target, 11};
+    req.set(http::field::host, options.host);
+    req.set(http::field::user_agent, "skye-load");
+    if (!options.body.empty() || req.method() == http::verb::post) {
+        req.body() = options.body;
+        req.prepare_payload();
+    }
+
+    std::ostringstream os;
+    os << req;
+
+    return os.str();
+}
+
+void usage()
+{
+    std::fputs(
+        "usage: skye-load [options]\n"
+        "  --host HOST         server address (127.0.0.1)\n"
+        "  --port PORT         server port (8080)\n"
+        "  --target TARGET     request target (/)\n"
+        "  --method METHOD     request method (GET)\n"
+        "  --body BODY         request body\n"
+        "  --connections N     number of connections (64)\n"
+        "  --threads N         number of client threads (1)\n"
+        "  --pipeline N        max requests in flight per connection (1)\n"
+        "  --rate N            open loop, total requests per second (0)\n"
+        "  --duration SECONDS  length of the run (10)\n"
+        "  --warmup SECONDS    ignore requests sent before this (1)\n",
+        stderr);
+}
+
+bool parse_options(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view name = argv[i];
+        if (i + 1 == argc) {
+            return false;
+        }
+
+        const char* value = argv[++i];
+        if (name == "--host") {
+            options.host = value;
+        } else if (name == "--port") {
+            options.port = value;
+        } else if (name == "--target") {
+            options.target = value;
+        } else if (name == "--method") {
+            options.method = value;
+        } else if (name == "--body") {
+            options.body = value;
+        } else if (name == "--connections") {
+            options.connections = std::atoi(value);
+        } else if (name == "--threads") {
+            options.threads = std::atoi(value);
+        } else if (name == "--pipeline") {
+            options.pipeline = std::atoi(value);
+        } else if (name == "--rate") {
+            options.rate = std::atof(value);
+        } else if (name == "--duration") {
+            options.duration = std::atof(value);
+        } else if (name == "--warmup") {
+            options.warmup = std::atof(value);
+        } else {
+            return false;
+        }
+    }
+
+    return options.connections > 0 && options.threads > 0 &&
+           options.pipeline > 0 && options.rate >= 0 &&
+           options.duration > options.warmup && options.warmup >= 0 &&
+           http::string_to_verb(options.method) != http::verb::unknown;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    using std::chrono::duration_cast;
+    using seconds = std::chrono::duration<double>;
+
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        usage();
+        return -1;
+    }
+
+    try {
+        const std::string request = make_request(options);
+
+        const auto endpoints = [&options]() {
+            asio::io_context ctx;
+            return asio::ip::tcp::resolver{ctx}.resolve(
+                options.host, options.port);
+        }();
+
+        const int num_thread = std::min(options.threads, options.connections);
+
+        Schedule schedule;
+        schedule.start = clock_type::now();
+        schedule.measure =
+            schedule.start + duration_cast<clock_type::duration>(
+                                 seconds{options.warmup});
+        schedule.deadline =
+            schedule.start + duration_cast<clock_type::duration>(
+                                 seconds{options.duration});
+        if (options.rate > 0) {
+            schedule.interval = duration_cast<clock_type::duration>(
+                seconds{options.connections / options.rate});
+        }
+
+        std::vector<Stats> stats(static_cast<std::size_t>(num_thread));
+        std::vector<std::thread> threads;
+        for (int t = 0; t < num_thread; ++t) {
+            threads.emplace_back([&, t]() {
+                asio::io_context ctx{1};
+                for (int i = t; i < options.connections; i += num_thread) {
+                    // Spread the open loop arrivals evenly over the interval
+                    const auto offset =
+                        schedule.interval * i / options.connections;
+
+                    co_spawn(
+                        ctx,
+                        connection(
+                            endpoints, request, schedule, offset,
+                            options.pipeline, stats[t]),
+                        asio::detached);
+                }
+                ctx.run();
+            });
+        }
+
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        const seconds elapsed = clock_type::now() - schedule.measure;
+
+        Stats total;
+        for (const auto& s : stats) {
+            total.latency.add(s.latency);
+            total.num_request += s.num_request;
+            total.num_error += s.num_error;
+            total.num_status_error += s.num_status_error;
+            total.bytes_read += s.bytes_read;
+        }
+
+        // Open loop latency is measured from the schedule and already includes
+        // any wait. Closed loop is corrected as if each connection was meant
+        // to send at its mean request rate.
+        const auto expected_interval =
+            (options.rate > 0)
+                ? 0
+                : static_cast<std::uint64_t>(
+                      total.latency.mean() / options.pipeline);
+
+        std::string out;
+        fmt::format_to(
+            std::back_inserter(out),
+            R"({{"mode":"{}","target":"{}","connections":{},"threads":{},)"
+            R"("pipeline":{},"rate":{},"duration":{:.3f},"requests":{},)"
+            R"("errors":{},"status_errors":{},"bytes":{},"rps":{:.1f},)"
+            R"("latency_us":)",
+            (options.rate > 0) ? "open" : "closed", options.target,
+            options.connections, num_thread, options.pipeline, options.rate,
+            elapsed.count(), total.num_request, total.num_error,
+            total.num_status_error, total.bytes_read,
+            static_cast<double>(total.num_request) / elapsed.count());
+        bench::format_latency(out, total.latency);
+        out += R"(,"corrected_us":)";
+        bench::format_latency(out, total.latency.corrected(expected_interval));
+        out += "}\n";
+
+        std::fputs(out.c_str(), stdout);
+
+        return (total.num_request > 0) ? 0 : -1;
+    } catch (std::exception& e) {
+        std::fprintf(stderr, "skye-load: %s\n", e.what());
+    }
+
+    return -1;
+}
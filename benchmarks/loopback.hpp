@@ -0,0 +1,234 @@
+#pragma once
+
+#include "histogram.hpp"
+
+#include <benchmark/benchmark.h>
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <skye/service.hpp>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace bench {
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+/**
+  Run the real server with async_run on a loopback port, or a Unix domain
+  socket, in a background thread. The kernel, acceptor, and session are all in
+  the measured path.
+*/
+class LoopbackServer {
+public:
+    /**
+      Listen on a free loopback port. Bind port 0 here and hand the listening
+      socket to the server, another process cannot take the port in between.
+    */
+    template <typename Handler>
+    explicit LoopbackServer(Handler handler) : ctx_{1}
+    {
+        using tcp = asio::ip::tcp;
+
+        {
+            const tcp::acceptor acceptor{
+                ctx_, tcp::endpoint{asio::ip::address_v4::loopback(), 0}};
+            port_ = acceptor.local_endpoint().port();
+
+            // The server accepts on a duplicate of the socket
+            listen(
+                skye::listen_fd<tcp>{tcp::v4(), acceptor.native_handle()},
+                std::move(handler));
+        }
+
+        thread_ = std::thread{[this]() { ctx_.run(); }};
+    }
+
+    template <typename Endpoint, typename Handler>
+    LoopbackServer(const Endpoint& endpoint, Handler handler) : ctx_{1}
+    {
+        if constexpr (std::is_same_v<Endpoint, asio::ip::tcp::endpoint>) {
+            port_ = endpoint.port();
+        }
+
+        listen(endpoint, std::move(handler));
+
+        thread_ = std::thread{[this]() { ctx_.run(); }};
+    }
+
+    LoopbackServer(const LoopbackServer&) = delete;
+    LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+    ~LoopbackServer()
+    {
+        ctx_.stop();
+        thread_.join();
+    }
+
+    [[nodiscard]] int port() const
+    {
+        return port_;
+    }
+
+private:
+    template <typename Endpoint, typename Handler>
+    void listen(const Endpoint& endpoint, Handler handler)
+    {
+        skye::async_run(ctx_, endpoint, std::move(handler));
+
+        // Run the listen coroutine up to its first accept so the port is open
+        // before the first client connects
+        ctx_.poll();
+    }
+
+    asio::io_context ctx_;
+    int port_{};
+    std::thread thread_;
+};
+
+inline std::string make_request(
+    http::verb method, const std::string& target, const std::string& body = {})
+{
+    http::request<http::string_body> req{method, target, 11};
+    req.set(http::field::host, "localhost");
+    if (method == http::verb::post) {
+        req.body() = body;
+        req.prepare_payload();
+    }
+
+    std::ostringstream os;
+    os << req;
+
+    return os.str();
+}
+
+/**
+  Closed loop client. Each keep alive connection sends one request, reads the
+  response, and repeats. Latency is from the start of the write to the end of
+  the read.
+*/
+inline asio::awaitable<void> request_loop(
+    auto& socket, boost::beast::flat_buffer& buffer, const std::string& request,
+    int num_request, Histogram& latency, int& num_error)
+{
+    using clock_type = std::chrono::steady_clock;
+
+    for (int i = 0; i < num_request; ++i) {
+        const auto start = clock_type::now();
+
+        auto [write_ec, bytes_write] =
+            co_await asio::async_write(socket, asio::buffer(request));
+        if (write_ec) {
+            ++num_error;
+            co_return;
+        }
+
+        http::response<http::string_body> res;
+        auto [read_ec, bytes_read] =
+            co_await http::async_read(socket, buffer, res);
+        if (read_ec) {
+            ++num_error;
+            co_return;
+        }
+
+        if (res.result() != http::status::ok) {
+            ++num_error;
+        }
+
+        latency.record(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                clock_type::now() - start)
+                .count()));
+    }
+}
+
+/**
+  Drive the server with state.range(0) connections. Each iteration sends
+  kRequestPerIteration requests split over the connections. Reports requests
+  per second and latency percentiles in microseconds as counters.
+*/
+template <typename Endpoint>
+void run_loopback(
+    benchmark::State& state, const Endpoint& endpoint,
+    const std::string& request)
+{
+    using protocol_type = typename Endpoint::protocol_type;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using socket_type =
+        default_token::as_default_on_t<typename protocol_type::socket>;
+
+    constexpr int kRequestPerIteration = 4096;
+
+    const int num_connection = static_cast<int>(state.range(0));
+    const int num_request =
+        std::max(1, kRequestPerIteration / std::max(1, num_connection));
+
+    asio::io_context ctx{1};
+
+    std::vector<socket_type> sockets;
+    std::vector<boost::beast::flat_buffer> buffers(
+        static_cast<std::size_t>(num_connection));
+    for (int i = 0; i < num_connection; ++i) {
+        auto& socket = sockets.emplace_back(ctx);
+        socket.connect(endpoint);
+        if constexpr (std::is_same_v<protocol_type, asio::ip::tcp>) {
+            socket.set_option(asio::ip::tcp::no_delay{true});
+        }
+    }
+
+    Histogram latency;
+    int num_error = 0;
+
+    for (auto _ : state) {
+        for (std::size_t i = 0; i < sockets.size(); ++i) {
+            co_spawn(
+                ctx,
+                request_loop(
+                    sockets[i], buffers[i], request, num_request, latency,
+                    num_error),
+                asio::detached);
+        }
+
+        ctx.run();
+        ctx.restart();
+    }
+
+    if (num_error > 0) {
+        state.SkipWithError("request failed");
+        return;
+    }
+
+    const auto us = [](std::uint64_t ns) {
+        return static_cast<double>(ns) / 1e3;
+    };
+
+    state.counters["rps"] = benchmark::Counter(
+        static_cast<double>(latency.count()), benchmark::Counter::kIsRate);
+    state.counters["p50_us"] = us(latency.percentile(50));
+    state.counters["p90_us"] = us(latency.percentile(90));
+    state.counters["p99_us"] = us(latency.percentile(99));
+    state.counters["p999_us"] = us(latency.percentile(99.9));
+    state.counters["max_us"] = us(latency.max());
+}
+
+inline void
+run_loopback(benchmark::State& state, int port, const std::string& request)
+{
+    run_loopback(
+        state,
+        asio::ip::tcp::endpoint{
+            asio::ip::address_v4::loopback(),
+            static_cast<asio::ip::port_type>(port)},
+        request);
+}
+
+} // namespace bench
@@ -0,0 +1,366 @@
+//
+// skye-replay, replay a request capture against a HTTP server
+//
+// Read a capture file from a server built with ENABLE_CAPTURE, see
+// skye/capture.hpp. Open one connection per captured connection and send each
+// captured read at its original time, scaled by the speed factor. Report
+// throughput and latency percentiles as JSON.
+//
+// The request boundaries are found by parsing the captured bytes. Latency is
+// measured from the time the last byte of a request was scheduled to be sent
+// to the time its response is read.
+//
+// Usage:
+//
+//   skye-replay --port 8080 capture.bin
+//   skye-replay --port 8080 --speed 10 capture.bin
+//   skye-replay --port 8080 --speed 0 capture.bin  # as fast as possible
+//
+#include "client.hpp"
+#include "histogram.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <fmt/format.h>
+#include <skye/capture.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <iterator>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+using bench::clock_type;
+using bench::Event;
+using bench::steady_timer;
+using bench::tcp_socket;
+
+struct Options {
+    std::string host = "127.0.0.1";
+    std::string port = "8080";
+    std::string filename;
+    double speed = 1;
+};
+
+struct Stats {
+    bench::Histogram latency;
+    std::uint64_t num_request{};
+    std::uint64_t num_error{};
+    std::uint64_t num_status_error{};
+    std::uint64_t bytes_write{};
+};
+
+// One captured read and the number of requests it completes
+struct Chunk {
+    clock_type::duration time;
+    std::string data;
+    int num_request{};
+};
+
+struct Stream {
+    std::vector<Chunk> chunks;
+    int num_request{};
+};
+
+/**
+  Group the records by connection and find the requests that end in each
+  chunk. A partial request at the end of a connection is sent but not counted.
+*/
+std::map<std::uint32_t, Stream>
+make_streams(const std::vector<skye::CaptureRecord>& records)
+{
+    std::map<std::uint32_t, Stream> streams;
+    for (const auto& record : records) {
+        if (!record.data.empty()) {
+            streams[record.id].chunks.push_back(
+                {std::chrono::duration_cast<clock_type::duration>(record.time),
+                 record.data});
+        }
+    }
+
+    for (auto& [id, stream] : streams) {
+        std::string data;
+        for (const auto& chunk : stream.chunks) {
+            data += chunk.data;
+        }
+
+        // End offset of each complete request
+        std::vector<std::size_t> ends;
+        for (std::size_t offset = 0; offset < data.size();) {
+            http::request_parser<http::string_body> parser;
+            parser.eager(true);
+            parser.body_limit(std::numeric_limits<std::uint64_t>::max());
+
+            boost::system::error_code ec;
+            while (!parser.is_done() && !ec) {
+                const std::size_t n = parser.put(
+                    asio::buffer(data.data() + offset, data.size() - offset),
+                    ec);
+                offset += n;
+                if (n == 0) {
+                    break;
+                }
+            }
+
+            if (!parser.is_done()) {
+                break;
+            }
+
+            ends.push_back(offset);
+        }
+
+        std::size_t offset = 0;
+        auto it = ends.begin();
+        for (auto& chunk : stream.chunks) {
+            offset += chunk.data.size();
+            for (; (it != ends.end()) && (*it <= offset); ++it) {
+                ++chunk.num_request;
+                ++stream.num_request;
+            }
+        }
+    }
+
+    return streams;
+}
+
+struct Connection {
+    explicit Connection(asio::any_io_executor ex)
+        : socket{ex}, timer{ex}, readable{ex}
+    {
+    }
+
+    tcp_socket socket;
+    steady_timer timer;
+    // Scheduled send time of each request waiting for a response
+    std::deque<clock_type::time_point> in_flight;
+    Event readable;
+    bool writing{true};
+};
+
+clock_type::time_point
+scale(clock_type::time_point start, clock_type::duration time, double speed)
+{
+    if (speed <= 0) {
+        return start;
+    }
+
+    return start + std::chrono::duration_cast<clock_type::duration>(
+                       std::chrono::duration<double, std::nano>{time} / speed);
+}
+
+asio::awaitable<void> write_loop(
+    Connection& conn, const Stream& stream, clock_type::time_point start,
+    double speed, Stats& stats)
+{
+    for (const auto& chunk : stream.chunks) {
+        const auto intended = scale(start, chunk.time, speed);
+        if (intended > clock_type::now()) {
+            conn.timer.expires_at(intended);
+            auto [ec] = co_await conn.timer.async_wait();
+            if (ec) {
+                break;
+            }
+        }
+
+        for (int i = 0; i < chunk.num_request; ++i) {
+            conn.in_flight.push_back(intended);
+        }
+        conn.readable.notify();
+
+        auto [ec, n] =
+            co_await asio::async_write(conn.socket, asio::buffer(chunk.data));
+        if (ec) {
+            ++stats.num_error;
+            break;
+        }
+
+        stats.bytes_write += n;
+    }
+
+    conn.writing = false;
+    conn.readable.notify();
+}
+
+asio::awaitable<void> read_loop(Connection& conn, int num_request, Stats& stats)
+{
+    boost::beast::flat_buffer buffer;
+
+    for (int i = 0; i < num_request; ++i) {
+        while (conn.in_flight.empty() && conn.writing) {
+            co_await conn.readable.wait();
+        }
+
+        if (conn.in_flight.empty()) {
+            break;
+        }
+
+        http::response<http::string_body> res;
+        auto [ec, n] = co_await http::async_read(conn.socket, buffer, res);
+        if (ec) {
+            ++stats.num_error;
+            break;
+        }
+
+        const auto intended = conn.in_flight.front();
+        conn.in_flight.pop_front();
+
+        stats.latency.record(static_cast<std::uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                clock_type::now() - intended)
+                .count()));
+        ++stats.num_request;
+        if (res.result_int() >= 400) {
+            ++stats.num_status_error;
+        }
+    }
+}
+
+asio::awaitable<void> connection(
+    asio::ip::tcp::resolver::results_type endpoints, const Stream& stream,
+    clock_type::time_point start, double speed, Stats& stats)
+{
+    Connection conn{co_await asio::this_coro::executor};
+
+    // Connect at the time of the first captured read
+    conn.timer.expires_at(scale(start, stream.chunks.front().time, speed));
+    co_await conn.timer.async_wait();
+
+    auto [ec, endpoint] = co_await asio::async_connect(conn.socket, endpoints);
+    if (ec) {
+        ++stats.num_error;
+        co_return;
+    }
+
+    conn.socket.set_option(asio::ip::tcp::no_delay{true}, ec);
+
+    co_spawn(
+        conn.socket.get_executor(),
+        write_loop(conn, stream, start, speed, stats), asio::detached);
+
+    co_await read_loop(conn, stream.num_request, stats);
+
+    // Wait for the writer to exit before the connection goes away
+    conn.socket.close(ec);
+    conn.timer.cancel();
+    while (conn.writing) {
+        co_await conn.readable.wait();
+    }
+}
+
+void usage()
+{
+    std::fputs(
+        "usage: skye-replay [options] FILE\n"
+        "  --host HOST     server address (127.0.0.1)\n"
+        "  --port PORT     server port (8080)\n"
+        "  --speed FACTOR  time scale, 2 is twice as fast, 0 is no delay (1)\n",
+        stderr);
+}
+
+bool parse_options(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view name = argv[i];
+        if (i + 1 == argc) {
+            options.filename = argv[i];
+            break;
+        }
+
+        const char* value = argv[++i];
+        if (name == "--host") {
+            options.host = value;
+        } else if (name == "--port") {
+            options.port = value;
+        } else if (name == "--speed") {
+            options.speed = std::atof(value);
+        } else {
+            return false;
+        }
+    }
+
+    return !options.filename.empty() && options.speed >= 0;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        usage();
+        return -1;
+    }
+
+    try {
+        std::vector<skye::CaptureRecord> records;
+        {
+            std::FILE* file = std::fopen(options.filename.c_str(), "rb");
+            if (file == nullptr) {
+                throw std::runtime_error{"failed to open " + options.filename};
+            }
+
+            try {
+                records = skye::capture_read(file);
+            } catch (...) {
+                std::fclose(file);
+                throw;
+            }
+            std::fclose(file);
+        }
+
+        const auto streams = make_streams(records);
+
+        asio::io_context ctx{1};
+
+        const auto endpoints =
+            asio::ip::tcp::resolver{ctx}.resolve(options.host, options.port);
+
+        Stats stats;
+        const auto start = clock_type::now();
+        for (const auto& [id, stream] : streams) {
+            co_spawn(
+                ctx, connection(endpoints, stream, start, options.speed, stats),
+                asio::detached);
+        }
+
+        ctx.run();
+
+        const std::chrono::duration<double> elapsed =
+            clock_type::now() - start;
+
+        std::string out;
+        fmt::format_to(
+            std::back_inserter(out),
+            R"({{"file":"{}","speed":{},"connections":{},"duration":{:.3f},)"
+            R"("requests":{},"errors":{},"status_errors":{},"bytes_sent":{},)"
+            R"("rps":{:.1f},"latency_us":)",
+            options.filename, options.speed, streams.size(), elapsed.count(),
+            stats.num_request, stats.num_error, stats.num_status_error,
+            stats.bytes_write,
+            static_cast<double>(stats.num_request) / elapsed.count());
+        bench::format_latency(out, stats.latency);
+        out += "}\n";
+
+        std::fputs(out.c_str(), stdout);
+
+        return (stats.num_error == 0) ? 0 : -1;
+    } catch (std::exception& e) {
+        std::fprintf(stderr, "skye-replay: %s\n", e.what());
+    }
+
+    return -1;
+}
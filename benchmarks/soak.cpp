@@ -0,0 +1,619 @@
+//
+// skye-soak, measure server memory per keep alive connection
+//
+// For each connection count fork a server process that runs async_run on a
+// loopback port and a client process that opens the connections. The client is
+// a separate process so its own sockets and buffers are not counted. The server
+// samples its resident set size and malloc heap in use at each phase.
+//
+// - base, listening with no connections.
+// - idle, every connection has completed one request and waits for the next.
+// - active, every connection has a request suspended in the handler.
+//
+// Report the growth from base divided by the number of connections as JSON,
+// one line per connection count. Kernel socket buffers are not in either
+// number. The open file limit is raised to fit the connections, the hard limit
+// may need to be raised first with ulimit -Hn.
+//
+// Usage:
+//
+//   skye-soak                          # 10000, 50000, and 100000 connections
+//   skye-soak --connections 1000,20000
+//
+#include "client.hpp"
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <fmt/format.h>
+#include <skye/buffer_pool.hpp>
+#include <skye/service.hpp>
+
+#include <malloc.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace {
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+using bench::clock_type;
+using bench::default_token;
+using bench::steady_timer;
+using bench::tcp_socket;
+using pipe_descriptor =
+    default_token::as_default_on_t<asio::posix::stream_descriptor>;
+using tcp = asio::ip::tcp;
+// Pick the source port at connect time, a bind to port zero searches the whole
+// ephemeral range on every call
+using bind_address_no_port =
+    asio::detail::socket_option::boolean<IPPROTO_IP, IP_BIND_ADDRESS_NO_PORT>;
+
+// Connections per client source address, below the ephemeral port range
+constexpr int kConnectionPerAddress = 25000;
+// Connects, writes, or reads in flight in the client
+constexpr int kClientConcurrency = 256;
+// Spare descriptors for the listener, pipes, and stdio
+constexpr int kSpareFiles = 64;
+
+constexpr std::string_view kIdleRequest =
+    "GET /idle HTTP/1.1\r\nHost: localhost\r\n\r\n";
+constexpr std::string_view kHoldRequest =
+    "GET /hold HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+// Client commands and acks over the control pipes
+constexpr char kConnect = 'i';
+constexpr char kHold = 'a';
+constexpr char kRelease = 'r';
+constexpr char kClose = 'c';
+constexpr char kAckOk = 'k';
+constexpr char kAckError = 'e';
+
+struct Options {
+    std::vector<int> connections{10000, 50000, 100000};
+};
+
+struct Memory {
+    std::int64_t rss{};
+    std::int64_t heap{};
+};
+
+/// Resident set size from /proc/self/status and malloc bytes in use.
+Memory sample_memory()
+{
+    Memory mem;
+
+    std::ifstream status{"/proc/self/status"};
+    for (std::string line; std::getline(status, line);) {
+        if (line.starts_with("VmRSS:")) {
+            mem.rss = std::atoll(line.c_str() + 6) * 1024;
+            break;
+        }
+    }
+
+#if defined(__GLIBC__) && ((__GLIBC__ > 2) || (__GLIBC_MINOR__ >= 33))
+    const auto info = mallinfo2();
+    mem.heap = static_cast<std::int64_t>(info.uordblks + info.hblkhd);
+#else
+    mem.heap = -1;
+#endif
+
+    return mem;
+}
+
+/// Raise the open file limit to fit the connections, or throw.
+void raise_file_limit(int num_connection)
+{
+    const auto want = static_cast<rlim_t>(num_connection + kSpareFiles);
+
+    rlimit limit{};
+    if (::getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        throw std::runtime_error{"getrlimit failed"};
+    }
+
+    if (limit.rlim_cur >= want) {
+        return;
+    }
+
+    // Raising the hard limit requires CAP_SYS_RESOURCE, try it first
+    rlimit raised{want, std::max(want, limit.rlim_max)};
+    if (::setrlimit(RLIMIT_NOFILE, &raised) == 0) {
+        return;
+    }
+
+    raised = {std::min(want, limit.rlim_max), limit.rlim_max};
+    if ((raised.rlim_cur < want) ||
+        (::setrlimit(RLIMIT_NOFILE, &raised) != 0)) {
+        throw std::runtime_error{fmt::format(
+            "open file limit {} is below {}, raise it with ulimit -Hn",
+            limit.rlim_max, want)};
+    }
+}
+
+struct Listener {
+    int fd{-1};
+    int port{};
+};
+
+/**
+  Bind a free loopback port and listen on it. The server process inherits the
+  socket, so no other process can take the port before the server accepts.
+*/
+Listener listen_loopback()
+{
+    asio::io_context ctx;
+    tcp::acceptor acceptor{
+        ctx, tcp::endpoint{asio::ip::address_v4::loopback(), 0}};
+
+    const int port = acceptor.local_endpoint().port();
+
+    return {acceptor.release(), port};
+}
+
+//
+// Server process
+//
+
+struct Server {
+    explicit Server(asio::io_context& ctx) : gate{ctx}
+    {
+        gate.expires_at(clock_type::time_point::max());
+    }
+
+    // Held requests wait here until the active sample is taken
+    steady_timer gate;
+    int num_request{};
+    int num_hold{};
+    int num_closed{};
+};
+
+asio::awaitable<void>
+wait_until(std::function<bool()> done, clock_type::duration timeout)
+{
+    using namespace std::chrono_literals;
+
+    steady_timer timer{co_await asio::this_coro::executor};
+    const auto deadline = clock_type::now() + timeout;
+    while (!done()) {
+        if (clock_type::now() > deadline) {
+            throw std::runtime_error{"timed out waiting for the client"};
+        }
+
+        timer.expires_after(10ms);
+        co_await timer.async_wait();
+    }
+}
+
+/// Send one command to the client and wait for its ack.
+asio::awaitable<void>
+command(pipe_descriptor& cmd, pipe_descriptor& ack, char code)
+{
+    auto [write_ec, bytes_write] =
+        co_await asio::async_write(cmd, asio::buffer(&code, 1));
+    if (write_ec) {
+        throw boost::system::system_error{write_ec};
+    }
+
+    char reply = 0;
+    auto [read_ec, bytes_read] =
+        co_await asio::async_read(ack, asio::buffer(&reply, 1));
+    if (read_ec || (reply != kAckOk)) {
+        throw std::runtime_error{"client failed"};
+    }
+}
+
+void format_phases(
+    std::string& out, std::string_view name, std::int64_t Memory::*field,
+    const Memory& base, const Memory& idle, const Memory& active,
+    int num_connection)
+{
+    const auto per = [&](const Memory& mem) {
+        return static_cast<double>(mem.*field - base.*field) / num_connection;
+    };
+
+    fmt::format_to(
+        std::back_inserter(out),
+        R"("{}":{{"base":{},"idle":{},"active":{}}},)"
+        R"("{}_per_connection":{{"idle":{:.1f},"active":{:.1f}}})",
+        name, base.*field, idle.*field, active.*field, name, per(idle),
+        per(active));
+}
+
+asio::awaitable<void> control(
+    Server& server, int num_connection, int cmd_fd, int ack_fd,
+    asio::io_context& ctx)
+{
+    using namespace std::chrono_literals;
+
+    const auto ex = co_await asio::this_coro::executor;
+    pipe_descriptor cmd{ex, cmd_fd};
+    pipe_descriptor ack{ex, ack_fd};
+
+    const auto timeout = 60s + num_connection * 1ms;
+
+    const Memory base = sample_memory();
+
+    const auto start = clock_type::now();
+    co_await command(cmd, ack, kConnect);
+    co_await wait_until(
+        [&]() { return server.num_request >= num_connection; }, timeout);
+    const std::chrono::duration<double> connect_time =
+        clock_type::now() - start;
+
+    const Memory idle = sample_memory();
+
+    co_await command(cmd, ack, kHold);
+    co_await wait_until(
+        [&]() { return server.num_hold >= num_connection; }, timeout);
+
+    const Memory active = sample_memory();
+
+    server.gate.cancel();
+    co_await command(cmd, ack, kRelease);
+    co_await command(cmd, ack, kClose);
+    co_await wait_until(
+        [&]() { return server.num_closed >= num_connection; }, timeout);
+
+    std::string out;
+    fmt::format_to(
+        std::back_inserter(out),
+        R"({{"connections":{},"connect_time":{:.3f},)", num_connection,
+        connect_time.count());
+    format_phases(
+        out, "rss", &Memory::rss, base, idle, active, num_connection);
+    out += ",";
+    format_phases(
+        out, "heap", &Memory::heap, base, idle, active, num_connection);
+    fmt::format_to(
+        std::back_inserter(out), R"(,"pool_cached":{}}})",
+        skye::detail::BufferPool::local().cached_bytes());
+    out += "\n";
+
+    std::fputs(out.c_str(), stdout);
+    std::fflush(stdout);
+
+    ctx.stop();
+}
+
+int run_server(int listener_fd, int num_connection, int cmd_fd, int ack_fd)
+{
+    raise_file_limit(num_connection);
+
+    asio::io_context ctx{1};
+    Server server{ctx};
+
+    auto handler = [&server](skye::request req)
+        -> asio::awaitable<skye::response> {
+        if (req.target() == "/hold") {
+            ++server.num_hold;
+            co_await server.gate.async_wait();
+        }
+
+        ++server.num_request;
+
+        skye::response res{http::status::ok, req.version()};
+        res.body() = "ok";
+
+        co_return res;
+    };
+
+    auto reporter = [&server](const skye::SessionMetrics& /*metrics*/) {
+        ++server.num_closed;
+    };
+
+    skye::async_run(
+        ctx, skye::listen_fd<tcp>{tcp::v4(), listener_fd}, handler, reporter);
+
+    co_spawn(
+        ctx, control(server, num_connection, cmd_fd, ack_fd, ctx),
+        [](auto ptr) {
+            if (ptr) {
+                std::rethrow_exception(ptr);
+            }
+        });
+
+    ctx.run();
+
+    return 0;
+}
+
+//
+// Client process
+//
+
+struct Client {
+    Client(asio::io_context& ctx, int port, int run, int num_connection)
+        : port{port}, run{run}
+    {
+        sockets.reserve(static_cast<std::size_t>(num_connection));
+        for (int i = 0; i < num_connection; ++i) {
+            sockets.emplace_back(ctx);
+        }
+        buffers.resize(sockets.size());
+    }
+
+    int port;
+    int run;
+    std::vector<tcp_socket> sockets;
+    std::vector<boost::beast::flat_buffer> buffers;
+    std::size_t next{};
+    int num_error{};
+};
+
+/**
+  Source address for connection i. Each run uses a new subnet so the ports in
+  TIME_WAIT from the previous run are not in the way.
+*/
+asio::ip::address_v4 source_address(int run, int i)
+{
+    const auto host = static_cast<std::uint32_t>(1 + i / kConnectionPerAddress);
+    const auto subnet = static_cast<std::uint32_t>(run + 1);
+
+    return asio::ip::address_v4{(127u << 24) | (subnet << 8) | host};
+}
+
+asio::awaitable<bool> connect_step(Client& client, std::size_t i)
+{
+    auto& socket = client.sockets[i];
+
+    boost::system::error_code ec;
+    socket.open(tcp::v4(), ec);
+    if (!ec) {
+        socket.set_option(bind_address_no_port{true}, ec);
+    }
+    if (!ec) {
+        // Otherwise our ports in TIME_WAIT block the next server from binding
+        socket.set_option(tcp::socket::reuse_address{true}, ec);
+    }
+    if (!ec) {
+        socket.bind({source_address(client.run, static_cast<int>(i)), 0}, ec);
+    }
+    if (ec) {
+        co_return false;
+    }
+
+    auto [connect_ec] = co_await socket.async_connect(
+        {asio::ip::address_v4::loopback(),
+         static_cast<asio::ip::port_type>(client.port)});
+    if (connect_ec) {
+        co_return false;
+    }
+
+    socket.set_option(tcp::no_delay{true}, ec);
+
+    auto [write_ec, bytes_write] =
+        co_await asio::async_write(socket, asio::buffer(kIdleRequest));
+    if (write_ec) {
+        co_return false;
+    }
+
+    http::response<http::string_body> res;
+    auto [read_ec, bytes_read] =
+        co_await http::async_read(socket, client.buffers[i], res);
+
+    co_return !read_ec && (res.result() == http::status::ok);
+}
+
+asio::awaitable<bool> hold_step(Client& client, std::size_t i)
+{
+    auto [ec, n] = co_await asio::async_write(
+        client.sockets[i], asio::buffer(kHoldRequest));
+
+    co_return !ec;
+}
+
+asio::awaitable<bool> release_step(Client& client, std::size_t i)
+{
+    http::response<http::string_body> res;
+    auto [ec, n] = co_await http::async_read(
+        client.sockets[i], client.buffers[i], res);
+
+    co_return !ec && (res.result() == http::status::ok);
+}
+
+/// Worker that runs one step on the next connection until all are done.
+asio::awaitable<void> worker(
+    Client& client,
+    asio::awaitable<bool> (*step)(Client& client, std::size_t i))
+{
+    while (client.next < client.sockets.size()) {
+        const std::size_t i = client.next++;
+        if (!co_await step(client, i)) {
+            ++client.num_error;
+        }
+    }
+}
+
+int run_client(int port, int run, int num_connection, int cmd_fd, int ack_fd)
+{
+    raise_file_limit(num_connection);
+
+    asio::io_context ctx{1};
+    Client client{ctx, port, run, num_connection};
+
+    for (;;) {
+        char code = 0;
+        if (::read(cmd_fd, &code, 1) != 1) {
+            return -1;
+        }
+
+        if (code == kClose) {
+            for (auto& socket : client.sockets) {
+                boost::system::error_code ec;
+                socket.close(ec);
+            }
+        } else {
+            auto* step = (code == kConnect) ? &connect_step
+                         : (code == kHold)  ? &hold_step
+                                            : &release_step;
+
+            client.next = 0;
+            for (int i = 0; i < kClientConcurrency; ++i) {
+                co_spawn(ctx, worker(client, step), asio::detached);
+            }
+
+            ctx.run();
+            ctx.restart();
+        }
+
+        const char reply = (client.num_error == 0) ? kAckOk : kAckError;
+        if (::write(ack_fd, &reply, 1) != 1) {
+            return -1;
+        }
+
+        if ((code == kClose) || (client.num_error > 0)) {
+            return (client.num_error == 0) ? 0 : -1;
+        }
+    }
+}
+
+//
+// Driver
+//
+
+/// Fork a child process that runs fn and exits with its result.
+pid_t spawn(std::function<int()> fn)
+{
+    std::fflush(stdout);
+
+    const pid_t pid = ::fork();
+    if (pid < 0) {
+        throw std::runtime_error{"fork failed"};
+    }
+
+    if (pid == 0) {
+        int result = -1;
+        try {
+            result = fn();
+        } catch (std::exception& e) {
+            std::fprintf(stderr, "skye-soak: %s\n", e.what());
+        }
+        std::fflush(stdout);
+        ::_exit((result == 0) ? 0 : 1);
+    }
+
+    return pid;
+}
+
+bool wait_child(pid_t pid)
+{
+    int status = 0;
+    return (::waitpid(pid, &status, 0) == pid) && WIFEXITED(status) &&
+           (WEXITSTATUS(status) == 0);
+}
+
+bool soak(int run, int num_connection)
+{
+    const Listener listener = listen_loopback();
+
+    // Server to client commands and client to server acks
+    int cmd[2] = {};
+    int ack[2] = {};
+    if ((::pipe(cmd) != 0) || (::pipe(ack) != 0)) {
+        throw std::runtime_error{"pipe failed"};
+    }
+
+    const pid_t server = spawn([&]() {
+        ::close(cmd[0]);
+        ::close(ack[1]);
+        return run_server(listener.fd, num_connection, cmd[1], ack[0]);
+    });
+
+    const pid_t client = spawn([&]() {
+        ::close(cmd[1]);
+        ::close(ack[0]);
+        ::close(listener.fd);
+        return run_client(listener.port, run, num_connection, cmd[0], ack[1]);
+    });
+
+    for (int fd : {listener.fd, cmd[0], cmd[1], ack[0], ack[1]}) {
+        ::close(fd);
+    }
+
+    const bool server_ok = wait_child(server);
+    const bool client_ok = wait_child(client);
+
+    return server_ok && client_ok;
+}
+
+void usage()
+{
+    std::fputs(
+        "usage: skye-soak [options]\n"
+        "  --connections N,N,...  connection counts (10000,50000,100000)\n",
+        stderr);
+}
+
+bool parse_options(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        const std::string_view name = argv[i];
+        if (i + 1 == argc) {
+            return false;
+        }
+
+        const std::string_view value = argv[++i];
+        if (name == "--connections") {
+            options.connections.clear();
+            for (std::size_t pos = 0; pos <= value.size();) {
+                const std::size_t end =
+                    std::min(value.find(',', pos), value.size());
+                options.connections.push_back(
+                    std::atoi(std::string{value.substr(pos, end - pos)}
+                                  .c_str()));
+                pos = end + 1;
+            }
+        } else {
+            return false;
+        }
+    }
+
+    return !options.connections.empty() &&
+           std::ranges::all_of(options.connections, [](int n) {
+               return n > 0;
+           });
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!parse_options(argc, argv, options)) {
+        usage();
+        return -1;
+    }
+
+    try {
+        bool ok = true;
+        for (std::size_t i = 0; i < options.connections.size(); ++i) {
+            if (!soak(static_cast<int>(i), options.connections[i])) {
+                std::fprintf(
+                    stderr, "skye-soak: run with %d connections failed\n",
+                    options.connections[i]);
+                ok = false;
+            }
+        }
+
+        return ok ? 0 : -1;
+    } catch (std::exception& e) {
+        std::fprintf(stderr, "skye-soak: %s\n", e.what());
+    }
+
+    return -1;
+}
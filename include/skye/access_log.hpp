@@ -0,0 +1,274 @@
+//
+// skye/access_log.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Asynchronous access log. The session copies a fixed size RequestMetrics record
+  into a lock free ring buffer. A background thread formats the records as JSON
+  lines and writes them in large batches, so the I/O thread never formats or
+  blocks on a write.
+
+  Usage:
+
+  skye::AccessLog log;
+
+  // Log one JSON line per request to stdout
+  run(8080, handler, log.reporter());
+*/
+#ifndef SKYE_ACCESS_LOG_HPP_
+#define SKYE_ACCESS_LOG_HPP_
+
+#include <skye/format.hpp>
+#include <skye/types.hpp>
+
+#include <fmt/core.h>
+#include <fmt/format.h>
+
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+namespace skye {
+
+/**
+  Bounded multiple producer, single consumer queue of RequestMetrics records.
+  Each cell has a sequence number that tells the producers and the consumer
+  whose turn it is, as in the Vyukov bounded queue. Producers never block, push
+  fails if the ring is full.
+
+  https://www.1024cores.net/home/lock-free-algorithms/queues/bounded-mpmc-queue
+*/
+class AccessLogRing {
+public:
+    /// Capacity is rounded up to a power of two.
+    explicit AccessLogRing(std::size_t capacity)
+        : mask_{std::bit_ceil(capacity < 2 ? 2 : capacity) - 1},
+          cells_{std::make_unique<Cell[]>(mask_ + 1)}
+    {
+        for (std::size_t i = 0; i <= mask_; ++i) {
+            cells_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    bool push(const RequestMetrics& record) noexcept
+    {
+        std::size_t pos = tail_.load(std::memory_order_relaxed);
+        for (;;) {
+            Cell& cell = cells_[pos & mask_];
+            const std::size_t seq =
+                cell.sequence.load(std::memory_order_acquire);
+            const auto diff =
+                static_cast<std::ptrdiff_t>(seq) -
+                static_cast<std::ptrdiff_t>(pos);
+
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    cell.record = record;
+                    cell.sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /// Single consumer only.
+    bool pop(RequestMetrics& record) noexcept
+    {
+        Cell& cell = cells_[head_ & mask_];
+        if (cell.sequence.load(std::memory_order_acquire) != head_ + 1) {
+            return false;
+        }
+
+        record = cell.record;
+        cell.sequence.store(head_ + mask_ + 1, std::memory_order_release);
+        ++head_;
+
+        return true;
+    }
+
+    [[nodiscard]] std::size_t capacity() const noexcept
+    {
+        return mask_ + 1;
+    }
+
+private:
+    // Keep producers and the consumer off each other's cache lines
+    static constexpr std::size_t kCacheLine = 64;
+
+    struct Cell {
+        std::atomic<std::size_t> sequence;
+        RequestMetrics record;
+    };
+
+    std::size_t mask_;
+    std::unique_ptr<Cell[]> cells_;
+    alignas(kCacheLine) std::atomic<std::size_t> tail_{0};
+    alignas(kCacheLine) std::size_t head_{0};
+};
+
+/**
+  Access log with a background writer thread. Records that do not fit in the
+  ring are dropped and counted, the I/O thread never waits for the writer.
+
+  The writer wakes up every flush interval, formats all pending records into one
+  preallocated buffer, and writes it with one call. The destructor writes any
+  records still in the ring.
+*/
+class AccessLog {
+public:
+    static constexpr std::size_t kDefaultCapacity = 1 << 16;
+    static constexpr std::chrono::milliseconds kDefaultFlushInterval{100};
+
+    /**
+      Reporter function object for session(...) and run(...). Refers to the log,
+      which must outlive the server.
+    */
+    class Reporter {
+    public:
+        explicit Reporter(AccessLog& log) : log_{&log}
+        {
+        }
+
+        void operator()(const RequestMetrics& metrics) const noexcept
+        {
+            log_->push(metrics);
+        }
+
+    private:
+        AccessLog* log_;
+    };
+
+    explicit AccessLog(
+        std::FILE* file = stdout, std::size_t capacity = kDefaultCapacity,
+        std::chrono::milliseconds flush_interval = kDefaultFlushInterval)
+        : file_{file}, flush_interval_{flush_interval}, ring_{capacity}
+    {
+        writer_ = std::thread{[this]() { run(); }};
+    }
+
+    AccessLog(const AccessLog&) = delete;
+    AccessLog& operator=(const AccessLog&) = delete;
+
+    ~AccessLog()
+    {
+        {
+            const std::lock_guard lock{mutex_};
+            stop_ = true;
+        }
+        wakeup_.notify_one();
+        writer_.join();
+    }
+
+    /// Hot path. Copy one record into the ring or count it as dropped.
+    bool push(const RequestMetrics& metrics) noexcept
+    {
+        if (!ring_.push(metrics)) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        return true;
+    }
+
+    [[nodiscard]] Reporter reporter()
+    {
+        return Reporter{*this};
+    }
+
+    /// Number of records dropped because the ring was full.
+    [[nodiscard]] std::uint64_t dropped() const noexcept
+    {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+
+    /// Number of records written to the file.
+    [[nodiscard]] std::uint64_t written() const noexcept
+    {
+        return written_.load(std::memory_order_relaxed);
+    }
+
+private:
+    // Write out a batch once the buffer reaches this size
+    static constexpr std::size_t kBatchSize = 1 << 16;
+
+    void run()
+    {
+        fmt::memory_buffer buffer;
+        buffer.reserve(kBatchSize + kBatchSize / 4);
+
+        for (;;) {
+            bool stop = false;
+            {
+                std::unique_lock lock{mutex_};
+                wakeup_.wait_for(
+                    lock, flush_interval_, [this] { return stop_; });
+                stop = stop_;
+            }
+
+            flush(buffer);
+
+            if (stop) {
+                break;
+            }
+        }
+    }
+
+    void flush(fmt::memory_buffer& buffer)
+    {
+        std::uint64_t count = 0;
+
+        RequestMetrics record;
+        while (ring_.pop(record)) {
+            fmt::format_to(std::back_inserter(buffer), "{}\n", record);
+            ++count;
+
+            if (buffer.size() >= kBatchSize) {
+                write(buffer);
+            }
+        }
+
+        write(buffer);
+
+        written_.fetch_add(count, std::memory_order_relaxed);
+    }
+
+    void write(fmt::memory_buffer& buffer)
+    {
+        if (buffer.size() == 0) {
+            return;
+        }
+
+        std::fwrite(buffer.data(), 1, buffer.size(), file_);
+        std::fflush(file_);
+        buffer.clear();
+    }
+
+    std::FILE* file_;
+    std::chrono::milliseconds flush_interval_;
+    AccessLogRing ring_;
+    std::atomic<std::uint64_t> dropped_{0};
+    std::atomic<std::uint64_t> written_{0};
+
+    std::mutex mutex_;
+    std::condition_variable wakeup_;
+    bool stop_{false};
+    std::thread writer_;
+};
+
+} // namespace skye
+
+#endif // SKYE_ACCESS_LOG_HPP_
@@ -0,0 +1,162 @@
+//
+// skye/buffer_pool.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Per thread pool of read buffer blocks in power of two size classes. Sessions
+  allocate their read buffer from the pool and, if idle release is enabled,
+  give it back while the keep alive connection waits for the next request.
+
+  The pool is a cache in front of operator new. A block may be freed on another
+  thread than the one that allocated it, it then goes to that thread's pool.
+
+  Usage:
+
+  // Read buffer that allocates from the pool of the current thread
+  skye::pooled_flat_buffer buffer{skye::kRequestSizeLimit};
+
+  // Drop the storage back in the pool while idle
+  buffer.shrink_to_fit();
+*/
+#ifndef SKYE_BUFFER_POOL_HPP_
+#define SKYE_BUFFER_POOL_HPP_
+
+#include <boost/beast/core/flat_buffer.hpp>
+
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace skye {
+
+namespace detail {
+
+class BufferPool {
+public:
+    // Size classes from 512 bytes to 1 MB
+    static constexpr std::size_t kMinSizeLog2 = 9;
+    static constexpr std::size_t kNumClass = 12;
+    // Free bytes cached per size class
+    static constexpr std::size_t kMaxFreeBytes = std::size_t{1} << 21;
+
+    BufferPool() = default;
+
+    BufferPool(const BufferPool&) = delete;
+    BufferPool& operator=(const BufferPool&) = delete;
+
+    ~BufferPool()
+    {
+        for (auto& free : free_) {
+            for (void* ptr : free) {
+                ::operator delete(ptr);
+            }
+        }
+    }
+
+    void* allocate(std::size_t n)
+    {
+        const std::size_t index = size_class(n);
+        if (index >= kNumClass) {
+            return ::operator new(n);
+        }
+
+        auto& free = free_[index];
+        if (free.empty()) {
+            return ::operator new(class_size(index));
+        }
+
+        void* ptr = free.back();
+        free.pop_back();
+        cached_bytes_ -= class_size(index);
+
+        return ptr;
+    }
+
+    void deallocate(void* ptr, std::size_t n) noexcept
+    {
+        const std::size_t index = size_class(n);
+        if (index < kNumClass) {
+            auto& free = free_[index];
+            if (free.size() * class_size(index) < kMaxFreeBytes) {
+                try {
+                    free.push_back(ptr);
+                    cached_bytes_ += class_size(index);
+                    return;
+                } catch (...) {
+                }
+            }
+        }
+
+        ::operator delete(ptr);
+    }
+
+    /// Bytes held in free blocks on this thread.
+    [[nodiscard]] std::size_t cached_bytes() const noexcept
+    {
+        return cached_bytes_;
+    }
+
+    static BufferPool& local()
+    {
+        thread_local BufferPool pool;
+        return pool;
+    }
+
+private:
+    static std::size_t size_class(std::size_t n) noexcept
+    {
+        const std::size_t log2 = std::bit_width(n > 0 ? n - 1 : 0);
+        return (log2 > kMinSizeLog2) ? log2 - kMinSizeLog2 : 0;
+    }
+
+    static std::size_t class_size(std::size_t index) noexcept
+    {
+        return std::size_t{1} << (index + kMinSizeLog2);
+    }
+
+    std::array<std::vector<void*>, kNumClass> free_;
+    std::size_t cached_bytes_{0};
+};
+
+} // namespace detail
+
+/// Allocator for the pool of the current thread.
+template <typename T>
+struct pool_allocator {
+    using value_type = T;
+
+    pool_allocator() noexcept = default;
+
+    template <typename U>
+    // NOLINTNEXTLINE(google-explicit-constructor)
+    pool_allocator(const pool_allocator<U>& /*other*/) noexcept
+    {
+    }
+
+    T* allocate(std::size_t n)
+    {
+        return static_cast<T*>(
+            detail::BufferPool::local().allocate(n * sizeof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t n) noexcept
+    {
+        detail::BufferPool::local().deallocate(ptr, n * sizeof(T));
+    }
+
+    friend bool
+    operator==(const pool_allocator&, const pool_allocator&) noexcept
+    {
+        return true;
+    }
+};
+
+using pooled_flat_buffer =
+    boost::beast::basic_flat_buffer<pool_allocator<char>>;
+
+} // namespace skye
+
+#endif // SKYE_BUFFER_POOL_HPP_
@@ -0,0 +1,120 @@
+//
+// skye/busy_poll.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Low latency run loop for a dedicated core. Spin on io_context::poll for a
+  budget after the last handler ran before the loop blocks in the kernel. A
+  request that arrives within the budget skips the epoll sleep, wake up, and
+  context switch at the cost of a core at 100% CPU.
+
+  Combine with the busy_poll listen option, SO_BUSY_POLL, to also spin on the
+  device queue in the kernel.
+
+  Usage:
+
+  asio::io_context ctx{1};
+
+  skye::listen_options options;
+  options.busy_poll = 50;
+
+  skye::async_run(ctx, 8080, options, handler);
+
+  // Spin for up to 200us after the last event before blocking
+  skye::BusyPollMetrics metrics;
+  skye::run_busy_poll(ctx, std::chrono::microseconds{200}, metrics);
+
+  // Later, e.g. in a /metrics handler on the same thread
+  fmt::print("{}\n", metrics);
+*/
+#ifndef SKYE_BUSY_POLL_HPP_
+#define SKYE_BUSY_POLL_HPP_
+
+#include <skye/types.hpp>
+
+#include <boost/asio/io_context.hpp>
+
+#include <chrono>
+#include <cstddef>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+namespace skye {
+
+namespace asio = boost::asio;
+
+namespace detail {
+
+/// Spin wait hint, lets the sibling hyper thread run and saves power.
+inline void cpu_relax() noexcept
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield");
+#endif
+}
+
+} // namespace detail
+
+/**
+  Run the event loop on this thread until it is stopped or runs out of work,
+  same as io_context::run. Poll for ready handlers and spin while the time
+  since the last one ran is within the budget, then block for the next event.
+
+  Returns the number of handlers that were run. The metrics are updated after
+  every poll so a handler on the same thread may read them.
+*/
+inline std::size_t run_busy_poll(
+    asio::io_context& ctx, std::chrono::nanoseconds budget,
+    BusyPollMetrics& metrics)
+{
+    using clock_type = std::chrono::steady_clock;
+
+    std::size_t num_handler = 0;
+
+    auto idle_start = clock_type::now();
+    while (!ctx.stopped()) {
+        const auto start = clock_type::now();
+        std::size_t n = ctx.poll();
+        const auto end = clock_type::now();
+
+        if (n > 0) {
+            metrics.spin += start - idle_start;
+            metrics.work += end - start;
+            ++metrics.num_poll;
+            metrics.num_handler += n;
+            num_handler += n;
+
+            idle_start = end;
+            continue;
+        }
+
+        if (end - idle_start < budget) {
+            detail::cpu_relax();
+            continue;
+        }
+
+        metrics.spin += end - idle_start;
+
+        // Budget is used up, block in the kernel until the next event
+        n = ctx.run_one();
+        const auto wake = clock_type::now();
+
+        metrics.sleep += wake - end;
+        ++metrics.num_sleep;
+        metrics.num_handler += n;
+        num_handler += n;
+
+        idle_start = wake;
+    }
+
+    return num_handler;
+}
+
+} // namespace skye
+
+#endif // SKYE_BUSY_POLL_HPP_
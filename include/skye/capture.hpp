@@ -0,0 +1,411 @@
+//
+// skye/capture.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Capture the raw request bytes of each connection with timestamps to a compact
+  binary file. Replay the file with the skye-replay tool to reproduce a
+  production request stream on a local server.
+
+  Capture is compiled out unless SKYE_ENABLE_CAPTURE is defined, or the
+  ENABLE_CAPTURE CMake option is on. If enabled, it is off at runtime until
+  capture_start is called. Only sessions that start while the capture is running
+  are recorded.
+
+  File format, all integers in host byte order:
+
+  magic    8 bytes "SKYECAP1"
+  record*  time   uint64, nanoseconds since capture_start
+           id     uint32, connection number, starts at 1
+           size   uint32, followed by size bytes of request data
+
+  A record with size zero marks the end of the connection. Each I/O thread
+  buffers its records and writes them in batches, so the file is only in time
+  order per thread. capture_read sorts the records by time.
+
+  Usage:
+
+  std::FILE* file = std::fopen("capture.bin", "wb");
+  skye::capture_start(file);
+
+  // ... run the server, e.g. for 60 seconds
+
+  skye::capture_stop();
+  std::fclose(file);
+
+  // skye-replay --port 8080 --speed 2 capture.bin
+*/
+#ifndef SKYE_CAPTURE_HPP_
+#define SKYE_CAPTURE_HPP_
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/buffer.hpp>
+#include <boost/asio/compose.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace skye {
+
+namespace asio = boost::asio;
+
+#if defined(SKYE_ENABLE_CAPTURE)
+constexpr bool kEnableCapture = true;
+#else
+constexpr bool kEnableCapture = false;
+#endif
+
+/// One read from a captured connection.
+struct CaptureRecord {
+    std::chrono::nanoseconds time{};
+    std::uint32_t id{};
+    std::string data;
+};
+
+namespace detail {
+
+constexpr std::string_view kCaptureMagic = "SKYECAP1";
+constexpr std::size_t kCaptureHeaderSize = 16;
+
+/**
+  Records written on one thread. The I/O thread appends to its own buffer and
+  only takes the file lock once the buffer reaches the batch size. The buffer
+  lock is uncontended except when capture_stop flushes it.
+*/
+struct CaptureBuffer {
+    std::mutex mutex;
+    std::string data;
+};
+
+struct CaptureState {
+    std::atomic<bool> enabled{false};
+    std::atomic<std::uint32_t> next_id{0};
+    std::atomic<std::chrono::steady_clock::rep> start_time{0};
+
+    // Guards the file and the list of thread buffers. Lock order is buffer
+    // first, then state.
+    std::mutex mutex;
+    std::FILE* file{nullptr};
+    std::vector<std::shared_ptr<CaptureBuffer>> buffers;
+};
+
+inline CaptureState& capture_state()
+{
+    static CaptureState state;
+    return state;
+}
+
+// Write out a thread buffer once it reaches this size
+constexpr std::size_t kCaptureBatchSize = 1 << 16;
+
+inline CaptureBuffer& capture_buffer()
+{
+    thread_local const std::shared_ptr<CaptureBuffer> buffer = [] {
+        auto ptr = std::make_shared<CaptureBuffer>();
+        ptr->data.reserve(kCaptureBatchSize + kCaptureBatchSize / 4);
+
+        auto& state = capture_state();
+        const std::lock_guard lock{state.mutex};
+        state.buffers.push_back(ptr);
+
+        return ptr;
+    }();
+
+    return *buffer;
+}
+
+/// Write out the buffer and clear it. Caller holds the buffer lock.
+inline void capture_flush(CaptureBuffer& buffer)
+{
+    if (buffer.data.empty()) {
+        return;
+    }
+
+    auto& state = capture_state();
+    {
+        const std::lock_guard lock{state.mutex};
+        if (state.file != nullptr) {
+            std::fwrite(buffer.data.data(), 1, buffer.data.size(), state.file);
+        }
+    }
+
+    buffer.data.clear();
+}
+
+/**
+  Append one record to the buffer of this thread. Records from different
+  threads reach the file in batches, so the file is not in time order.
+*/
+template <typename ConstBufferSequence>
+void capture_write(
+    std::uint32_t id, const ConstBufferSequence& buffers, std::size_t size)
+{
+    auto& state = capture_state();
+    auto& buffer = capture_buffer();
+    const std::lock_guard lock{buffer.mutex};
+
+    if (!state.enabled.load(std::memory_order_acquire)) {
+        return;
+    }
+
+    const auto start = std::chrono::steady_clock::time_point{
+        std::chrono::steady_clock::duration{
+            state.start_time.load(std::memory_order_relaxed)}};
+    const std::uint64_t time =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start)
+            .count();
+    const auto size32 = static_cast<std::uint32_t>(size);
+
+    std::array<char, kCaptureHeaderSize> header{};
+    std::memcpy(header.data(), &time, sizeof(time));
+    std::memcpy(header.data() + 8, &id, sizeof(id));
+    std::memcpy(header.data() + 12, &size32, sizeof(size32));
+    buffer.data.append(header.data(), header.size());
+
+    for (auto it = asio::buffer_sequence_begin(buffers);
+         (it != asio::buffer_sequence_end(buffers)) && (size > 0); ++it) {
+        const asio::const_buffer buf{*it};
+        const std::size_t n = std::min(buf.size(), size);
+        buffer.data.append(static_cast<const char*>(buf.data()), n);
+        size -= n;
+    }
+
+    if (buffer.data.size() >= kCaptureBatchSize) {
+        capture_flush(buffer);
+    }
+}
+
+} // namespace detail
+
+/**
+  Start recording new sessions to the file. The caller owns the file, keep it
+  open until after capture_stop.
+*/
+inline void capture_start(std::FILE* file)
+{
+    auto& state = detail::capture_state();
+    const std::lock_guard lock{state.mutex};
+
+    std::fwrite(
+        detail::kCaptureMagic.data(), 1, detail::kCaptureMagic.size(), file);
+
+    state.file = file;
+    state.start_time.store(
+        std::chrono::steady_clock::now().time_since_epoch().count(),
+        std::memory_order_relaxed);
+    state.next_id.store(0, std::memory_order_relaxed);
+    state.enabled.store(true, std::memory_order_release);
+}
+
+/// Stop recording, write out the buffers of all threads, and flush the file.
+inline void capture_stop()
+{
+    auto& state = detail::capture_state();
+
+    std::vector<std::shared_ptr<detail::CaptureBuffer>> buffers;
+    {
+        const std::lock_guard lock{state.mutex};
+        state.enabled.store(false, std::memory_order_relaxed);
+
+        // Forget the buffers of threads that have exited once they are written
+        buffers.swap(state.buffers);
+        for (const auto& ptr : buffers) {
+            if (ptr.use_count() > 1) {
+                state.buffers.push_back(ptr);
+            }
+        }
+    }
+
+    // A writer checks the enabled flag under its buffer lock, so once we have
+    // held each lock no more records are appended
+    for (const auto& buffer : buffers) {
+        const std::lock_guard lock{buffer->mutex};
+        detail::capture_flush(*buffer);
+    }
+
+    const std::lock_guard lock{state.mutex};
+    if (state.file != nullptr) {
+        std::fflush(state.file);
+        state.file = nullptr;
+    }
+}
+
+[[nodiscard]] inline bool capture_enabled() noexcept
+{
+    return detail::capture_state().enabled.load(std::memory_order_relaxed);
+}
+
+/**
+  Read all records from a capture file, sorted by time. Throws if the file is
+  not a capture.
+*/
+inline std::vector<CaptureRecord> capture_read(std::FILE* file)
+{
+    std::array<char, detail::kCaptureHeaderSize> header{};
+    if ((std::fread(header.data(), 1, detail::kCaptureMagic.size(), file) !=
+         detail::kCaptureMagic.size()) ||
+        (std::string_view{header.data(), detail::kCaptureMagic.size()} !=
+         detail::kCaptureMagic)) {
+        throw std::runtime_error{"not a skye capture file"};
+    }
+
+    std::vector<CaptureRecord> records;
+    while (std::fread(header.data(), 1, header.size(), file) ==
+           header.size()) {
+        std::uint64_t time = 0;
+        std::uint32_t size = 0;
+
+        auto& record = records.emplace_back();
+        std::memcpy(&time, header.data(), sizeof(time));
+        std::memcpy(&record.id, header.data() + 8, sizeof(record.id));
+        std::memcpy(&size, header.data() + 12, sizeof(size));
+
+        record.time = std::chrono::nanoseconds{time};
+        record.data.resize(size);
+        if (std::fread(record.data.data(), 1, size, file) != size) {
+            throw std::runtime_error{"truncated skye capture file"};
+        }
+    }
+
+    // Threads write their records in batches, restore the time order
+    std::stable_sort(
+        records.begin(), records.end(),
+        [](const auto& a, const auto& b) { return a.time < b.time; });
+
+    return records;
+}
+
+/**
+  Stream wrapper that records the bytes of each read to the capture file and
+  forwards everything else to the next layer. The session wraps its stream in
+  one of these if capture is running when the session starts.
+*/
+template <typename AsyncStream>
+class capture_stream {
+public:
+    using next_layer_type = AsyncStream;
+    using executor_type = typename AsyncStream::executor_type;
+    using native_handle_type = typename AsyncStream::native_handle_type;
+    using shutdown_type = typename AsyncStream::shutdown_type;
+
+    static constexpr shutdown_type shutdown_receive =
+        AsyncStream::shutdown_receive;
+    static constexpr shutdown_type shutdown_send = AsyncStream::shutdown_send;
+
+    explicit capture_stream(AsyncStream stream)
+        : next_{std::move(stream)},
+          id_{detail::capture_state().next_id.fetch_add(1) + 1}
+    {
+    }
+
+    capture_stream(capture_stream&& other) noexcept
+        : next_{std::move(other.next_)}, id_{std::exchange(other.id_, 0)}
+    {
+    }
+
+    capture_stream(const capture_stream&) = delete;
+    capture_stream& operator=(const capture_stream&) = delete;
+    capture_stream& operator=(capture_stream&&) = delete;
+
+    ~capture_stream()
+    {
+        if (id_ != 0) {
+            detail::capture_write(id_, asio::const_buffer{}, 0);
+        }
+    }
+
+    template <
+        typename MutableBufferSequence,
+        typename Token = asio::default_completion_token_t<executor_type>>
+    auto
+    async_read_some(const MutableBufferSequence& buffers, Token&& token = {})
+    {
+        return asio::async_compose<
+            Token, void(boost::system::error_code, std::size_t)>(
+            [this, buffers, started = false](
+                auto& self, boost::system::error_code ec = {},
+                std::size_t n = 0) mutable {
+                if (!started) {
+                    started = true;
+                    next_.async_read_some(buffers, std::move(self));
+                    return;
+                }
+
+                if (n > 0) {
+                    detail::capture_write(id_, buffers, n);
+                }
+
+                self.complete(ec, n);
+            },
+            token, next_);
+    }
+
+    template <
+        typename ConstBufferSequence,
+        typename Token = asio::default_completion_token_t<executor_type>>
+    auto
+    async_write_some(const ConstBufferSequence& buffers, Token&& token = {})
+    {
+        return next_.async_write_some(buffers, std::forward<Token>(token));
+    }
+
+    executor_type get_executor()
+    {
+        return next_.get_executor();
+    }
+
+    native_handle_type native_handle()
+    {
+        return next_.native_handle();
+    }
+
+    void shutdown(shutdown_type what, boost::system::error_code& ec)
+    {
+        next_.shutdown(what, ec);
+    }
+
+    void set_option(const auto& option, boost::system::error_code& ec)
+    {
+        next_.set_option(option, ec);
+    }
+
+    next_layer_type& next_layer() noexcept
+    {
+        return next_;
+    }
+
+private:
+    AsyncStream next_;
+    std::uint32_t id_;
+};
+
+namespace detail {
+
+template <typename T>
+struct is_capture_stream : std::false_type {};
+
+template <typename AsyncStream>
+struct is_capture_stream<capture_stream<AsyncStream>> : std::true_type {};
+
+} // namespace detail
+
+} // namespace skye
+
+#endif // SKYE_CAPTURE_HPP_
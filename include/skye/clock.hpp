@@ -0,0 +1,183 @@
+//
+// skye/clock.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Cheap monotonic clocks for timing that stays enabled in production. All of the
+  clocks meet the std::chrono Clock requirements and count in nanoseconds.
+
+  - std::chrono::steady_clock, the default. Usually a vDSO call, ~20ns.
+  - coarse_clock, CLOCK_MONOTONIC_COARSE on Linux. Resolution of one kernel
+    tick, 1-4ms, but only reads a value from shared memory.
+  - tsc_clock, the x86 time stamp counter. Resolution of ~1ns and no system
+    call. Assumes an invariant TSC that is synchronized across cores, which is
+    true on any recent x86 server.
+
+  The phase_clock alias picks one at compile time. Define SKYE_PHASE_CLOCK_TSC
+  or SKYE_PHASE_CLOCK_COARSE, or use the PHASE_TIMING_CLOCK CMake option.
+
+  Usage:
+
+  const auto start = skye::phase_clock::now();
+  // ...
+  const auto elapsed = skye::phase_clock::now() - start;
+*/
+#ifndef SKYE_CLOCK_HPP_
+#define SKYE_CLOCK_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+
+#if defined(__linux__)
+#include <time.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define SKYE_HAS_TSC_CLOCK 1
+#elif defined(_M_X64)
+#include <intrin.h>
+#define SKYE_HAS_TSC_CLOCK 1
+#endif
+
+namespace skye {
+
+#if defined(__linux__)
+
+/**
+  Monotonic clock with coarse resolution. Use it to measure phases that take
+  milliseconds, or to count work in aggregate over many requests.
+*/
+struct coarse_clock {
+    using duration = std::chrono::nanoseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<coarse_clock>;
+
+    static constexpr bool is_steady = true;
+
+    static time_point now() noexcept
+    {
+        timespec ts{};
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+
+        return time_point{
+            std::chrono::seconds{ts.tv_sec} +
+            std::chrono::nanoseconds{ts.tv_nsec}};
+    }
+};
+
+#else
+
+using coarse_clock = std::chrono::steady_clock;
+
+#endif // __linux__
+
+#if defined(SKYE_HAS_TSC_CLOCK)
+
+/**
+  Clock that reads the time stamp counter. The tick rate is measured against
+  the steady clock once, in calibrate, which sleeps for 10ms. It runs during
+  static initialization when tsc_clock is the phase_clock. Otherwise call it at
+  startup, now() only calibrates if nobody did.
+
+  Ticks since calibration are scaled in 32.32 fixed point, so the result keeps
+  nanosecond precision for any uptime.
+*/
+struct tsc_clock {
+    using duration = std::chrono::nanoseconds;
+    using rep = duration::rep;
+    using period = duration::period;
+    using time_point = std::chrono::time_point<tsc_clock>;
+
+    static constexpr bool is_steady = true;
+
+    static time_point now() noexcept
+    {
+        if (!calibrated_.load(std::memory_order_acquire)) [[unlikely]] {
+            calibrate();
+        }
+
+        const std::uint64_t ticks = __rdtsc() - base_tick_;
+
+        return time_point{
+            duration{base_ns_ + static_cast<rep>(scale(ticks, multiplier_))}};
+    }
+
+    /// Measure the tick rate. Blocks for 10ms the first time only.
+    static void calibrate() noexcept
+    {
+        static std::once_flag once;
+        std::call_once(once, []() {
+            constexpr std::chrono::milliseconds kCalibrateTime{10};
+
+            const auto start = std::chrono::steady_clock::now();
+            const std::uint64_t start_tick = __rdtsc();
+
+            std::this_thread::sleep_for(kCalibrateTime);
+
+            const std::uint64_t end_tick = __rdtsc();
+            const auto end = std::chrono::steady_clock::now();
+
+            const std::chrono::duration<double, std::nano> elapsed =
+                end - start;
+            const double ns_per_tick =
+                elapsed.count() / static_cast<double>(end_tick - start_tick);
+
+            base_tick_ = start_tick;
+            base_ns_ = std::chrono::duration_cast<duration>(
+                           start.time_since_epoch())
+                           .count();
+            multiplier_ = static_cast<std::uint64_t>(
+                ns_per_tick * static_cast<double>(std::uint64_t{1} << kShift));
+
+            calibrated_.store(true, std::memory_order_release);
+        });
+    }
+
+private:
+    static constexpr int kShift = 32;
+
+    /// (ticks * multiplier) >> 32 without a 128 bit product.
+    static std::uint64_t
+    scale(std::uint64_t ticks, std::uint64_t multiplier) noexcept
+    {
+        constexpr std::uint64_t kLow = (std::uint64_t{1} << kShift) - 1;
+
+        const std::uint64_t high = ticks >> kShift;
+        const std::uint64_t low = ticks & kLow;
+
+        return high * multiplier + low * (multiplier >> kShift) +
+               ((low * (multiplier & kLow)) >> kShift);
+    }
+
+    inline static std::atomic<bool> calibrated_{false};
+    inline static std::uint64_t base_tick_{};
+    inline static rep base_ns_{};
+    inline static std::uint64_t multiplier_{};
+};
+
+#endif // SKYE_HAS_TSC_CLOCK
+
+#if defined(SKYE_PHASE_CLOCK_TSC) && defined(SKYE_HAS_TSC_CLOCK)
+using phase_clock = tsc_clock;
+
+namespace detail {
+
+// Calibrate before main, not in the first timed request
+inline const bool tsc_calibrated = (tsc_clock::calibrate(), true);
+
+} // namespace detail
+#elif defined(SKYE_PHASE_CLOCK_COARSE)
+using phase_clock = coarse_clock;
+#else
+using phase_clock = std::chrono::steady_clock;
+#endif
+
+} // namespace skye
+
+#endif // SKYE_CLOCK_HPP_
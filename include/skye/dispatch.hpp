@@ -0,0 +1,479 @@
+//
+// skye/dispatch.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Spread connections over N single threaded I/O contexts from one acceptor.
+  Each accepted socket is released from the acceptor context and assigned to
+  the least loaded context in the pool, where its session runs for the life of
+  the connection.
+
+  Compared to one io_context shared by N threads there is no contention on one
+  handler queue. Compared to one SO_REUSEPORT listener per thread the choice is
+  made from the current load and not a hash of the client address, so long
+  lived keep alive connections of different costs stay balanced.
+
+  Load is one of:
+  - sessions, the number of open connections on the context.
+  - handler_time, the handler wall time on the context over the last second or
+    so. A new session is charged the average handler time per open session
+    until its own time shows up, so a burst of connections is spread out. Ties
+    go to fewer sessions.
+
+  Usage:
+
+  // Four I/O threads, balance by the time spent in handlers
+  skye::DispatchPool pool{4, skye::DispatchLoad::handler_time};
+
+  // Accept on this thread
+  asio::io_context ctx{1};
+  skye::async_dispatch(ctx, pool, 8080, {}, handler);
+
+  ctx.run();
+
+  // Later, stop accepting and drain the sessions on the pool
+  skye::async_drain(ctx, pool, std::chrono::seconds{30}, [&](const auto& m) {
+    ctx.stop();
+    pool.stop();
+  });
+*/
+#ifndef SKYE_DISPATCH_HPP_
+#define SKYE_DISPATCH_HPP_
+
+#include <skye/drain.hpp>
+#include <skye/listen_options.hpp>
+#include <skye/probe.hpp>
+#include <skye/service.hpp>
+#include <skye/session.hpp>
+#include <skye/trace.hpp>
+
+#include <boost/asio/as_tuple.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <unistd.h>
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace skye {
+
+namespace asio = boost::asio;
+
+enum class DispatchLoad { sessions, handler_time };
+
+namespace detail {
+
+struct DispatchWorker {
+    // Written on the worker thread, read by the acceptor. Declared first so
+    // they outlive the sessions destroyed with the context.
+    std::atomic<int> sessions{0};
+    std::atomic<std::int64_t> handler_ns{0};
+
+    // Decayed handler time, and the estimate charged for new sessions. Acceptor
+    // thread only.
+    double recent_ns{};
+    double charged_ns{};
+    std::int64_t last_ns{};
+
+    asio::io_context ctx{1};
+    asio::executor_work_guard<asio::io_context::executor_type> work{
+        ctx.get_executor()};
+    std::thread thread;
+};
+
+/// Drop the session count when the session coroutine exits.
+class DispatchSessionGuard {
+public:
+    explicit DispatchSessionGuard(DispatchWorker& worker) : worker_{worker}
+    {
+    }
+
+    DispatchSessionGuard(const DispatchSessionGuard&) = delete;
+    DispatchSessionGuard& operator=(const DispatchSessionGuard&) = delete;
+
+    ~DispatchSessionGuard()
+    {
+        worker_.sessions.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+private:
+    DispatchWorker& worker_;
+};
+
+} // namespace detail
+
+/**
+  Pool of single threaded io_context objects, each run by its own thread from
+  construction until stop is called or the pool is destroyed.
+*/
+class DispatchPool {
+public:
+    // Handler time older than this counts for 1/e as much
+    static constexpr std::chrono::seconds kLoadWindow{1};
+
+    explicit DispatchPool(
+        std::size_t num_thread, DispatchLoad load = DispatchLoad::sessions)
+        : load_{load}, last_pick_{std::chrono::steady_clock::now()}
+    {
+        for (std::size_t i = 0; i < num_thread; ++i) {
+            auto& worker = workers_.emplace_back(
+                std::make_unique<detail::DispatchWorker>());
+            worker->thread = std::thread{[&ctx = worker->ctx]() { ctx.run(); }};
+        }
+    }
+
+    DispatchPool(const DispatchPool&) = delete;
+    DispatchPool& operator=(const DispatchPool&) = delete;
+
+    ~DispatchPool()
+    {
+        stop();
+        join();
+    }
+
+    /**
+      Stop all I/O contexts, sessions in progress are abandoned. Drain them
+      first with async_drain on the acceptor context and the pool.
+    */
+    void stop()
+    {
+        for (auto& worker : workers_) {
+            worker->work.reset();
+            worker->ctx.stop();
+        }
+    }
+
+    void join()
+    {
+        for (auto& worker : workers_) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+        }
+    }
+
+    [[nodiscard]] DispatchLoad load() const noexcept
+    {
+        return load_;
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return workers_.size();
+    }
+
+    [[nodiscard]] asio::io_context& context(std::size_t i) noexcept
+    {
+        return workers_[i]->ctx;
+    }
+
+    /// Open sessions on context i.
+    [[nodiscard]] int sessions(std::size_t i) const noexcept
+    {
+        return workers_[i]->sessions.load(std::memory_order_relaxed);
+    }
+
+    /// Total handler time on context i.
+    [[nodiscard]] std::chrono::nanoseconds handler_time(std::size_t i) const
+    {
+        return std::chrono::nanoseconds{
+            workers_[i]->handler_ns.load(std::memory_order_relaxed)};
+    }
+
+    /**
+      Pick the least loaded worker and count a new session on it. Call from the
+      acceptor thread only.
+    */
+    detail::DispatchWorker& acquire()
+    {
+        if (load_ == DispatchLoad::handler_time) {
+            decay();
+        }
+
+        detail::DispatchWorker* best = nullptr;
+        for (auto& worker : workers_) {
+            if ((best == nullptr) || less_loaded(*worker, *best)) {
+                best = worker.get();
+            }
+        }
+
+        if (load_ == DispatchLoad::handler_time) {
+            best->charged_ns += session_cost();
+        }
+
+        best->sessions.fetch_add(1, std::memory_order_relaxed);
+
+        return *best;
+    }
+
+private:
+    /// Estimated handler time of a new session, the average of the open ones.
+    double session_cost() const
+    {
+        double recent_ns = 0;
+        int sessions = 0;
+        for (const auto& worker : workers_) {
+            recent_ns += worker->recent_ns;
+            sessions += worker->sessions.load(std::memory_order_relaxed);
+        }
+
+        return (sessions > 0) ? recent_ns / sessions : 0;
+    }
+
+    bool less_loaded(
+        const detail::DispatchWorker& lhs,
+        const detail::DispatchWorker& rhs) const
+    {
+        const int lhs_sessions = lhs.sessions.load(std::memory_order_relaxed);
+        const int rhs_sessions = rhs.sessions.load(std::memory_order_relaxed);
+
+        if (load_ == DispatchLoad::handler_time) {
+            const double lhs_ns = lhs.recent_ns + lhs.charged_ns;
+            const double rhs_ns = rhs.recent_ns + rhs.charged_ns;
+            if (lhs_ns != rhs_ns) {
+                return lhs_ns < rhs_ns;
+            }
+        }
+
+        return lhs_sessions < rhs_sessions;
+    }
+
+    /// Fold the handler time since the last pick into the decayed sum.
+    void decay()
+    {
+        using seconds = std::chrono::duration<double>;
+
+        const auto now = std::chrono::steady_clock::now();
+        const double factor =
+            std::exp(-seconds{now - last_pick_} / seconds{kLoadWindow});
+        last_pick_ = now;
+
+        for (auto& worker : workers_) {
+            const std::int64_t total =
+                worker->handler_ns.load(std::memory_order_relaxed);
+            worker->recent_ns = worker->recent_ns * factor +
+                                static_cast<double>(total - worker->last_ns);
+            worker->charged_ns *= factor;
+            worker->last_ns = total;
+        }
+    }
+
+    std::vector<std::unique_ptr<detail::DispatchWorker>> workers_;
+    DispatchLoad load_;
+    std::chrono::steady_clock::time_point last_pick_;
+};
+
+namespace detail {
+
+/// Wrap the handler to add its wall time to the worker.
+template <Handler Handler>
+auto make_timed_handler(Handler handler, DispatchWorker& worker)
+{
+    using request_type = handler_request_t<Handler>;
+    using response_type = handler_response_t<Handler>;
+
+    return [handler = std::move(handler), &worker](
+               request_type req) -> asio::awaitable<response_type> {
+        const auto start = std::chrono::steady_clock::now();
+        auto res = co_await handler(std::move(req));
+        worker.handler_ns.fetch_add(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start)
+                .count(),
+            std::memory_order_relaxed);
+
+        co_return res;
+    };
+}
+
+/**
+  Run one session on the worker thread. Takes ownership of the native socket
+  handle that the acceptor released.
+*/
+template <typename Protocol>
+asio::awaitable<void> dispatch_session(
+    Protocol protocol, typename Protocol::socket::native_handle_type handle,
+    DispatchWorker& worker, DispatchLoad load, Handler auto handler,
+    Reporter auto reporter)
+{
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using socket_type =
+        default_token::as_default_on_t<typename Protocol::socket>;
+
+    const DispatchSessionGuard guard{worker};
+
+    socket_type stream{co_await asio::this_coro::executor};
+
+    boost::system::error_code ec;
+    stream.assign(protocol, handle, ec);
+    if (ec) {
+        ::close(handle);
+        co_return;
+    }
+
+    if (load == DispatchLoad::handler_time) {
+        co_await session(
+            std::move(stream), make_timed_handler(std::move(handler), worker),
+            std::move(reporter));
+    } else {
+        co_await session(
+            std::move(stream), std::move(handler), std::move(reporter));
+    }
+}
+
+/**
+  Accept loop that hands each socket to the least loaded worker in the pool.
+
+  loop {
+    stream = accept()
+    worker = pool.acquire()
+
+    // HTTP request/response loop on the worker thread
+    co_spawn worker, session(stream.release())
+  }
+
+  The loop ends when stop_listening closes the acceptor.
+*/
+asio::awaitable<void> dispatch_accept(
+    auto acceptor, listen_options options, DispatchPool& pool,
+    Handler auto handler, Reporter auto reporter)
+{
+    const auto protocol = acceptor.local_endpoint().protocol();
+
+    const ListenerGuard guard{
+        asio::query(acceptor.get_executor(), asio::execution::context),
+        acceptor};
+
+    TraceContext trace_ctx{static_cast<int>(acceptor.native_handle())};
+
+    for (;;) {
+        ++trace_ctx.request;
+
+        trace_begin("accept", trace_ctx);
+        auto [ec, stream] = co_await acceptor.async_accept();
+        trace_end("accept", trace_ctx);
+
+        if (ec) {
+            if (!acceptor.is_open()) {
+                break;
+            }
+
+            continue;
+        }
+
+        set_accept_options(stream, options, ec);
+
+        if (ec) {
+            continue;
+        }
+
+        SKYE_PROBE1(accept, stream.native_handle());
+
+        const auto handle = stream.release(ec);
+
+        if (ec) {
+            continue;
+        }
+
+        auto& worker = pool.acquire();
+
+        co_spawn(
+            worker.ctx,
+            dispatch_session(
+                protocol, handle, worker, pool.load(), handler, reporter),
+            [](auto ptr) {
+                // Propagate exception from the coroutine
+                if (ptr) {
+                    std::rethrow_exception(ptr);
+                }
+            });
+    }
+}
+
+asio::awaitable<void> dispatch_listen(
+    Endpoint auto endpoint, listen_options options, DispatchPool& pool,
+    Handler auto handler, Reporter auto reporter)
+{
+    auto acceptor =
+        open_acceptor(co_await asio::this_coro::executor, endpoint, options);
+
+    co_await dispatch_accept(
+        std::move(acceptor), options, pool, std::move(handler),
+        std::move(reporter));
+}
+
+} // namespace detail
+
+/**
+  Run the acceptor in a coroutine on ctx and the sessions on the pool. Same as
+  async_run otherwise. The pool must outlive ctx.
+*/
+template <
+    typename ExecutionContext, Endpoint Endpoint, Handler Handler,
+    Reporter Reporter = bool>
+void async_dispatch(
+    ExecutionContext& ctx, DispatchPool& pool, Endpoint endpoint,
+    listen_options options, Handler handler, Reporter reporter = {})
+{
+    co_spawn(
+        ctx,
+        detail::dispatch_listen(
+            std::move(endpoint), options, pool, std::move(handler),
+            std::move(reporter)),
+        [](auto ptr) {
+            // Propagate exception from the coroutine
+            if (ptr) {
+                std::rethrow_exception(ptr);
+            }
+        });
+}
+
+/// Listen on the TCP port on all IPv4 addresses.
+template <typename ExecutionContext, Handler Handler, Reporter Reporter = bool>
+void async_dispatch(
+    ExecutionContext& ctx, DispatchPool& pool, int port,
+    listen_options options, Handler handler, Reporter reporter = {})
+{
+    async_dispatch(
+        ctx, pool, detail::tcp_endpoint(port), options, std::move(handler),
+        std::move(reporter));
+}
+
+/**
+  Drain the listeners on ctx and the sessions on the pool, see async_drain.
+  Call the handler with the sum of the metrics once all are done, on the last
+  thread to finish. The pool threads keep running until stop is called.
+*/
+template <typename ExecutionContext, typename DrainHandler>
+void async_drain(
+    ExecutionContext& ctx, DispatchPool& pool,
+    std::chrono::nanoseconds timeout, DrainHandler handler)
+{
+    auto join = std::make_shared<detail::DrainJoin<DrainHandler>>(
+        pool.size() + 1, std::move(handler));
+
+    auto add = [join](const DrainMetrics& metrics) { join->add(metrics); };
+
+    async_drain(ctx, timeout, add);
+    for (std::size_t i = 0; i < pool.size(); ++i) {
+        async_drain(pool.context(i), timeout, add);
+    }
+}
+
+} // namespace skye
+
+#endif // SKYE_DISPATCH_HPP_
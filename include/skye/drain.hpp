@@ -0,0 +1,361 @@
+//
+// skye/drain.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Stop a server gracefully. Close the listeners, answer the requests in
+  progress with Connection: close, and wait for those sessions to end up to a
+  timeout. Idle keep alive connections are closed right away.
+
+  The run functions drain on SIGTERM or SIGINT for up to the drain_timeout
+  listen option before they stop the event loop. A second signal stops the
+  loop right away. A reporter that accepts DrainMetrics is called once the
+  drain is done.
+
+  The state is per execution context, so with more than one context drain each
+  of them. ServerThreads::async_drain and the DispatchPool overload of
+  async_drain do that and sum the metrics.
+
+  The listeners and sessions are closed in a handler on the context. Asio does
+  not allow that while another thread runs an operation on the same socket, so
+  drain a context that one thread runs, e.g. with run, run_threads, or a
+  DispatchPool. Stop a context that several threads run instead.
+
+  Usage:
+
+  asio::io_context ctx{1};
+  skye::async_run(ctx, 8080, handler);
+
+  // Later
+  skye::async_drain(ctx, std::chrono::seconds{30}, [&ctx](const auto& m) {
+    fmt::print("{}\n", m);
+    ctx.stop();
+  });
+*/
+#ifndef SKYE_DRAIN_HPP_
+#define SKYE_DRAIN_HPP_
+
+#include <skye/types.hpp>
+
+#include <boost/asio/as_tuple.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/execution/context.hpp>
+#include <boost/asio/execution_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/query.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace skye {
+
+namespace asio = boost::asio;
+
+namespace detail {
+
+class ServerState;
+
+/// Session entry in the ServerState, in an intrusive list.
+class SessionEntry {
+public:
+    template <typename Close>
+    SessionEntry(asio::execution_context& ctx, Close close);
+
+    SessionEntry(const SessionEntry&) = delete;
+    SessionEntry& operator=(const SessionEntry&) = delete;
+
+    ~SessionEntry();
+
+    /// The server is draining, do not keep the connection alive.
+    [[nodiscard]] bool draining() const noexcept;
+
+    /// Waiting for the first byte of the next request.
+    std::atomic<bool> idle{false};
+
+private:
+    friend class ServerState;
+
+    ServerState& state_;
+    std::function<void()> close_;
+    SessionEntry* prev_{nullptr};
+    SessionEntry* next_{nullptr};
+};
+
+/**
+  State of the servers running on one execution context, the open listeners
+  and sessions. The lock makes registration safe for a context run by several
+  threads, e.g. a thread_pool. Sessions only take it when they start and end.
+*/
+class ServerState : public asio::execution_context::service {
+public:
+    inline static asio::execution_context::id id;
+
+    explicit ServerState(asio::execution_context& ctx)
+        : asio::execution_context::service{ctx}
+    {
+    }
+
+    void add_listener(std::function<void()>* close)
+    {
+        const std::lock_guard lock{mutex_};
+        listeners_.push_back(close);
+    }
+
+    void remove_listener(std::function<void()>* close)
+    {
+        const std::lock_guard lock{mutex_};
+        std::erase(listeners_, close);
+    }
+
+    void close_listeners()
+    {
+        const std::lock_guard lock{mutex_};
+        close_listeners_locked();
+    }
+
+    void add_session(SessionEntry& entry)
+    {
+        const std::lock_guard lock{mutex_};
+        entry.next_ = head_;
+        if (head_ != nullptr) {
+            head_->prev_ = &entry;
+        }
+        head_ = &entry;
+        ++num_session_;
+    }
+
+    void remove_session(SessionEntry& entry)
+    {
+        const std::lock_guard lock{mutex_};
+        if (entry.prev_ != nullptr) {
+            entry.prev_->next_ = entry.next_;
+        } else {
+            head_ = entry.next_;
+        }
+        if (entry.next_ != nullptr) {
+            entry.next_->prev_ = entry.prev_;
+        }
+        --num_session_;
+    }
+
+    [[nodiscard]] int num_session() const noexcept
+    {
+        return num_session_;
+    }
+
+    [[nodiscard]] bool draining() const noexcept
+    {
+        return draining_;
+    }
+
+    /**
+      Stop accepting and close the idle sessions. The other sessions end after
+      their next response. Returns the number of idle sessions closed.
+    */
+    int start_drain()
+    {
+        const std::lock_guard lock{mutex_};
+
+        draining_ = true;
+
+        close_listeners_locked();
+
+        // Closing only shuts down the read side, the sessions end and remove
+        // themselves later
+        int num_idle = 0;
+        for (auto* entry = head_; entry != nullptr; entry = entry->next_) {
+            if (entry->idle) {
+                entry->close_();
+                ++num_idle;
+            }
+        }
+
+        return num_idle;
+    }
+
+private:
+    void shutdown() override
+    {
+    }
+
+    void close_listeners_locked()
+    {
+        // Each close only cancels the pending accept, the accept loops exit
+        // and remove themselves later
+        for (auto* close : listeners_) {
+            (*close)();
+        }
+    }
+
+    std::mutex mutex_;
+    std::vector<std::function<void()>*> listeners_;
+    SessionEntry* head_{nullptr};
+    std::atomic<int> num_session_{0};
+    std::atomic<bool> draining_{false};
+};
+
+template <typename Close>
+SessionEntry::SessionEntry(asio::execution_context& ctx, Close close)
+    : state_{asio::use_service<ServerState>(ctx)}, close_{std::move(close)}
+{
+    state_.add_session(*this);
+}
+
+inline SessionEntry::~SessionEntry()
+{
+    state_.remove_session(*this);
+}
+
+inline bool SessionEntry::draining() const noexcept
+{
+    return state_.draining();
+}
+
+/// Register the acceptor for the lifetime of the accept loop.
+class ListenerGuard {
+public:
+    template <typename Acceptor>
+    ListenerGuard(asio::execution_context& ctx, Acceptor& acceptor)
+        : state_{asio::use_service<ServerState>(ctx)},
+          close_{[&acceptor]() {
+              boost::system::error_code ec;
+              acceptor.close(ec);
+          }}
+    {
+        state_.add_listener(&close_);
+    }
+
+    ListenerGuard(const ListenerGuard&) = delete;
+    ListenerGuard& operator=(const ListenerGuard&) = delete;
+
+    ~ListenerGuard()
+    {
+        state_.remove_listener(&close_);
+    }
+
+private:
+    ServerState& state_;
+    std::function<void()> close_;
+};
+
+inline asio::awaitable<DrainMetrics> drain(std::chrono::nanoseconds timeout)
+{
+    auto ex = co_await asio::this_coro::executor;
+    auto& state = asio::use_service<ServerState>(
+        asio::query(ex, asio::execution::context));
+
+    // Check for the last session on a short interval. The sessions may end on
+    // other threads, so they do not touch the timer.
+    constexpr std::chrono::milliseconds kPollInterval{10};
+
+    const auto start = std::chrono::steady_clock::now();
+    const auto deadline = start + timeout;
+
+    DrainMetrics metrics;
+    metrics.num_session = state.num_session();
+    metrics.num_idle = state.start_drain();
+
+    asio::steady_timer timer{ex};
+    while ((state.num_session() > 0) &&
+           (std::chrono::steady_clock::now() < deadline)) {
+        timer.expires_at(std::min(
+            deadline, std::chrono::steady_clock::now() + kPollInterval));
+        co_await timer.async_wait(asio::as_tuple(asio::use_awaitable));
+    }
+
+    metrics.num_abandoned = state.num_session();
+    metrics.drain_time = std::chrono::steady_clock::now() - start;
+
+    co_return metrics;
+}
+
+/**
+  Sum the metrics of the drains on several contexts. Call the handler once the
+  last one is done, on its thread. The drain time is the longest one.
+*/
+template <typename DrainHandler>
+class DrainJoin {
+public:
+    DrainJoin(std::size_t count, DrainHandler handler)
+        : count_{count}, handler_{std::move(handler)}
+    {
+    }
+
+    void add(const DrainMetrics& metrics)
+    {
+        {
+            const std::lock_guard lock{mutex_};
+            total_.drain_time = std::max(total_.drain_time, metrics.drain_time);
+            total_.num_session += metrics.num_session;
+            total_.num_idle += metrics.num_idle;
+            total_.num_abandoned += metrics.num_abandoned;
+
+            if (--count_ > 0) {
+                return;
+            }
+        }
+
+        handler_(std::as_const(total_));
+    }
+
+private:
+    std::mutex mutex_;
+    std::size_t count_;
+    DrainMetrics total_;
+    DrainHandler handler_;
+};
+
+} // namespace detail
+
+/**
+  Close the listeners of all servers running on the context. Connections in
+  progress carry on, the event loop runs out of work once they are done. May be
+  called from any thread, the listeners are closed in a handler on the context.
+*/
+template <typename ExecutionContext>
+void stop_listening(ExecutionContext& ctx)
+{
+    asio::post(ctx, [&state = asio::use_service<detail::ServerState>(ctx)]() {
+        state.close_listeners();
+    });
+}
+
+/**
+  Drain the servers running on the context, see above. Call the handler with
+  the metrics once the last session has ended or the timeout expired. May be
+  called from any thread, the drain and the handler run on the context.
+*/
+template <typename ExecutionContext, typename DrainHandler>
+void async_drain(
+    ExecutionContext& ctx, std::chrono::nanoseconds timeout,
+    DrainHandler handler)
+{
+    co_spawn(
+        ctx, detail::drain(timeout),
+        [handler = std::move(handler)](
+            std::exception_ptr ptr, DrainMetrics metrics) mutable {
+            // Propagate exception from the coroutine
+            if (ptr) {
+                std::rethrow_exception(ptr);
+            }
+
+            handler(std::as_const(metrics));
+        });
+}
+
+} // namespace skye
+
+#endif // SKYE_DRAIN_HPP_
@@ -15,6 +15,33 @@
 #include <fmt/core.h>
 
 #include <chrono>
+#include <string_view>
+
+/**
+  Convert PhaseTimes to a JSON object with durations in seconds. Included in the
+  metrics objects if phase timing is enabled at compile time.
+*/
+template <>
+struct fmt::formatter<skye::PhaseTimes> {
+    constexpr static auto parse(format_parse_context& ctx)
+    {
+        return ctx.begin();
+    }
+
+    template <typename FormatContext>
+    auto format(const skye::PhaseTimes& p, FormatContext& ctx) const
+    {
+        using seconds = std::chrono::duration<double>;
+
+        return fmt::format_to(
+            ctx.out(),
+            "{{\"wait\":{},\"header\":{},\"body\":{},\"handler\":{},"
+            "\"write\":{}}}",
+            seconds{p.wait}.count(), seconds{p.header}.count(),
+            seconds{p.body}.count(), seconds{p.handler}.count(),
+            seconds{p.write}.count());
+    }
+};
 
 /**
   Convert SessionMetrics to a JSON string. Specialize the formatter struct so
@@ -44,12 +71,168 @@ struct fmt::formatter<skye::SessionMetrics> {
     template <typename FormatContext>
     auto format(const skye::SessionMetrics& m, FormatContext& ctx) const
     {
-        return fmt::format_to(
+        auto out = fmt::format_to(
             ctx.out(),
             "{{\"fd\":{},\"num_request\":{},\"bytes_read\":{},"
-            "\"bytes_write\":{},\"duration\":{}}}",
+            "\"bytes_write\":{},\"duration\":{}",
             m.fd, m.num_request, m.bytes_read, m.bytes_write,
             std::chrono::duration<double>(m.end_time - m.start_time).count());
+
+        if constexpr (skye::kEnablePhaseTiming) {
+            out = fmt::format_to(out, ",\"phases\":{}", m.phases);
+        }
+
+        return fmt::format_to(out, "}}");
+    }
+};
+
+/**
+  Convert RequestMetrics to a JSON string. One line per request for an access
+  log.
+
+  The request target is escaped since it comes from the client.
+*/
+template <>
+struct fmt::formatter<skye::RequestMetrics> {
+    constexpr static auto parse(format_parse_context& ctx)
+    {
+        return ctx.begin();
+    }
+
+    template <typename FormatContext>
+    auto format(const skye::RequestMetrics& m, FormatContext& ctx) const
+    {
+        const auto method = skye::http::to_string(m.method);
+
+        auto out = fmt::format_to(
+            ctx.out(), "{{\"fd\":{},\"num_request\":{},\"method\":\"{}\",",
+            m.fd, m.num_request,
+            std::string_view{method.data(), method.size()});
+
+        out = fmt::format_to(out, "\"target\":\"");
+        for (const char ch : m.target()) {
+            if ((ch == '"') || (ch == '\\')) {
+                *out++ = '\\';
+                *out++ = ch;
+            } else if (static_cast<unsigned char>(ch) < 0x20) {
+                out = fmt::format_to(
+                    out, "\\u{:04x}", static_cast<unsigned char>(ch));
+            } else {
+                *out++ = ch;
+            }
+        }
+
+        out = fmt::format_to(
+            out,
+            "\",\"status\":{},\"bytes_read\":{},\"bytes_write\":{},"
+            "\"duration\":{}",
+            m.status, m.bytes_read, m.bytes_write,
+            std::chrono::duration<double>(m.end_time - m.start_time).count());
+
+        if constexpr (skye::kEnablePhaseTiming) {
+            out = fmt::format_to(out, ",\"phases\":{}", m.phases);
+        }
+
+        return fmt::format_to(out, "}}");
+    }
+};
+
+/**
+  Convert LoopMetrics to a JSON string. Durations are in seconds.
+*/
+template <>
+struct fmt::formatter<skye::LoopMetrics> {
+    constexpr static auto parse(format_parse_context& ctx)
+    {
+        return ctx.begin();
+    }
+
+    template <typename FormatContext>
+    auto format(const skye::LoopMetrics& m, FormatContext& ctx) const
+    {
+        using seconds = std::chrono::duration<double>;
+
+        const double mean_lag =
+            (m.num_tick > 0) ? seconds{m.total_lag}.count() / m.num_tick : 0.0;
+
+        return fmt::format_to(
+            ctx.out(),
+            "{{\"num_tick\":{},\"num_lag\":{},\"lag\":{},\"max_lag\":{},"
+            "\"mean_lag\":{},\"in_flight\":{},\"max_in_flight\":{},"
+            "\"num_handler\":{},\"num_slow\":{},\"max_handler\":{}}}",
+            m.num_tick, m.num_lag, seconds{m.lag}.count(),
+            seconds{m.max_lag}.count(), mean_lag, m.in_flight, m.max_in_flight,
+            m.num_handler, m.num_slow, seconds{m.max_handler}.count());
+    }
+};
+
+/**
+  Convert BusyPollMetrics to a JSON string. Durations are in seconds.
+*/
+template <>
+struct fmt::formatter<skye::BusyPollMetrics> {
+    constexpr static auto parse(format_parse_context& ctx)
+    {
+        return ctx.begin();
+    }
+
+    template <typename FormatContext>
+    auto format(const skye::BusyPollMetrics& m, FormatContext& ctx) const
+    {
+        using seconds = std::chrono::duration<double>;
+
+        return fmt::format_to(
+            ctx.out(),
+            "{{\"spin\":{},\"sleep\":{},\"work\":{},\"num_poll\":{},"
+            "\"num_sleep\":{},\"num_handler\":{}}}",
+            seconds{m.spin}.count(), seconds{m.sleep}.count(),
+            seconds{m.work}.count(), m.num_poll, m.num_sleep, m.num_handler);
+    }
+};
+
+/**
+  Convert DrainMetrics to a JSON string. Durations are in seconds.
+*/
+template <>
+struct fmt::formatter<skye::DrainMetrics> {
+    constexpr static auto parse(format_parse_context& ctx)
+    {
+        return ctx.begin();
+    }
+
+    template <typename FormatContext>
+    auto format(const skye::DrainMetrics& m, FormatContext& ctx) const
+    {
+        using seconds = std::chrono::duration<double>;
+
+        return fmt::format_to(
+            ctx.out(),
+            "{{\"drain_time\":{},\"num_session\":{},\"num_idle\":{},"
+            "\"num_abandoned\":{}}}",
+            seconds{m.drain_time}.count(), m.num_session, m.num_idle,
+            m.num_abandoned);
+    }
+};
+
+/**
+  Convert PreforkMetrics to a JSON string.
+*/
+template <>
+struct fmt::formatter<skye::PreforkMetrics> {
+    constexpr static auto parse(format_parse_context& ctx)
+    {
+        return ctx.begin();
+    }
+
+    template <typename FormatContext>
+    auto format(const skye::PreforkMetrics& m, FormatContext& ctx) const
+    {
+        return fmt::format_to(
+            ctx.out(),
+            "{{\"num_worker\":{},\"num_restart\":{},\"num_session\":{},"
+            "\"num_request\":{},\"bytes_read\":{},\"bytes_write\":{}}}",
+            m.num_worker, m.num_restart, m.num_session, m.num_request,
+            m.bytes_read, m.bytes_write);
     }
 };
 
@@ -0,0 +1,427 @@
+//
+// skye/handoff.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Restart the server without closing the listening socket. The kernel keeps
+  queueing new connections on the socket while it changes owner, so a deploy
+  does not refuse any.
+
+  - Socket activation, systemd binds the socket and passes it to the process.
+    See systemd_listen_fds.
+  - Handoff, the running process offers its listener on a Unix domain control
+    socket. The new process takes it once it is ready to serve, then the old
+    process stops accepting and drains its open connections. See run_handoff.
+
+  Usage:
+
+  // ListenStream=8080 in the .socket unit
+  const auto fds = skye::systemd_listen_fds();
+  skye::run(skye::listen_fd<asio::ip::tcp>{fds.at(0)}, handler);
+
+  // Take the port from the running instance, or bind it if there is none. Do
+  // any warm up before this call, the old instance serves until then.
+  skye::run_handoff(8080, "/run/skye.handoff", {}, handler);
+
+  POSIX only, builds on Linux and macOS.
+*/
+#ifndef SKYE_HANDOFF_HPP_
+#define SKYE_HANDOFF_HPP_
+
+#include <skye/listen_options.hpp>
+#include <skye/service.hpp>
+#include <skye/session.hpp>
+
+#include <boost/asio/as_tuple.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <array>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace skye {
+
+namespace asio = boost::asio;
+
+/**
+  Listening sockets passed by systemd socket activation, in the order of the
+  ListenStream lines in the socket unit. Empty if the process was not started
+  by socket activation.
+
+  Clears the environment variables so child processes do not see them too.
+*/
+inline std::vector<int> systemd_listen_fds()
+{
+    // SD_LISTEN_FDS_START, the first passed descriptor
+    constexpr int kListenFdsStart = 3;
+
+    const char* pid = std::getenv("LISTEN_PID");
+    const char* num = std::getenv("LISTEN_FDS");
+    if ((pid == nullptr) || (num == nullptr) ||
+        (std::strtol(pid, nullptr, 10) != ::getpid())) {
+        return {};
+    }
+
+    const auto num_fd = static_cast<int>(std::strtol(num, nullptr, 10));
+
+    ::unsetenv("LISTEN_PID");
+    ::unsetenv("LISTEN_FDS");
+    ::unsetenv("LISTEN_FDNAMES");
+
+    std::vector<int> fds;
+    for (int fd = kListenFdsStart; fd < kListenFdsStart + num_fd; ++fd) {
+        ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fds.push_back(fd);
+    }
+
+    return fds;
+}
+
+namespace detail {
+
+// macOS has no MSG_NOSIGNAL, asio sets SO_NOSIGPIPE on its sockets instead
+#if defined(MSG_NOSIGNAL)
+constexpr int kNoSignal = MSG_NOSIGNAL;
+#else
+constexpr int kNoSignal = 0;
+#endif
+
+/// Set FD_CLOEXEC, for platforms without SOCK_CLOEXEC or MSG_CMSG_CLOEXEC.
+inline void set_cloexec([[maybe_unused]] int fd)
+{
+#if !defined(SOCK_CLOEXEC) || !defined(MSG_CMSG_CLOEXEC)
+    ::fcntl(fd, F_SETFD, FD_CLOEXEC);
+#endif
+}
+
+/// Send a descriptor over a Unix domain socket with SCM_RIGHTS.
+inline void send_fd(int sock, int fd, boost::system::error_code& ec)
+{
+    // At least one byte of real data must go along with the descriptor
+    char data = 'L';
+    iovec iov{&data, sizeof(data)};
+
+    alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int))> control{};
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    std::memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+
+    if (::sendmsg(sock, &msg, kNoSignal) < 0) {
+        ec.assign(errno, boost::system::system_category());
+    }
+}
+
+/// Receive a descriptor sent with send_fd. Returns -1 on failure.
+inline int receive_fd(int sock, boost::system::error_code& ec)
+{
+    char data = 0;
+    iovec iov{&data, sizeof(data)};
+
+    alignas(cmsghdr) std::array<char, CMSG_SPACE(sizeof(int))> control{};
+
+    msghdr msg{};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control.data();
+    msg.msg_controllen = control.size();
+
+#if defined(MSG_CMSG_CLOEXEC)
+    const auto n = ::recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+#else
+    const auto n = ::recvmsg(sock, &msg, 0);
+#endif
+    if (n < 0) {
+        ec.assign(errno, boost::system::system_category());
+        return -1;
+    }
+
+    const cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    if ((n == 0) || (cmsg == nullptr) || (cmsg->cmsg_level != SOL_SOCKET) ||
+        (cmsg->cmsg_type != SCM_RIGHTS)) {
+        ec = asio::error::eof;
+        return -1;
+    }
+
+    int fd = -1;
+    std::memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+    set_cloexec(fd);
+
+    return fd;
+}
+
+/**
+  True if fd is a socket of the protocol that is listening for connections.
+  Checked before taking over a descriptor that came from another process.
+*/
+template <typename Protocol>
+bool is_listener(int fd, const Protocol& protocol)
+{
+    int value = 0;
+    socklen_t size = sizeof(value);
+    if ((::getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &value, &size) != 0) ||
+        (value == 0)) {
+        return false;
+    }
+
+    size = sizeof(value);
+    if ((::getsockopt(fd, SOL_SOCKET, SO_TYPE, &value, &size) != 0) ||
+        (value != protocol.type())) {
+        return false;
+    }
+
+    sockaddr_storage addr{};
+    size = sizeof(addr);
+    if (::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &size) != 0) {
+        return false;
+    }
+
+    return addr.ss_family == protocol.family();
+}
+
+/**
+  Offer the listener on the control socket until a new process takes it.
+
+  loop {
+    control = accept()
+    send(control, fd)
+
+    // New process confirms it has the descriptor
+    read(control, ack)
+    on_handoff()
+  }
+
+  An accept error that persists, e.g. out of descriptors, backs off for a
+  moment instead of spinning the I/O thread.
+*/
+template <typename Callback>
+asio::awaitable<void> offer_listener(
+    asio::local::stream_protocol::endpoint control, int fd,
+    Callback on_handoff)
+{
+    constexpr std::chrono::milliseconds kAcceptBackoff{100};
+
+    const auto ex = co_await asio::this_coro::executor;
+
+    auto acceptor = open_acceptor(ex, control, {});
+
+    for (;;) {
+        auto [ec, socket] = co_await acceptor.async_accept();
+        if (ec == asio::error::operation_aborted) {
+            co_return;
+        }
+
+        if (ec) {
+            asio::steady_timer timer{ex, kAcceptBackoff};
+            co_await timer.async_wait(asio::as_tuple(asio::use_awaitable));
+            continue;
+        }
+
+        send_fd(socket.native_handle(), fd, ec);
+        if (ec) {
+            continue;
+        }
+
+        char ack = 0;
+        auto [read_ec, n] =
+            co_await asio::async_read(socket, asio::buffer(&ack, 1));
+        if (read_ec) {
+            // New process went away before it took over, keep serving
+            continue;
+        }
+
+        on_handoff();
+        co_return;
+    }
+}
+
+} // namespace detail
+
+/**
+  Take the listener from the process that offers it on the control socket at
+  path. Returns -1 if no process is listening on the control socket.
+
+  The descriptor must be a listening socket of the protocol, e.g. the address
+  family of the endpoint the new process would bind. Otherwise it is closed,
+  the old process keeps serving, and this throws.
+
+  The old process stops accepting as soon as this returns, call it once the
+  new process is ready to serve.
+*/
+template <typename Protocol>
+int receive_listener(const std::string& path, const Protocol& protocol)
+{
+    using boost::system::system_category;
+    using boost::system::system_error;
+
+#if defined(SOCK_CLOEXEC)
+    const int sock = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+#else
+    const int sock = ::socket(AF_UNIX, SOCK_STREAM, 0);
+#endif
+    if (sock < 0) {
+        throw system_error{errno, system_category(), "socket"};
+    }
+
+    detail::set_cloexec(sock);
+
+#if defined(SO_NOSIGPIPE)
+    const int on = 1;
+    ::setsockopt(sock, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+
+    sockaddr_un addr{};
+    addr.sun_family = AF_UNIX;
+    path.copy(addr.sun_path, sizeof(addr.sun_path) - 1);
+
+    if (::connect(sock, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) <
+        0) {
+        const int error = errno;
+        ::close(sock);
+
+        // Nobody to take over from
+        if ((error == ENOENT) || (error == ECONNREFUSED)) {
+            return -1;
+        }
+
+        throw system_error{error, system_category(), "connect"};
+    }
+
+    boost::system::error_code ec;
+    const int fd = detail::receive_fd(sock, ec);
+
+    if (!ec && !detail::is_listener(fd, protocol)) {
+        ec = asio::error::invalid_argument;
+    }
+
+    // Tell the old process to stop accepting
+    const char ack = 'K';
+    if (!ec && (::send(sock, &ack, 1, detail::kNoSignal) != 1)) {
+        ec.assign(errno, system_category());
+    }
+
+    ::close(sock);
+
+    if (ec) {
+        if (fd >= 0) {
+            ::close(fd);
+        }
+
+        throw system_error{ec, "receive_listener"};
+    }
+
+    return fd;
+}
+
+/**
+  Offer the listening socket fd on the control socket at path. When a new
+  process takes it call on_handoff, e.g. to stop_listening and drain. The
+  caller still owns fd and may close it after the handoff.
+*/
+template <typename ExecutionContext, typename Callback>
+void async_offer_listener(
+    ExecutionContext& ctx, const std::string& path, int fd,
+    Callback on_handoff)
+{
+    co_spawn(
+        ctx,
+        detail::offer_listener(
+            asio::local::stream_protocol::endpoint{path}, fd,
+            std::move(on_handoff)),
+        [](auto ptr) {
+            // Propagate exception from the coroutine
+            if (ptr) {
+                std::rethrow_exception(ptr);
+            }
+        });
+}
+
+/**
+  Run a server that hands its listener over to the next instance.
+
+  Take the listener from the instance running on the control socket at path,
+  or bind the endpoint if there is none. Then serve and offer the listener on
+  the control socket in turn. Once the next instance takes it, drain the open
+  connections for up to the drain_timeout listen option, see drain.hpp.
+
+  Also drains and stops on SIGINT or SIGTERM, same as run.
+*/
+template <Endpoint Endpoint, Handler Handler, Reporter Reporter = bool>
+void run_handoff(
+    const Endpoint& endpoint, const std::string& path, listen_options options,
+    Handler handler, Reporter reporter = {})
+{
+    // Concurrency hint to asio that run is single threaded
+    asio::io_context ioc{1};
+
+    int fd = receive_listener(path, endpoint.protocol());
+    if (fd < 0) {
+        auto acceptor =
+            detail::open_acceptor(ioc.get_executor(), endpoint, options);
+        fd = static_cast<int>(acceptor.release());
+    } else {
+        // This instance owns the handoff now. The old one keeps its control
+        // socket open until it reads the ack, so the offer below would find it
+        // in use and fail to bind.
+        ::unlink(path.c_str());
+    }
+
+    async_run(
+        ioc, listen_fd{endpoint.protocol(), fd}, options, std::move(handler),
+        reporter);
+
+    asio::signal_set signals{ioc, SIGINT, SIGTERM};
+    detail::drain_on_signal(ioc, signals, options.drain_timeout, reporter);
+
+    // Same as a stop signal once the next instance has the listener
+    async_offer_listener(ioc, path, fd, []() { ::raise(SIGTERM); });
+
+    ioc.run();
+
+    ::close(fd);
+}
+
+/// Run a server on the TCP port on all IPv4 addresses.
+template <Handler Handler, Reporter Reporter = bool>
+void run_handoff(
+    int port, const std::string& path, listen_options options,
+    Handler handler, Reporter reporter = {})
+{
+    run_handoff(
+        detail::tcp_endpoint(port), path, options, std::move(handler),
+        std::move(reporter));
+}
+
+} // namespace skye
+
+#endif // SKYE_HANDOFF_HPP_
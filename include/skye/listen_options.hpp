@@ -0,0 +1,211 @@
+//
+// skye/listen_options.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Tuning options for the listening socket and the connections it accepts. Pass
+  them to async_run or run to size the accept queue and socket buffers, or to
+  trade CPU for latency, per deployment.
+
+  Zero leaves the system default. The TCP options only apply to a TCP endpoint.
+  An option the platform does not have is ignored.
+
+  Usage:
+
+  skye::listen_options options;
+  options.backlog = 65535;
+  options.defer_accept = 1;
+  options.fast_open = 256;
+
+  skye::run(8080, options, handler);
+*/
+#ifndef SKYE_LISTEN_OPTIONS_HPP_
+#define SKYE_LISTEN_OPTIONS_HPP_
+
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/socket_base.hpp>
+#include <boost/system/error_code.hpp>
+
+#include <chrono>
+#include <cstddef>
+#include <type_traits>
+
+namespace skye {
+
+namespace asio = boost::asio;
+
+struct listen_options {
+    /// Length of the queue of connections waiting for accept.
+    int backlog{asio::socket_base::max_listen_connections};
+
+    /**
+      SO_RCVBUF and SO_SNDBUF in bytes. Set on the listener so the TCP window
+      scale is negotiated from them, accepted sockets inherit the sizes.
+    */
+    int receive_buffer_size{0};
+    int send_buffer_size{0};
+
+    /**
+      TCP_DEFER_ACCEPT, seconds to wait for the first request bytes before the
+      connection is ready to accept. Connections that never send are dropped
+      by the kernel and never wake up the event loop.
+    */
+    int defer_accept{0};
+
+    /// TCP_FASTOPEN, max pending connections with request data in the SYN.
+    int fast_open{0};
+
+    /**
+      SO_BUSY_POLL, microseconds to busy poll the device queue on a read
+      instead of waiting for an interrupt. Raising it above the
+      net.core.busy_read sysctl requires CAP_NET_ADMIN.
+    */
+    int busy_poll{0};
+
+    /**
+      SO_REUSEPORT, more than one listener may bind the same port and the
+      kernel spreads the incoming connections over them.
+    */
+    bool reuse_port{false};
+
+    /**
+      SO_INCOMING_CPU, with SO_REUSEPORT the kernel prefers the listener on
+      the CPU that handled the packet. Less than zero is any CPU.
+    */
+    int incoming_cpu{-1};
+
+    /**
+      Time the run functions wait for requests in progress after a stop
+      signal before they close the connections, see drain.hpp.
+    */
+    std::chrono::milliseconds drain_timeout{30000};
+};
+
+namespace detail {
+
+/**
+  Integer socket option for the ones asio does not name, models the settable
+  socket option requirements.
+*/
+template <int Level, int Name>
+class int_option {
+public:
+    explicit int_option(int value) : value_{value}
+    {
+    }
+
+    template <typename Protocol>
+    int level(const Protocol& /*protocol*/) const
+    {
+        return Level;
+    }
+
+    template <typename Protocol>
+    int name(const Protocol& /*protocol*/) const
+    {
+        return Name;
+    }
+
+    template <typename Protocol>
+    const int* data(const Protocol& /*protocol*/) const
+    {
+        return &value_;
+    }
+
+    template <typename Protocol>
+    std::size_t size(const Protocol& /*protocol*/) const
+    {
+        return sizeof(value_);
+    }
+
+private:
+    int value_;
+};
+
+template <typename Protocol>
+constexpr bool kIsTcp = std::is_same_v<Protocol, asio::ip::tcp>;
+
+/**
+  Open, bind, and listen on the endpoint with the options set in between.
+  Throws a boost::system::system_error on failure, same as the acceptor
+  constructor that it replaces.
+*/
+template <typename Acceptor, typename Endpoint>
+void open_listener(
+    Acceptor& acceptor, const Endpoint& endpoint,
+    const listen_options& options)
+{
+    using protocol_type = typename Endpoint::protocol_type;
+
+    acceptor.open(endpoint.protocol());
+    acceptor.set_option(asio::socket_base::reuse_address{true});
+
+    if (options.receive_buffer_size > 0) {
+        acceptor.set_option(asio::socket_base::receive_buffer_size{
+            options.receive_buffer_size});
+    }
+
+    if (options.send_buffer_size > 0) {
+        acceptor.set_option(
+            asio::socket_base::send_buffer_size{options.send_buffer_size});
+    }
+
+#if defined(SO_REUSEPORT)
+    if (options.reuse_port) {
+        acceptor.set_option(int_option<SOL_SOCKET, SO_REUSEPORT>{1});
+    }
+#endif
+
+#if defined(SO_BUSY_POLL)
+    if (options.busy_poll > 0) {
+        acceptor.set_option(
+            int_option<SOL_SOCKET, SO_BUSY_POLL>{options.busy_poll});
+    }
+#endif
+
+#if defined(SO_INCOMING_CPU)
+    if (options.incoming_cpu >= 0) {
+        acceptor.set_option(
+            int_option<SOL_SOCKET, SO_INCOMING_CPU>{options.incoming_cpu});
+    }
+#endif
+
+    acceptor.bind(endpoint);
+
+    if constexpr (kIsTcp<protocol_type>) {
+#if defined(TCP_DEFER_ACCEPT)
+        if (options.defer_accept > 0) {
+            acceptor.set_option(int_option<IPPROTO_TCP, TCP_DEFER_ACCEPT>{
+                options.defer_accept});
+        }
+#endif
+
+#if defined(TCP_FASTOPEN)
+        if (options.fast_open > 0) {
+            acceptor.set_option(
+                int_option<IPPROTO_TCP, TCP_FASTOPEN>{options.fast_open});
+        }
+#endif
+    }
+
+    acceptor.listen(options.backlog);
+}
+
+/// Set the per connection options on an accepted socket.
+template <typename Stream>
+void set_accept_options(
+    Stream& stream, const listen_options& /*options*/,
+    [[maybe_unused]] boost::system::error_code& ec)
+{
+    if constexpr (kIsTcp<typename Stream::protocol_type>) {
+        // Nagle does not apply to Unix domain sockets
+        stream.set_option(asio::ip::tcp::no_delay{true}, ec);
+    }
+}
+
+} // namespace detail
+
+} // namespace skye
+
+#endif // SKYE_LISTEN_OPTIONS_HPP_
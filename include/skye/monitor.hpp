@@ -0,0 +1,256 @@
+//
+// skye/monitor.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Watch the health of the I/O thread event loop. One blocking handler stalls
+  every connection on the same io_context, the monitor measures how late a
+  periodic timer fires and which handlers were running when it did.
+
+  Usage:
+
+  asio::io_context ctx;
+
+  // Log the target of handlers that block the loop for more than 50ms
+  skye::LoopMonitor monitor{
+    [](std::string_view target, std::chrono::nanoseconds elapsed) {
+      fmt::print(stderr, "blocked {} {}\n", target, elapsed.count());
+    }};
+  monitor.start(ctx);
+
+  skye::async_run(ctx, 8080, monitor.wrap(handler));
+
+  ctx.run();
+
+  // Later, e.g. in a /metrics handler
+  fmt::print("{}\n", monitor.metrics());
+*/
+#ifndef SKYE_MONITOR_HPP_
+#define SKYE_MONITOR_HPP_
+
+#include <skye/session.hpp>
+#include <skye/types.hpp>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <memory>
+#include <optional>
+#include <string_view>
+#include <utility>
+
+namespace skye {
+
+namespace asio = boost::asio;
+
+/**
+  Called with the request target and elapsed time of a handler that blocked the
+  event loop. The target is truncated to LoopMonitor::kMaxTarget bytes.
+*/
+using BlockedHandlerFunction =
+    std::function<void(std::string_view, std::chrono::nanoseconds)>;
+
+namespace detail {
+
+struct LoopState {
+    std::chrono::nanoseconds interval;
+    std::chrono::nanoseconds threshold;
+    BlockedHandlerFunction on_blocked;
+
+    LoopMetrics metrics;
+    std::optional<asio::steady_timer> timer;
+};
+
+/**
+  Periodic timer loop. The lag is how long after its expiry the timer
+  completion actually ran, i.e. how long the event loop was busy with other
+  work.
+*/
+inline asio::awaitable<void> loop_monitor(std::shared_ptr<LoopState> state)
+{
+    auto& timer = state->timer.emplace(co_await asio::this_coro::executor);
+
+    for (;;) {
+        timer.expires_after(state->interval);
+
+        boost::system::error_code ec;
+        co_await timer.async_wait(
+            asio::redirect_error(asio::use_awaitable, ec));
+
+        if (ec) {
+            break;
+        }
+
+        const auto lag = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            asio::steady_timer::clock_type::now() - timer.expiry());
+
+        auto& m = state->metrics;
+        ++m.num_tick;
+        m.lag = lag;
+        m.total_lag += lag;
+        m.max_lag = std::max(m.max_lag, lag);
+        if (lag > state->threshold) {
+            ++m.num_lag;
+        }
+    }
+}
+
+/**
+  Count the handlers in flight even if the handler throws or the session is
+  cancelled.
+*/
+class InFlight {
+public:
+    explicit InFlight(LoopMetrics& metrics) : metrics_{metrics}
+    {
+        ++metrics_.in_flight;
+        metrics_.max_in_flight =
+            std::max(metrics_.max_in_flight, metrics_.in_flight);
+    }
+
+    InFlight(const InFlight&) = delete;
+    InFlight& operator=(const InFlight&) = delete;
+
+    ~InFlight()
+    {
+        --metrics_.in_flight;
+    }
+
+private:
+    LoopMetrics& metrics_;
+};
+
+} // namespace detail
+
+/**
+  Event loop lag monitor for the I/O thread.
+
+  The monitor runs a timer every interval and records how late it fires. The
+  wrapped handler records the number of handlers in flight, which is the closest
+  measure of the run queue depth that asio exposes, and handlers that take
+  longer than the threshold.
+
+  A handler that takes longer than the threshold is reported as blocking if the
+  timer did not fire at all while it ran, or if the timer fired late by more
+  than the threshold. A handler that is suspended on I/O for a long time lets
+  the timer run on schedule and is only counted as slow. Keep the interval well
+  below the threshold.
+
+  The monitor is not thread safe. Start it on the I/O context and wrap the
+  handler that runs on the I/O thread, i.e. wrap the make_co_handler result.
+*/
+class LoopMonitor {
+public:
+    static constexpr std::chrono::milliseconds kDefaultInterval{10};
+    static constexpr std::chrono::milliseconds kDefaultThreshold{50};
+    static constexpr std::size_t kMaxTarget = RequestMetrics::kMaxTarget;
+
+    explicit LoopMonitor(
+        BlockedHandlerFunction on_blocked = {},
+        std::chrono::nanoseconds interval = kDefaultInterval,
+        std::chrono::nanoseconds threshold = kDefaultThreshold)
+        : state_{std::make_shared<detail::LoopState>()}
+    {
+        state_->interval = interval;
+        state_->threshold = threshold;
+        state_->on_blocked = std::move(on_blocked);
+    }
+
+    /// Start the periodic timer on the I/O context.
+    template <typename ExecutionContext>
+    void start(ExecutionContext& ctx)
+    {
+        co_spawn(ctx, detail::loop_monitor(state_), asio::detached);
+    }
+
+    /// Cancel the periodic timer so the I/O context may run out of work.
+    void stop()
+    {
+        if (state_->timer) {
+            state_->timer->cancel();
+        }
+    }
+
+    /**
+      Wrap a HTTP request handler to count handlers in flight and find the ones
+      that block the event loop.
+    */
+    template <Handler Handler>
+    auto wrap(Handler handler) const
+    {
+        using request_type = handler_request_t<Handler>;
+        using response_type = handler_response_t<Handler>;
+
+        return [state = state_, handler = std::move(handler)](
+                   request_type req) -> asio::awaitable<response_type> {
+            using clock = asio::steady_timer::clock_type;
+
+            auto& m = state->metrics;
+
+            const auto start = clock::now();
+            const int num_tick = m.num_tick;
+            const int num_lag = m.num_lag;
+
+            // Only copy the target if someone is listening. Fixed size so the
+            // hot path does not allocate, long targets are truncated.
+            std::array<char, kMaxTarget> target_data;
+            std::size_t target_size = 0;
+            if (state->on_blocked) {
+                const std::string_view target{
+                    req.target().data(), req.target().size()};
+                target_size = truncate_utf8(target, kMaxTarget);
+                std::copy_n(target.data(), target_size, target_data.data());
+            }
+
+            response_type res;
+            {
+                const detail::InFlight in_flight{m};
+                res = co_await std::invoke(handler, std::move(req));
+            }
+
+            const auto elapsed =
+                std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    clock::now() - start);
+
+            ++m.num_handler;
+            m.max_handler = std::max(m.max_handler, elapsed);
+
+            if (elapsed > state->threshold) {
+                ++m.num_slow;
+
+                const bool blocked =
+                    (m.num_tick == num_tick) || (m.num_lag != num_lag);
+                if (blocked && state->on_blocked) {
+                    state->on_blocked(
+                        std::string_view{target_data.data(), target_size},
+                        elapsed);
+                }
+            }
+
+            co_return res;
+        };
+    }
+
+    [[nodiscard]] LoopMetrics metrics() const
+    {
+        return state_->metrics;
+    }
+
+private:
+    std::shared_ptr<detail::LoopState> state_;
+};
+
+} // namespace skye
+
+#endif // SKYE_MONITOR_HPP_
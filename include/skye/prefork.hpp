@@ -0,0 +1,507 @@
+//
+// skye/prefork.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Run the server in N worker processes that share one listening socket. The
+  supervisor binds the socket once and forks the workers, each one runs the
+  single threaded event loop of run. Use it to fill all the cores of a
+  container with handlers that wrap libraries that are not thread safe.
+
+  The supervisor starts a worker again if it exits or crashes. On SIGTERM or
+  SIGINT it forwards SIGTERM to the workers and waits for them to exit, up to
+  the stop timeout, before it sends SIGKILL. Each worker drains its
+  connections for up to the drain_timeout listen option, see drain.hpp.
+
+  Workers add their session metrics to counters in shared memory. The
+  supervisor reports the aggregate of all workers every report interval.
+
+  Usage:
+
+  skye::prefork_options prefork;
+  prefork.num_worker = 4;
+  prefork.report = [](const skye::PreforkMetrics& metrics) {
+    fmt::print("{}\n", metrics);
+  };
+
+  // Call from the main thread before any other threads start
+  skye::run_prefork(8080, {}, prefork, handler);
+
+  POSIX only, builds on Linux and macOS.
+*/
+#ifndef SKYE_PREFORK_HPP_
+#define SKYE_PREFORK_HPP_
+
+#include <skye/listen_options.hpp>
+#include <skye/service.hpp>
+#include <skye/session.hpp>
+#include <skye/types.hpp>
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <functional>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace skye {
+
+namespace asio = boost::asio;
+
+struct prefork_options {
+    /// Number of worker processes, zero is one per CPU.
+    std::size_t num_worker{0};
+
+    /// Wait before a worker that exited is started again.
+    std::chrono::milliseconds restart_delay{100};
+
+    /**
+      Time the workers have to exit after SIGTERM before they are killed.
+      Longer than the drain timeout of the listen options.
+    */
+    std::chrono::milliseconds stop_timeout{35000};
+
+    /// Call report with the aggregate metrics this often, and once at stop.
+    std::chrono::milliseconds report_interval{1000};
+    std::function<void(const PreforkMetrics&)> report;
+};
+
+namespace detail {
+
+/// Counters of one worker in shared memory, read by the supervisor.
+struct PreforkSlot {
+    std::atomic<std::uint64_t> num_session{0};
+    std::atomic<std::uint64_t> num_request{0};
+    std::atomic<std::uint64_t> bytes_read{0};
+    std::atomic<std::uint64_t> bytes_write{0};
+};
+
+// Shared between processes, must not hide a lock in the process
+static_assert(std::atomic<std::uint64_t>::is_always_lock_free);
+
+/// Add the session metrics to the worker slot, then call the user reporter.
+template <typename Reporter>
+struct PreforkReporter {
+    Reporter reporter;
+    PreforkSlot* slot;
+
+    void operator()(const SessionMetrics& metrics)
+    {
+        constexpr auto kOrder = std::memory_order_relaxed;
+
+        slot->num_session.fetch_add(1, kOrder);
+        slot->num_request.fetch_add(
+            static_cast<std::uint64_t>(metrics.num_request), kOrder);
+        slot->bytes_read.fetch_add(
+            static_cast<std::uint64_t>(metrics.bytes_read), kOrder);
+        slot->bytes_write.fetch_add(
+            static_cast<std::uint64_t>(metrics.bytes_write), kOrder);
+
+        if constexpr (std::invocable<Reporter&, const SessionMetrics&>) {
+            std::invoke(reporter, metrics);
+        }
+    }
+
+    void operator()(const RequestMetrics& metrics)
+        requires std::invocable<Reporter&, const RequestMetrics&>
+    {
+        std::invoke(reporter, metrics);
+    }
+};
+
+/**
+  Wait up to timeout for one of the blocked signals in set. Returns true if one
+  arrived, it is no longer pending.
+*/
+inline bool wait_signal(const sigset_t& set, std::chrono::nanoseconds timeout)
+{
+#if defined(__APPLE__)
+    // No sigtimedwait on macOS. Poll the pending set and take the signal with
+    // sigwait, which returns right away once it is pending.
+    const auto is_pending = [&set]() {
+        sigset_t pending;
+        ::sigemptyset(&pending);
+        if (::sigpending(&pending) != 0) {
+            return false;
+        }
+
+        for (int sig = 1; sig < NSIG; ++sig) {
+            if ((::sigismember(&set, sig) == 1) &&
+                (::sigismember(&pending, sig) == 1)) {
+                return true;
+            }
+        }
+
+        return false;
+    };
+
+    if (!is_pending()) {
+        std::this_thread::sleep_for(timeout);
+        if (!is_pending()) {
+            return false;
+        }
+    }
+
+    int sig = 0;
+    return ::sigwait(&set, &sig) == 0;
+#else
+    const auto sec = std::chrono::duration_cast<std::chrono::seconds>(timeout);
+    const timespec ts{
+        static_cast<time_t>(sec.count()),
+        static_cast<long>((timeout - sec).count())};
+
+    return ::sigtimedwait(&set, nullptr, &ts) > 0;
+#endif
+}
+
+} // namespace detail
+
+/**
+  Supervisor of the worker processes. The listening socket is opened in the
+  constructor, so a bind error throws there. Call run to fork the workers.
+
+  By default the workers share the one listening socket. Each one waits for it
+  in its own event loop so every new connection wakes all of them, and all but
+  one find nothing to accept. Fine for a few workers or a modest connection
+  rate. Set the reuse_port listen option on Linux to give each worker its own
+  SO_REUSEPORT listener on a TCP endpoint instead, the kernel then hands each
+  connection to one worker. The trade off is that connections queued on the
+  listener of a worker that exits are reset, and the supervisor only checks the
+  bind and does not hold the port while the workers restart.
+*/
+class PreforkServer {
+public:
+    // Supervisor loop checks for exited workers and stop requests this often
+    static constexpr std::chrono::milliseconds kPollInterval{50};
+
+    template <Endpoint Endpoint, Handler Handler, Reporter Reporter = bool>
+    PreforkServer(
+        const Endpoint& endpoint, listen_options listen,
+        prefork_options options, Handler handler, Reporter reporter = {})
+        : options_{std::move(options)}
+    {
+        if (options_.num_worker == 0) {
+            options_.num_worker =
+                std::max(1u, std::thread::hardware_concurrency());
+        }
+
+        void* ptr = ::mmap(
+            nullptr, sizeof(detail::PreforkSlot) * options_.num_worker,
+            PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (ptr == MAP_FAILED) {
+            throw boost::system::system_error{
+                errno, boost::system::system_category(), "mmap"};
+        }
+
+        slots_ = static_cast<detail::PreforkSlot*>(ptr);
+        for (std::size_t i = 0; i < options_.num_worker; ++i) {
+            new (slots_ + i) detail::PreforkSlot{};
+        }
+
+        // With reuse_port each worker binds its own TCP listener
+        const bool own_listener =
+            listen.reuse_port &&
+            detail::kIsTcp<typename Endpoint::protocol_type>;
+
+        // Bind once in the supervisor so a bind error throws here, the workers
+        // inherit the socket. Release it from the temporary context so no
+        // worker inherits its reactor.
+        try {
+            asio::io_context ctx{1};
+            auto acceptor =
+                detail::open_acceptor(ctx.get_executor(), endpoint, listen);
+            if (!own_listener) {
+                fd_ = static_cast<int>(acceptor.release());
+            }
+        } catch (...) {
+            ::munmap(slots_, sizeof(detail::PreforkSlot) * options_.num_worker);
+            throw;
+        }
+
+        worker_ = [fd = fd_, endpoint, listen, handler = std::move(handler),
+                   reporter = std::move(reporter)](detail::PreforkSlot& slot) {
+            asio::io_context ioc{1};
+
+            auto acceptor =
+                (fd < 0) ? detail::open_acceptor(
+                               ioc.get_executor(), endpoint, listen)
+                         : detail::adopt_acceptor(
+                               ioc.get_executor(), endpoint.protocol(), fd);
+
+            co_spawn(
+                ioc,
+                detail::accept(
+                    std::move(acceptor), listen, handler,
+                    detail::PreforkReporter<Reporter>{reporter, &slot}),
+                [](auto ptr) {
+                    // Propagate exception from the coroutine
+                    if (ptr) {
+                        std::rethrow_exception(ptr);
+                    }
+                });
+
+            // A worker gets the stop signal twice when it is sent to the whole
+            // process group, e.g. Ctrl+C, and the supervisor forwards it. Keep
+            // draining, the supervisor kills it after the stop timeout.
+            asio::signal_set signals{ioc, SIGINT, SIGTERM};
+            detail::drain_on_signal(
+                ioc, signals, listen.drain_timeout, reporter, false);
+
+            ioc.run();
+        };
+    }
+
+    PreforkServer(const PreforkServer&) = delete;
+    PreforkServer& operator=(const PreforkServer&) = delete;
+
+    /// Call after run has returned.
+    ~PreforkServer()
+    {
+        if (fd_ >= 0) {
+            ::close(fd_);
+        }
+        ::munmap(slots_, sizeof(detail::PreforkSlot) * options_.num_worker);
+    }
+
+    /**
+      Fork the workers and supervise them until stop is called or the process
+      receives SIGTERM or SIGINT. Returns once all workers have exited.
+
+      The stop signals are blocked on the calling thread and waited for in the
+      loop, so other threads in the process must block them too.
+
+      Call once, the shared listening socket is closed when the workers stop.
+
+      Only the calling thread is forked. Threads started before run, e.g. the
+      AccessLog writer or a thread pool for make_co_handler, do not exist in
+      the workers. Start them in the handler or reporter of each worker.
+    */
+    void run()
+    {
+        sigset_t stop_signals;
+        ::sigemptyset(&stop_signals);
+        ::sigaddset(&stop_signals, SIGINT);
+        ::sigaddset(&stop_signals, SIGTERM);
+        ::pthread_sigmask(SIG_BLOCK, &stop_signals, &mask_);
+
+        workers_.assign(options_.num_worker, Worker{});
+        for (std::size_t i = 0; i < workers_.size(); ++i) {
+            spawn(i);
+        }
+
+        auto next_report = clock_type::now() + options_.report_interval;
+        while (!stop_.load(std::memory_order_relaxed)) {
+            if (detail::wait_signal(stop_signals, kPollInterval)) {
+                break;
+            }
+
+            reap();
+
+            // Start workers that exited again after the restart delay
+            const auto now = clock_type::now();
+            for (std::size_t i = 0; i < workers_.size(); ++i) {
+                if ((workers_[i].pid == 0) && (now >= workers_[i].restart_at)) {
+                    if (spawn(i)) {
+                        num_restart_.fetch_add(1, std::memory_order_relaxed);
+                    }
+                }
+            }
+
+            if (options_.report && (now >= next_report)) {
+                options_.report(metrics());
+                next_report = now + options_.report_interval;
+            }
+        }
+
+        stop_workers();
+
+        if (options_.report) {
+            options_.report(metrics());
+        }
+
+        ::pthread_sigmask(SIG_SETMASK, &mask_, nullptr);
+    }
+
+    /// Ask run to stop the workers and return. Safe to call from any thread.
+    void stop() noexcept
+    {
+        stop_.store(true, std::memory_order_relaxed);
+    }
+
+    /// Aggregate metrics of all workers. Safe to call from any thread.
+    [[nodiscard]] PreforkMetrics metrics() const
+    {
+        constexpr auto kOrder = std::memory_order_relaxed;
+
+        PreforkMetrics metrics;
+        metrics.num_worker = num_running_.load(kOrder);
+        metrics.num_restart = num_restart_.load(kOrder);
+        for (std::size_t i = 0; i < options_.num_worker; ++i) {
+            const auto& slot = slots_[i];
+            metrics.num_session += slot.num_session.load(kOrder);
+            metrics.num_request += slot.num_request.load(kOrder);
+            metrics.bytes_read += slot.bytes_read.load(kOrder);
+            metrics.bytes_write += slot.bytes_write.load(kOrder);
+        }
+
+        return metrics;
+    }
+
+private:
+    using clock_type = std::chrono::steady_clock;
+
+    struct Worker {
+        pid_t pid{0};
+        clock_type::time_point restart_at{};
+    };
+
+    /// Fork worker i. Returns false and retries later if fork failed.
+    bool spawn(std::size_t i)
+    {
+        const pid_t pid = ::fork();
+        if (pid < 0) {
+            workers_[i].restart_at = clock_type::now() + options_.restart_delay;
+            return false;
+        }
+
+        if (pid == 0) {
+            // Worker process, never returns to the caller of run
+            ::pthread_sigmask(SIG_SETMASK, &mask_, nullptr);
+
+            int status = 0;
+            try {
+                worker_(slots_[i]);
+            } catch (...) {
+                status = 1;
+            }
+
+            ::_exit(status);
+        }
+
+        workers_[i].pid = pid;
+        num_running_.fetch_add(1, std::memory_order_relaxed);
+
+        return true;
+    }
+
+    /// Collect the workers that exited, without blocking.
+    void reap()
+    {
+        for (auto& worker : workers_) {
+            int status = 0;
+            if ((worker.pid > 0) &&
+                (::waitpid(worker.pid, &status, WNOHANG) == worker.pid)) {
+                worker.pid = 0;
+                worker.restart_at = clock_type::now() + options_.restart_delay;
+                num_running_.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+      Close the shared listener, forward SIGTERM to the workers, and kill any
+      left after the stop timeout. Once the workers stop listening the socket
+      is gone, so new connections are refused instead of queued with nobody to
+      accept them.
+    */
+    void stop_workers()
+    {
+        if (fd_ >= 0) {
+            ::close(fd_);
+            fd_ = -1;
+        }
+
+        for (const auto& worker : workers_) {
+            if (worker.pid > 0) {
+                ::kill(worker.pid, SIGTERM);
+            }
+        }
+
+        const auto deadline = clock_type::now() + options_.stop_timeout;
+        while (num_running_.load(std::memory_order_relaxed) > 0) {
+            reap();
+
+            if (clock_type::now() >= deadline) {
+                break;
+            }
+
+            std::this_thread::sleep_for(std::chrono::milliseconds{10});
+        }
+
+        for (auto& worker : workers_) {
+            if (worker.pid > 0) {
+                ::kill(worker.pid, SIGKILL);
+
+                int status = 0;
+                ::waitpid(worker.pid, &status, 0);
+                worker.pid = 0;
+                num_running_.fetch_sub(1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    prefork_options options_;
+    int fd_{-1};
+    detail::PreforkSlot* slots_{nullptr};
+    std::function<void(detail::PreforkSlot&)> worker_;
+    std::vector<Worker> workers_;
+    sigset_t mask_{};
+    std::atomic<bool> stop_{false};
+    std::atomic<int> num_running_{0};
+    std::atomic<int> num_restart_{0};
+};
+
+/**
+  Run a server in prefork mode. Listen on endpoint and route all requests to
+  the handler function object in each worker process.
+
+  Supervise the workers "forever" until a SIGINT or SIGTERM signal, then stop
+  them and return.
+*/
+template <Endpoint Endpoint, Handler Handler, Reporter Reporter = bool>
+void run_prefork(
+    const Endpoint& endpoint, listen_options listen, prefork_options options,
+    Handler handler, Reporter reporter = {})
+{
+    PreforkServer server{
+        endpoint, listen, std::move(options), std::move(handler),
+        std::move(reporter)};
+
+    server.run();
+}
+
+/// Run a server on the TCP port on all IPv4 addresses.
+template <Handler Handler, Reporter Reporter = bool>
+void run_prefork(
+    int port, listen_options listen, prefork_options options, Handler handler,
+    Reporter reporter = {})
+{
+    run_prefork(
+        detail::tcp_endpoint(port), listen, std::move(options),
+        std::move(handler), std::move(reporter));
+}
+
+} // namespace skye
+
+#endif // SKYE_PREFORK_HPP_
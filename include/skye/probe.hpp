@@ -0,0 +1,59 @@
+//
+// skye/probe.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  USDT static probes for bpftrace, perf, and SystemTap. The library is header
+  only and inlined into the app so there are no stable function symbols for
+  uprobes. The probes are stable names in the skye provider instead.
+
+  A probe is a single nop instruction until a tracer attaches to it. Probes are
+  compiled out unless SKYE_ENABLE_USDT is defined, or the ENABLE_USDT CMake
+  option is on and sys/sdt.h is found (systemtap-sdt-dev package).
+
+  Probes and arguments:
+
+  accept(fd)
+  request(fd, num_request, bytes_read)
+  handler_start(fd, num_request)
+  handler_end(fd, num_request)
+  response(fd, num_request, status, bytes_write)
+  session_end(fd, num_request)
+
+  Usage:
+
+  // List the probes in the app
+  bpftrace -l 'usdt:./app:skye:*'
+
+  // Histogram of handler latency in microseconds
+  bpftrace -e '
+    usdt:./app:skye:handler_start { @start[arg0] = nsecs; }
+    usdt:./app:skye:handler_end /@start[arg0]/ {
+      @us = hist((nsecs - @start[arg0]) / 1000); delete(@start[arg0]);
+    }'
+*/
+#ifndef SKYE_PROBE_HPP_
+#define SKYE_PROBE_HPP_
+
+#if defined(SKYE_ENABLE_USDT)
+
+#include <sys/sdt.h>
+
+#define SKYE_PROBE1(name, a1) DTRACE_PROBE1(skye, name, a1)
+#define SKYE_PROBE2(name, a1, a2) DTRACE_PROBE2(skye, name, a1, a2)
+#define SKYE_PROBE3(name, a1, a2, a3) DTRACE_PROBE3(skye, name, a1, a2, a3)
+#define SKYE_PROBE4(name, a1, a2, a3, a4)                                      \
+    DTRACE_PROBE4(skye, name, a1, a2, a3, a4)
+
+#else
+
+// Arguments are not evaluated if probes are disabled
+#define SKYE_PROBE1(name, a1) static_cast<void>(0)
+#define SKYE_PROBE2(name, a1, a2) static_cast<void>(0)
+#define SKYE_PROBE3(name, a1, a2, a3) static_cast<void>(0)
+#define SKYE_PROBE4(name, a1, a2, a3, a4) static_cast<void>(0)
+
+#endif // SKYE_ENABLE_USDT
+
+#endif // SKYE_PROBE_HPP_
@@ -0,0 +1,334 @@
+//
+// skye/query_params.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Read parameters from the request target without allocating memory. The view
+  splits the target lazily on each lookup and converts values with
+  std::from_chars.
+
+  Usage:
+
+  // GET /queries?n=20&name=J%C3%BCrgen
+  const skye::query_params params{req};
+
+  const int n = params.get<int>("n").value_or(1);
+
+  std::array<char, 64> buf;
+  const auto name = params.get("name", buf);
+*/
+#ifndef SKYE_QUERY_PARAMS_HPP_
+#define SKYE_QUERY_PARAMS_HPP_
+
+#include <boost/beast/http/message.hpp>
+
+#include <charconv>
+#include <concepts>
+#include <cstddef>
+#include <iterator>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <system_error>
+#include <type_traits>
+
+namespace skye {
+
+namespace http = boost::beast::http;
+
+/**
+  Decode a percent encoded string into the output buffer. Also decodes '+' to
+  a space as used by HTML forms. Returns a view of the decoded bytes in the
+  output buffer, or nothing if the input is malformed or does not fit.
+
+  The decoded string is never longer than the input so the output may be the
+  input itself to decode in place.
+*/
+constexpr std::optional<std::string_view>
+percent_decode(std::string_view str, std::span<char> out)
+{
+    constexpr auto hex = [](char ch) -> int {
+        if ((ch >= '0') && (ch <= '9')) {
+            return ch - '0';
+        }
+        if ((ch >= 'a') && (ch <= 'f')) {
+            return ch - 'a' + 10;
+        }
+        if ((ch >= 'A') && (ch <= 'F')) {
+            return ch - 'A' + 10;
+        }
+        return -1;
+    };
+
+    std::size_t size = 0;
+    for (std::size_t i = 0; i < str.size(); ++i, ++size) {
+        if (size == out.size()) {
+            return std::nullopt;
+        }
+
+        char ch = str[i];
+        if (ch == '%') {
+            if (i + 2 >= str.size()) {
+                return std::nullopt;
+            }
+
+            const int hi = hex(str[i + 1]);
+            const int lo = hex(str[i + 2]);
+            if ((hi < 0) || (lo < 0)) {
+                return std::nullopt;
+            }
+
+            ch = static_cast<char>((hi << 4) | lo);
+            i += 2;
+        } else if (ch == '+') {
+            ch = ' ';
+        }
+
+        out[size] = ch;
+    }
+
+    return std::string_view{out.data(), size};
+}
+
+/**
+  Lazy view of the path and query string parameters of a request target. The
+  view does not own the target, keep the request alive while using it.
+
+  Keys and values are compared and returned in their raw encoded form. Use the
+  get overload that takes a buffer to decode a value.
+
+  /users/42/posts?limit=10&sort=date
+  ^ path          ^ query
+*/
+class query_params {
+public:
+    /// One key=value pair from the query string, still percent encoded.
+    struct param {
+        std::string_view key;
+        std::string_view value;
+    };
+
+    /// Forward iterator over the query string parameters.
+    class iterator {
+    public:
+        using iterator_category = std::forward_iterator_tag;
+        using value_type = param;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const param*;
+        using reference = const param&;
+
+        constexpr iterator() = default;
+
+        constexpr explicit iterator(std::string_view query) : rest_{query}
+        {
+            next();
+        }
+
+        constexpr reference operator*() const
+        {
+            return param_;
+        }
+
+        constexpr pointer operator->() const
+        {
+            return &param_;
+        }
+
+        constexpr iterator& operator++()
+        {
+            next();
+            return *this;
+        }
+
+        constexpr iterator operator++(int)
+        {
+            iterator tmp = *this;
+            next();
+            return tmp;
+        }
+
+        friend constexpr bool operator==(const iterator& a, const iterator& b)
+        {
+            return (a.end_ == b.end_) &&
+                   (a.end_ || (a.param_.key.data() == b.param_.key.data()));
+        }
+
+    private:
+        // Skip empty pairs like "a=1&&b=2"
+        constexpr void next()
+        {
+            while (!rest_.empty()) {
+                const auto amp = rest_.find('&');
+                const auto pair = rest_.substr(0, amp);
+                rest_ = (amp == std::string_view::npos) ? std::string_view{}
+                                                        : rest_.substr(amp + 1);
+                if (pair.empty()) {
+                    continue;
+                }
+
+                const auto eq = pair.find('=');
+                param_.key = pair.substr(0, eq);
+                param_.value = (eq == std::string_view::npos)
+                                   ? std::string_view{}
+                                   : pair.substr(eq + 1);
+                end_ = false;
+                return;
+            }
+
+            param_ = {};
+            end_ = true;
+        }
+
+        std::string_view rest_;
+        param param_;
+        bool end_{true};
+    };
+
+    constexpr query_params() = default;
+
+    constexpr explicit query_params(std::string_view target)
+    {
+        const auto pos = target.find('?');
+        path_ = target.substr(0, pos);
+        if (pos != std::string_view::npos) {
+            query_ = target.substr(pos + 1);
+        }
+    }
+
+    template <typename Body, typename Fields>
+    explicit query_params(const http::request<Body, Fields>& req)
+        : query_params{
+              std::string_view{req.target().data(), req.target().size()}}
+    {
+    }
+
+    /// The target up to the query string, e.g. "/users/42/posts".
+    [[nodiscard]] constexpr std::string_view path() const
+    {
+        return path_;
+    }
+
+    /// The raw query string without the '?', e.g. "limit=10&sort=date".
+    [[nodiscard]] constexpr std::string_view query() const
+    {
+        return query_;
+    }
+
+    [[nodiscard]] constexpr iterator begin() const
+    {
+        return iterator{query_};
+    }
+
+    [[nodiscard]] constexpr iterator end() const
+    {
+        return iterator{};
+    }
+
+    /**
+      Path segment by index, e.g. segment(1) is "42" for "/users/42/posts".
+    */
+    [[nodiscard]] constexpr std::optional<std::string_view>
+    segment(std::size_t index) const
+    {
+        std::string_view rest = path_;
+        for (;;) {
+            if (rest.starts_with('/')) {
+                rest.remove_prefix(1);
+            }
+
+            if (rest.empty()) {
+                return std::nullopt;
+            }
+
+            const auto slash = rest.find('/');
+            if (index == 0) {
+                return rest.substr(0, slash);
+            }
+
+            if (slash == std::string_view::npos) {
+                return std::nullopt;
+            }
+
+            rest.remove_prefix(slash);
+            --index;
+        }
+    }
+
+    /**
+      The raw value of the first parameter with this key. A key without a value,
+      e.g. "?verbose", is found with an empty value.
+    */
+    [[nodiscard]] constexpr std::optional<std::string_view>
+    find(std::string_view key) const
+    {
+        for (const auto& p : *this) {
+            if (p.key == key) {
+                return p.value;
+            }
+        }
+
+        return std::nullopt;
+    }
+
+    [[nodiscard]] constexpr bool contains(std::string_view key) const
+    {
+        return find(key).has_value();
+    }
+
+    /**
+      Convert the value of a parameter to an integer with std::from_chars. The
+      whole value must be a number in range for the type. Returns nothing if
+      the key is missing or the conversion fails.
+
+      get<std::string_view> returns the raw value.
+    */
+    template <typename T>
+        requires(std::integral<T> && !std::same_as<T, bool>) ||
+                std::same_as<T, std::string_view>
+    [[nodiscard]] std::optional<T> get(std::string_view key) const
+    {
+        const auto value = find(key);
+        if constexpr (std::is_same_v<T, std::string_view>) {
+            return value;
+        } else {
+            if (!value || value->empty()) {
+                return std::nullopt;
+            }
+
+            T result{};
+            const auto* last = value->data() + value->size();
+            const auto [ptr, ec] =
+                std::from_chars(value->data(), last, result);
+            if ((ec != std::errc{}) || (ptr != last)) {
+                return std::nullopt;
+            }
+
+            return result;
+        }
+    }
+
+    /**
+      Percent decode the value of a parameter into the caller's buffer. Returns
+      a view of the buffer, or nothing if the key is missing, the value is
+      malformed, or the buffer is too small.
+    */
+    [[nodiscard]] constexpr std::optional<std::string_view>
+    get(std::string_view key, std::span<char> buf) const
+    {
+        const auto value = find(key);
+        if (!value) {
+            return std::nullopt;
+        }
+
+        return percent_decode(*value, buf);
+    }
+
+private:
+    std::string_view path_;
+    std::string_view query_;
+};
+
+} // namespace skye
+
+#endif // SKYE_QUERY_PARAMS_HPP_
@@ -20,11 +20,23 @@
 
   // Listen on port 8080 and route all HTTP requests to the handler.
   run(8080, handler);
+
+  // Or listen on a Unix domain socket, e.g. behind a sidecar proxy. A leading
+  // null character is a Linux abstract namespace socket.
+  run(asio::local::stream_protocol::endpoint{"/run/skye.sock"}, handler);
+
+  // Or accept on a socket that is already listening, e.g. one passed in by
+  // systemd socket activation, see handoff.hpp. POSIX only.
+  run(listen_fd<asio::ip::tcp>{3}, handler);
 */
 #ifndef SKYE_SERVICE_HPP_
 #define SKYE_SERVICE_HPP_
 
+#include <skye/drain.hpp>
+#include <skye/listen_options.hpp>
+#include <skye/probe.hpp>
 #include <skye/session.hpp>
+#include <skye/trace.hpp>
 #include <skye/types.hpp>
 
 #include <boost/asio/as_tuple.hpp>
@@ -32,16 +44,105 @@
 #include <boost/asio/co_spawn.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/local/stream_protocol.hpp>
+#include <boost/asio/post.hpp>
 #include <boost/asio/signal_set.hpp>
 #include <boost/asio/this_coro.hpp>
 #include <boost/asio/use_awaitable.hpp>
+#include <boost/system/system_error.hpp>
+
+#if !defined(_WIN32)
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
+#include <cerrno>
+#include <chrono>
+#include <concepts>
 #include <exception>
+#include <functional>
+#include <type_traits>
+#include <utility>
 
 namespace skye {
 
 namespace asio = boost::asio;
 
+/**
+  Endpoint of a stream protocol to listen on, asio::ip::tcp::endpoint or
+  asio::local::stream_protocol::endpoint.
+*/
+// clang-format off
+template <typename T>
+concept Endpoint = requires(const T& endpoint) {
+    typename T::protocol_type::acceptor;
+    typename T::protocol_type::socket;
+    endpoint.protocol();
+};
+// clang-format on
+
+#if !defined(_WIN32)
+
+/**
+  A socket that is already bound and listening, e.g. inherited from the parent
+  process or passed over a Unix domain socket. Use it in place of an endpoint
+  to accept on the socket instead of binding a new one.
+
+  The server accepts on a duplicate of the descriptor, the caller still owns
+  fd. The listen options that apply to the listener were set by whoever bound
+  it, only the per connection options are used.
+
+  POSIX only.
+*/
+template <typename Protocol>
+class listen_fd {
+public:
+    using protocol_type = Protocol;
+
+    listen_fd(Protocol protocol, int fd) : protocol_{protocol}, fd_{fd}
+    {
+    }
+
+    /// The protocol of a TCP socket is read from its address family.
+    explicit listen_fd(int fd) : listen_fd{socket_protocol(fd), fd}
+    {
+    }
+
+    [[nodiscard]] Protocol protocol() const noexcept
+    {
+        return protocol_;
+    }
+
+    [[nodiscard]] int native_handle() const noexcept
+    {
+        return fd_;
+    }
+
+private:
+    static Protocol socket_protocol([[maybe_unused]] int fd)
+    {
+        if constexpr (std::is_same_v<Protocol, asio::ip::tcp>) {
+            sockaddr_storage addr{};
+            socklen_t size = sizeof(addr);
+            if ((::getsockname(fd, reinterpret_cast<sockaddr*>(&addr), &size) ==
+                 0) &&
+                (addr.ss_family == AF_INET6)) {
+                return asio::ip::tcp::v6();
+            }
+
+            return asio::ip::tcp::v4();
+        } else {
+            return Protocol{};
+        }
+    }
+
+    Protocol protocol_;
+    int fd_;
+};
+
+#endif // !_WIN32
+
 namespace detail {
 
 /**
@@ -55,25 +156,42 @@ namespace detail {
     // HTTP request/response loop
     co_spawn session(stream)
   }
+
+  The loop ends when stop_listening closes the acceptor.
 */
-asio::awaitable<void>
-accept(auto acceptor, Handler auto handler, Reporter auto reporter)
+asio::awaitable<void> accept(
+    auto acceptor, listen_options options, Handler auto handler,
+    Reporter auto reporter)
 {
-    using tcp = asio::ip::tcp;
+    const ListenerGuard guard{
+        asio::query(acceptor.get_executor(), asio::execution::context),
+        acceptor};
+
+    TraceContext trace_ctx{static_cast<int>(acceptor.native_handle())};
 
     for (;;) {
+        ++trace_ctx.request;
+
+        trace_begin("accept", trace_ctx);
         auto [ec, stream] = co_await acceptor.async_accept();
+        trace_end("accept", trace_ctx);
 
         if (ec) {
+            if (!acceptor.is_open()) {
+                break;
+            }
+
             continue;
         }
 
-        stream.set_option(tcp::no_delay{true}, ec);
+        set_accept_options(stream, options, ec);
 
         if (ec) {
             continue;
         }
 
+        SKYE_PROBE1(accept, stream.native_handle());
+
         // Run coroutine to handle one http connection
         co_spawn(
             acceptor.get_executor(),
@@ -86,27 +204,211 @@ accept(auto acceptor, Handler auto handler, Reporter auto reporter)
     }
 }
 
+// Use a custom completion token for async operations on the acceptor and its
+// incoming socket connections.
+// - Always use co_await
+// - Always return error_code and result as a std::tuple
+template <typename Protocol>
+using acceptor_t = asio::as_tuple_t<asio::use_awaitable_t<>>::as_default_on_t<
+    typename Protocol::acceptor>;
+
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS) && !defined(_WIN32)
+
 /**
-  Bind and listen for incoming connections on the specified port on all
-  IP addresses.
+  Remove a socket file left behind by a previous instance, it would fail the
+  bind. Only a socket that refuses connections is stale. Any other file, or the
+  socket of a live server, is left alone and the bind reports the error.
 */
-asio::awaitable<void>
-listen(int port, Handler auto handler, Reporter auto reporter)
+inline void remove_stale_socket(
+    const asio::any_io_executor& ex,
+    const asio::local::stream_protocol::endpoint& endpoint)
 {
-    // Use a custom completion token for async operations on the acceptor and
-    // its incoming socket connections.
-    // - Always use co_await
-    // - Always return error_code and result as a std::tuple
-    using tcp = asio::ip::tcp;
-    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
-    using tcp_acceptor = default_token::as_default_on_t<tcp::acceptor>;
+    const auto path = endpoint.path();
+    if (path.empty() || (path.front() == '\0')) {
+        return;
+    }
+
+    struct stat info {};
+    if ((::lstat(path.c_str(), &info) != 0) || !S_ISSOCK(info.st_mode)) {
+        return;
+    }
+
+    asio::local::stream_protocol::socket socket{ex};
+
+    boost::system::error_code ec;
+    socket.connect(endpoint, ec);
+
+    if (ec == asio::error::connection_refused) {
+        ::unlink(path.c_str());
+    }
+}
+
+#endif
+
+/**
+  Open an acceptor that is bound and listening on the endpoint.
+
+  A stale Unix domain socket file is removed first, see remove_stale_socket.
+*/
+template <Endpoint Endpoint>
+auto open_acceptor(
+    const asio::any_io_executor& ex, const Endpoint& endpoint,
+    const listen_options& options)
+{
+    using protocol_type = typename Endpoint::protocol_type;
+    using acceptor_type = acceptor_t<protocol_type>;
 
-    tcp::endpoint endpoint{tcp::v4(), static_cast<asio::ip::port_type>(port)};
+#if defined(BOOST_ASIO_HAS_LOCAL_SOCKETS) && !defined(_WIN32)
+    if constexpr (std::is_same_v<protocol_type, asio::local::stream_protocol>) {
+        remove_stale_socket(ex, endpoint);
+    }
+#endif
+
+    acceptor_type acceptor{ex};
+    open_listener(acceptor, endpoint, options);
 
-    tcp_acceptor acceptor{co_await asio::this_coro::executor, endpoint};
+    return acceptor;
+}
+
+#if !defined(_WIN32)
+
+/// Accept on a duplicate of a socket that is already listening.
+template <typename Protocol>
+auto open_acceptor(
+    const asio::any_io_executor& ex, const listen_fd<Protocol>& endpoint,
+    const listen_options& /*options*/)
+{
+    const int fd = ::dup(endpoint.native_handle());
+    if (fd < 0) {
+        throw boost::system::system_error{
+            errno, boost::system::system_category(), "dup"};
+    }
+
+    try {
+        return acceptor_t<Protocol>{ex, endpoint.protocol(), fd};
+    } catch (...) {
+        ::close(fd);
+        throw;
+    }
+}
+
+/**
+  Take ownership of a socket that is already bound and listening, e.g. one
+  inherited from a parent process.
+*/
+template <typename Protocol>
+auto adopt_acceptor(
+    const asio::any_io_executor& ex, const Protocol& protocol,
+    typename Protocol::acceptor::native_handle_type fd)
+{
+    return acceptor_t<Protocol>{ex, protocol, fd};
+}
+
+#endif // !_WIN32
+
+/// Bind and listen for incoming connections on the endpoint.
+asio::awaitable<void> listen(
+    Endpoint auto endpoint, listen_options options, Handler auto handler,
+    Reporter auto reporter)
+{
+    auto acceptor =
+        open_acceptor(co_await asio::this_coro::executor, endpoint, options);
 
     co_await accept(
-        std::move(acceptor), std::move(handler), std::move(reporter));
+        std::move(acceptor), options, std::move(handler), std::move(reporter));
+}
+
+/**
+  On SIGINT or SIGTERM call drain with a completion handler that takes the
+  DrainMetrics, then stop the context once it is called. The handler may be
+  called on another thread. Report the DrainMetrics if the reporter accepts
+  them. A second signal stops the context right away, unless repeat_stops is
+  false. Then later signals are ignored, e.g. in a process whose parent
+  enforces its own stop timeout.
+*/
+template <typename Drain, typename Reporter>
+void drain_on_signal_with(
+    asio::io_context& ioc, asio::signal_set& signals, Drain drain,
+    Reporter reporter, bool repeat_stops = true)
+{
+    signals.async_wait([&ioc, &signals, drain = std::move(drain), reporter,
+                        repeat_stops](auto ec, auto /*sig*/) mutable {
+        if (ec) {
+            return;
+        }
+
+        // Still in the set, later signals stay caught while the drain runs
+        if (repeat_stops) {
+            signals.async_wait([&ioc](auto ec, auto /*sig*/) {
+                if (!ec) {
+                    ioc.stop();
+                }
+            });
+        }
+
+        drain([&ioc, &signals, reporter = std::move(reporter)](
+                  const DrainMetrics& metrics) mutable {
+            // Report and stop on the thread that runs ioc
+            asio::post(
+                ioc, [&ioc, &signals, reporter = std::move(reporter),
+                      metrics]() mutable {
+                    if constexpr (std::invocable<
+                                      Reporter&, const DrainMetrics&>) {
+                        std::invoke(reporter, std::as_const(metrics));
+                    }
+
+                    signals.cancel();
+                    ioc.stop();
+                });
+        });
+    });
+}
+
+/**
+  On SIGINT or SIGTERM drain the servers on the context, then stop it. Report
+  the DrainMetrics if the reporter accepts them. A second signal stops the
+  context right away, unless repeat_stops is false.
+*/
+template <typename Reporter>
+void drain_on_signal(
+    asio::io_context& ioc, asio::signal_set& signals,
+    std::chrono::milliseconds timeout, Reporter reporter,
+    bool repeat_stops = true)
+{
+    drain_on_signal_with(
+        ioc, signals,
+        [&ioc, timeout](auto handler) {
+            async_drain(ioc, timeout, std::move(handler));
+        },
+        std::move(reporter), repeat_stops);
+}
+
+inline asio::ip::tcp::endpoint tcp_endpoint(int port)
+{
+    using tcp = asio::ip::tcp;
+
+    return tcp::endpoint{tcp::v4(), static_cast<asio::ip::port_type>(port)};
+}
+
+/**
+  Trace the hop to the other execution context. The offload span is on the I/O
+  thread and the pool span starts once the handler runs on the other context,
+  the gap between the two is the time spent waiting in its queue.
+*/
+template <typename Response>
+asio::awaitable<Response>
+trace_pool(asio::awaitable<Response> work, TraceContext trace_ctx)
+{
+    const TraceSpan span{"pool", trace_ctx};
+    co_return co_await std::move(work);
+}
+
+template <typename Response>
+asio::awaitable<Response>
+trace_offload(asio::awaitable<Response> work, TraceContext trace_ctx)
+{
+    const TraceSpan span{"offload", trace_ctx};
+    co_return co_await std::move(work);
 }
 
 } // namespace detail
@@ -115,18 +417,28 @@ listen(int port, Handler auto handler, Reporter auto reporter)
   Run the server in a coroutine. Convenient to call similar to asio::async_read
   style free functions.
 
-  The handler function object is called once per request.
+  The handler function object is called once per request. The request and
+  response body types are deduced from the handler, see handler_request_t.
 
   The optional reporter function object is called once per socket session which
   may span multiple requests.
+
+  The listen options tune the listening socket and accepted connections, see
+  listen_options.hpp.
 */
-template <typename ExecutionContext, Handler Handler, Reporter Reporter = bool>
+template <
+    typename ExecutionContext, Endpoint Endpoint, Handler Handler,
+    Reporter Reporter = bool>
 void async_run(
-    ExecutionContext& ctx, int port, Handler handler, Reporter reporter = {})
+    ExecutionContext& ctx, Endpoint endpoint, listen_options options,
+    Handler handler, Reporter reporter = {})
 {
-    // Run coroutine to listen on our port
+    // Run coroutine to listen on our endpoint
     co_spawn(
-        ctx, detail::listen(port, std::move(handler), std::move(reporter)),
+        ctx,
+        detail::listen(
+            std::move(endpoint), options, std::move(handler),
+            std::move(reporter)),
         [](auto ptr) {
             // Propagate exception from the coroutine
             if (ptr) {
@@ -135,50 +447,124 @@ void async_run(
         });
 }
 
+template <
+    typename ExecutionContext, Endpoint Endpoint, Handler Handler,
+    Reporter Reporter = bool>
+void async_run(
+    ExecutionContext& ctx, Endpoint endpoint, Handler handler,
+    Reporter reporter = {})
+{
+    async_run(
+        ctx, std::move(endpoint), listen_options{}, std::move(handler),
+        std::move(reporter));
+}
+
+/// Listen on the TCP port on all IPv4 addresses.
+template <typename ExecutionContext, Handler Handler, Reporter Reporter = bool>
+void async_run(
+    ExecutionContext& ctx, int port, listen_options options, Handler handler,
+    Reporter reporter = {})
+{
+    async_run(
+        ctx, detail::tcp_endpoint(port), options, std::move(handler),
+        std::move(reporter));
+}
+
+template <typename ExecutionContext, Handler Handler, Reporter Reporter = bool>
+void async_run(
+    ExecutionContext& ctx, int port, Handler handler, Reporter reporter = {})
+{
+    async_run(
+        ctx, detail::tcp_endpoint(port), listen_options{}, std::move(handler),
+        std::move(reporter));
+}
+
 /**
-  Run a server. Listen on port and route all requests to the handler function
-  object.
+  Run a server. Listen on endpoint and route all requests to the handler
+  function object.
 
   Run event loop "forever" on this thread. Sets a signal handler to stop
   cleanly.
 
   Opinionated design for use in a container behind load balancer. Listen on
-  port until the container runtime sends a SIGTERM signal. Single thread, scale
+  port until the container runtime sends a SIGTERM signal, then drain the
+  connections for up to the drain_timeout listen option. Single thread, scale
   service horizontally with more instances.
 
   The optional reporter function object is called once per socket session which
   may span multiple requests.
 */
-template <Handler Handler, Reporter Reporter = bool>
-void run(int port, Handler handler, Reporter reporter = {})
+template <Endpoint Endpoint, Handler Handler, Reporter Reporter = bool>
+void run(
+    Endpoint endpoint, listen_options options, Handler handler,
+    Reporter reporter = {})
 {
     // Concurrency hint to asio that run is single threaded
     asio::io_context ioc{1};
 
-    // Listen on port and route all HTTP requests to the handler
-    async_run(ioc, port, std::move(handler), std::move(reporter));
+    // Listen on endpoint and route all HTTP requests to the handler
+    async_run(ioc, std::move(endpoint), options, std::move(handler), reporter);
 
     // SIGTERM is sent by Docker to ask us to stop (politely)
     // SIGINT handles local Ctrl+C in a terminal
     asio::signal_set signals{ioc, SIGINT, SIGTERM};
-    signals.async_wait([&ioc](auto /*ec*/, auto /*sig*/) { ioc.stop(); });
+    detail::drain_on_signal(
+        ioc, signals, options.drain_timeout, std::move(reporter));
 
     // Run event processing loop
     ioc.run();
 }
 
+template <Endpoint Endpoint, Handler Handler, Reporter Reporter = bool>
+void run(Endpoint endpoint, Handler handler, Reporter reporter = {})
+{
+    run(std::move(endpoint), listen_options{}, std::move(handler),
+        std::move(reporter));
+}
+
+/// Run a server on the TCP port on all IPv4 addresses.
+template <Handler Handler, Reporter Reporter = bool>
+void run(
+    int port, listen_options options, Handler handler, Reporter reporter = {})
+{
+    run(detail::tcp_endpoint(port), options, std::move(handler),
+        std::move(reporter));
+}
+
+template <Handler Handler, Reporter Reporter = bool>
+void run(int port, Handler handler, Reporter reporter = {})
+{
+    run(detail::tcp_endpoint(port), listen_options{}, std::move(handler),
+        std::move(reporter));
+}
+
 /**
   Wrap a HTTP request handler in its own coroutine. Intended for use with a
   second ExecutionContext not running in the main I/O thread. This is the
   mechanism to use asio::thread_pool to run the handlers separately from the
   main server event loop.
+
+  A cancellation signal on the returned awaitable, e.g. when the client
+  disconnects, is forwarded to the handler coroutine on the other context.
 */
 template <typename ExecutionContext, Handler Handler>
 auto make_co_handler(ExecutionContext& ctx, Handler handler)
 {
+    using request_type = handler_request_t<Handler>;
+    using response_type = handler_response_t<Handler>;
+
     auto ex = ctx.get_executor();
-    return [=](request req) -> asio::awaitable<response> {
-        return co_spawn(ex, handler(std::move(req)), asio::use_awaitable);
+    return [=](request_type req) -> asio::awaitable<response_type> {
+        if constexpr (kEnableTrace) {
+            const auto trace_ctx = current_trace_context();
+            return detail::trace_offload(
+                co_spawn(
+                    ex, detail::trace_pool(handler(std::move(req)), trace_ctx),
+                    asio::use_awaitable),
+                trace_ctx);
+        } else {
+            return co_spawn(ex, handler(std::move(req)), asio::use_awaitable);
+        }
     };
 }
 
@@ -13,17 +13,42 @@
 #ifndef SKYE_SESSION_HPP_
 #define SKYE_SESSION_HPP_
 
+#include <skye/buffer_pool.hpp>
+#include <skye/capture.hpp>
+#include <skye/clock.hpp>
+#include <skye/drain.hpp>
+#include <skye/probe.hpp>
+#include <skye/trace.hpp>
 #include <skye/types.hpp>
 
+#include <boost/asio/as_tuple.hpp>
 #include <boost/asio/awaitable.hpp>
+#include <boost/asio/execution/context.hpp>
+#include <boost/asio/query.hpp>
+#include <boost/asio/use_awaitable.hpp>
 #include <boost/beast/core/flat_buffer.hpp>
 #include <boost/beast/http/read.hpp>
 #include <boost/beast/http/write.hpp>
 
+#if defined(SKYE_CANCEL_ON_DISCONNECT)
+#include <boost/asio/experimental/awaitable_operators.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#endif
+
+#if defined(SKYE_ENABLE_PHASE_TIMING)
+#include <boost/beast/http/parser.hpp>
+#endif
+
+#include <algorithm>
 #include <chrono>
 #include <concepts>
+#include <cstddef>
 #include <functional>
+#include <tuple>
 #include <type_traits>
+#include <utility>
+#include <variant>
 
 namespace skye {
 
@@ -38,30 +63,321 @@ constexpr auto kRequestSizeLimit = 1000 * 1000;
 template <typename T>
 concept AsyncStream = boost::beast::is_async_stream<T>::value;
 
+namespace detail {
+
+template <typename T>
+struct is_request : std::false_type {};
+
+template <typename Body, typename Fields>
+struct is_request<http::request<Body, Fields>> : std::true_type {};
+
+template <typename T>
+struct is_awaitable_response : std::false_type {};
+
+template <typename Body, typename Fields, typename Executor>
+struct is_awaitable_response<
+    asio::awaitable<http::response<Body, Fields>, Executor>> : std::true_type {
+};
+
+/**
+  Deduce the request type from the argument of a unary call signature. Anything
+  that is not an http::request falls back to the default request type.
+*/
+template <typename Arg>
+struct request_argument {
+    using type = std::conditional_t<
+        is_request<std::remove_cvref_t<Arg>>::value, std::remove_cvref_t<Arg>,
+        request>;
+};
+
+template <typename T>
+struct handler_request {
+    using type = request;
+};
+
+template <typename R, typename Arg>
+struct handler_request<R (*)(Arg)> : request_argument<Arg> {};
+
+template <typename R, typename Arg>
+struct handler_request<R (*)(Arg) noexcept> : request_argument<Arg> {};
+
+template <typename R, typename C, typename Arg>
+struct handler_request<R (C::*)(Arg)> : request_argument<Arg> {};
+
+template <typename R, typename C, typename Arg>
+struct handler_request<R (C::*)(Arg) const> : request_argument<Arg> {};
+
+template <typename R, typename C, typename Arg>
+struct handler_request<R (C::*)(Arg) noexcept> : request_argument<Arg> {};
+
+template <typename R, typename C, typename Arg>
+struct handler_request<R (C::*)(Arg) const noexcept> : request_argument<Arg> {
+};
+
+// Function object with exactly one, non template, call operator
+template <typename T>
+    requires requires { &T::operator(); }
+struct handler_request<T> : handler_request<decltype(&T::operator())> {};
+
+} // namespace detail
+
+/**
+  The request type a handler is called with. Deduced from the signature of a
+  function or a function object with one call operator, e.g. a handler that
+  takes `http::request<http::empty_body>` skips the body parser. Generic lambdas
+  and overloaded function objects get the default `request` type.
+*/
+template <typename T>
+using handler_request_t =
+    typename detail::handler_request<std::decay_t<T>>::type;
+
+/**
+  The response type a handler returns, e.g. `response` or `shared_response`.
+*/
+template <typename T>
+using handler_response_t =
+    typename std::invoke_result_t<T, handler_request_t<T>>::value_type;
+
 /**
   Handler function object must be:
   - CopyConstructible
   - Must be callable with a request and return an awaitable wrapped response
+
+  The request and response may use any Beast body type. The request type is
+  deduced from the handler signature, see handler_request_t. The response may
+  be a `response` with a string body, a `shared_response` with a reference
+  counted body, or any other http::response.
 */
 // clang-format off
 template <typename T>
 concept Handler = std::copy_constructible<T> &&
-    std::is_invocable_r_v<asio::awaitable<response>, T, request>;
+    std::invocable<T, handler_request_t<T>> &&
+    detail::is_awaitable_response<
+        std::invoke_result_t<T, handler_request_t<T>>>::value;
 // clang-format on
 
 /**
   Reporter function object must be:
   - CopyConstructible
-  - Must be callable with a SessionMetrics object OR be an integral type
+  - Must be callable with a SessionMetrics object, a RequestMetrics object, a
+    DrainMetrics object, or any of them, OR be an integral type
 
-  If Reporter is an integral type disable metrics at compile time.
+  If Reporter is an integral type disable metrics at compile time. Each kind of
+  metrics is only collected if the reporter accepts it.
 */
 // clang-format off
 template <typename T>
 concept Reporter = std::copy_constructible<T> &&
-    (std::integral<T> || std::invocable<T, const SessionMetrics&>);
+    (std::integral<T> || std::invocable<T, const SessionMetrics&> ||
+     std::invocable<T, const RequestMetrics&> ||
+     std::invocable<T, const DrainMetrics&>);
 // clang-format on
 
+namespace detail {
+
+// Placeholder for metrics the reporter does not accept, keeps them out of the
+// session coroutine frame
+struct NoMetrics {};
+
+#if defined(SKYE_ENABLE_IDLE_RELEASE)
+
+/**
+  Return the read buffer to the pool while a keep alive connection is idle, then
+  wait for the socket to become readable. Skip the wait if a pipelined request
+  is in the buffer or data is already in the socket. Streams without
+  async_wait, e.g. a TLS stream, keep their buffer.
+*/
+asio::awaitable<void> wait_idle(auto& stream, auto& buffer)
+{
+    using stream_type = std::remove_cvref_t<decltype(stream)>;
+
+    if constexpr (requires(boost::system::error_code ec) {
+                      stream.available(ec);
+                      stream.async_wait(
+                          stream_type::wait_read,
+                          asio::as_tuple(asio::use_awaitable));
+                  }) {
+        if (buffer.size() > 0) {
+            co_return;
+        }
+
+        boost::system::error_code ec;
+        if ((stream.available(ec) > 0) || ec) {
+            co_return;
+        }
+
+        buffer.shrink_to_fit();
+
+        co_await stream.async_wait(
+            stream_type::wait_read, asio::as_tuple(asio::use_awaitable));
+    }
+
+    co_return;
+}
+
+#endif // SKYE_ENABLE_IDLE_RELEASE
+
+/**
+  Wait for the first byte of the next request and read what is there into the
+  buffer. Skip it if a pipelined request is already in the buffer. The session
+  is idle until this returns.
+*/
+asio::awaitable<boost::system::error_code>
+async_read_first(auto& stream, auto& buffer)
+{
+    constexpr std::size_t kReadSize = 4096;
+
+#if defined(SKYE_ENABLE_IDLE_RELEASE)
+    co_await wait_idle(stream, buffer);
+#endif
+
+    if (buffer.size() > 0) {
+        co_return boost::system::error_code{};
+    }
+
+    auto [ec, bytes_read] = co_await stream.async_read_some(
+        buffer.prepare(std::min(buffer.max_size(), kReadSize)),
+        asio::as_tuple(asio::use_awaitable));
+
+    buffer.commit(bytes_read);
+
+    if (ec == asio::error::eof) {
+        co_return http::error::end_of_stream;
+    }
+
+    co_return ec;
+}
+
+/**
+  Record the time between laps into PhaseTimes durations. Does nothing unless
+  phase timing is enabled at compile time.
+*/
+class PhaseTimer {
+public:
+#if defined(SKYE_ENABLE_PHASE_TIMING)
+    PhaseTimer() : last_{phase_clock::now()}
+    {
+    }
+
+    void lap(std::chrono::nanoseconds& phase)
+    {
+        const auto now = phase_clock::now();
+        phase =
+            std::chrono::duration_cast<std::chrono::nanoseconds>(now - last_);
+        last_ = now;
+    }
+
+private:
+    phase_clock::time_point last_;
+#else
+    void lap(std::chrono::nanoseconds& /*phase*/)
+    {
+    }
+#endif
+};
+
+#if defined(SKYE_ENABLE_PHASE_TIMING)
+
+template <typename Request>
+struct request_parser;
+
+template <typename Body, typename Allocator>
+struct request_parser<http::request<Body, http::basic_fields<Allocator>>> {
+    using type = http::request_parser<Body, Allocator>;
+};
+
+/**
+  Read one request in two steps so each one can be timed. Parse the header,
+  then read the body. Call after async_read_first. Same result as
+  http::async_read.
+*/
+template <typename Request>
+asio::awaitable<std::tuple<boost::system::error_code, std::size_t>>
+async_read_phases(
+    auto& stream, auto& buffer, Request& req, PhaseTimes& phases)
+{
+    using result_type = std::tuple<boost::system::error_code, std::size_t>;
+
+    PhaseTimer timer;
+
+    typename request_parser<Request>::type parser;
+
+    std::size_t bytes_read = 0;
+    {
+        auto [ec, bytes_header] =
+            co_await http::async_read_header(stream, buffer, parser);
+
+        bytes_read += bytes_header;
+        timer.lap(phases.header);
+
+        if (ec) {
+            co_return result_type{ec, bytes_read};
+        }
+    }
+
+    {
+        auto [ec, bytes_body] =
+            co_await http::async_read(stream, buffer, parser);
+
+        bytes_read += bytes_body;
+        timer.lap(phases.body);
+
+        if (ec) {
+            co_return result_type{ec, bytes_read};
+        }
+    }
+
+    req = parser.release();
+
+    co_return result_type{boost::system::error_code{}, bytes_read};
+}
+
+#endif // SKYE_ENABLE_PHASE_TIMING
+
+} // namespace detail
+
+#if defined(SKYE_CANCEL_ON_DISCONNECT)
+
+namespace detail {
+
+/**
+  Keep a read pending on the stream while the handler runs. Completes when the
+  client closes or resets the connection. Bytes that arrive in the meantime,
+  e.g. a pipelined request, are kept in the session buffer for the next read.
+*/
+asio::awaitable<void> wait_disconnect(auto& stream, auto& buffer)
+{
+    constexpr std::size_t kReadSize = 4096;
+
+    for (;;) {
+        const std::size_t available = buffer.max_size() - buffer.size();
+        if (available == 0) {
+            // The client is still there but the buffer is full. Stop reading
+            // and wait to be cancelled when the handler completes.
+            asio::steady_timer timer{
+                stream.get_executor(), asio::steady_timer::time_point::max()};
+
+            boost::system::error_code ec;
+            co_await timer.async_wait(
+                asio::redirect_error(asio::use_awaitable, ec));
+            co_return;
+        }
+
+        auto [ec, bytes_read] = co_await stream.async_read_some(
+            buffer.prepare(std::min(available, kReadSize)));
+
+        buffer.commit(bytes_read);
+
+        if (ec) {
+            co_return;
+        }
+    }
+}
+
+} // namespace detail
+
+#endif // SKYE_CANCEL_ON_DISCONNECT
+
 /**
   The HTTP session loop. In the library, a session is multiple HTTP/1.1 requests
   with implicit keep alive over one TCP socket stream. The requests are
@@ -76,31 +392,125 @@ concept Reporter = std::copy_constructible<T> &&
   }
 
   If the user supplies a reporter function object then that is called once after
-  the request loop with the aggregate metrics.
+  the request loop with the aggregate metrics. A reporter that accepts
+  RequestMetrics is also called after each response is written.
 
   The session owns the socket stream. The session owns a copy of the handler
   function and a copy of the reporter function.
+
+  While the server drains, see drain.hpp, the next response closes the
+  connection. An idle keep alive session is shut down right away.
+
+  The request and response body types follow the handler signature. A GET only
+  service can take `http::request<http::empty_body>` so the session does not
+  store or parse request bodies, a request with a body is an error that closes
+  the connection.
+
+  If SKYE_CANCEL_ON_DISCONNECT is defined the session keeps a read pending while
+  the handler runs. If a keep alive client closes or resets the connection, the
+  handler coroutine gets a terminal cancellation signal and the session ends
+  without a response. Requests without keep alive may half close after sending
+  and are not watched.
+
+  If SKYE_ENABLE_PHASE_TIMING is defined the session times each phase of the
+  request with the phase_clock and reports them in the phases member of the
+  metrics objects.
+
+  If SKYE_ENABLE_TRACE is defined the session records session, read, handler,
+  and write spans while a trace capture is running.
+
+  If SKYE_ENABLE_USDT is defined the session fires the USDT probes listed in
+  probe.hpp.
+
+  If SKYE_ENABLE_CAPTURE is defined and a capture is running, the session
+  records the raw request bytes it reads, see capture.hpp.
+
+  The read buffer comes from the per thread buffer pool. If
+  SKYE_ENABLE_IDLE_RELEASE is defined an idle keep alive session returns the
+  buffer to the pool and waits for the socket to become readable before it
+  takes a buffer again. Costs one ioctl per request, saves up to the largest
+  request size per idle connection.
 */
 asio::awaitable<void>
 session(AsyncStream auto stream, Handler auto handler, Reporter auto reporter)
 {
+    if constexpr (
+        kEnableCapture && !detail::is_capture_stream<decltype(stream)>::value) {
+        if (capture_enabled()) {
+            co_await session(
+                capture_stream{std::move(stream)}, std::move(handler),
+                std::move(reporter));
+            co_return;
+        }
+    }
+
     constexpr bool kEnableMetrics =
         std::invocable<decltype(reporter), const SessionMetrics&>;
+    constexpr bool kEnableRequestMetrics =
+        std::invocable<decltype(reporter), const RequestMetrics&>;
 
-    SessionMetrics metrics;
+    std::conditional_t<kEnableMetrics, SessionMetrics, detail::NoMetrics>
+        metrics;
     if constexpr (kEnableMetrics) {
         metrics.fd = static_cast<int>(stream.native_handle());
         metrics.start_time = std::chrono::steady_clock::now();
     }
 
-    boost::beast::flat_buffer buffer{kRequestSizeLimit};
+    std::conditional_t<
+        kEnableRequestMetrics, RequestMetrics, detail::NoMetrics>
+        request_metrics;
+    if constexpr (kEnableRequestMetrics) {
+        request_metrics.fd = static_cast<int>(stream.native_handle());
+    }
+
+    // Shut down the read side of an idle session if the server drains
+    detail::SessionEntry entry{
+        asio::query(stream.get_executor(), asio::execution::context),
+        [&stream]() {
+            boost::system::error_code ec;
+            stream.shutdown(decltype(stream)::shutdown_receive, ec);
+        }};
+
+    TraceContext trace_ctx{static_cast<int>(stream.native_handle())};
+    const TraceSpan session_span{"session", trace_ctx};
+
+    // Responses written, for the drain and the session_end probe
+    int num_response = 0;
+
+    pooled_flat_buffer buffer{kRequestSizeLimit};
 
     for (;;) {
+        PhaseTimes phases;
+
+        ++trace_ctx.request;
+
         // req = read(...)
-        request req;
+        handler_request_t<decltype(handler)> req;
         {
-            auto [ec, bytes_read] =
-                co_await http::async_read(stream, buffer, req);
+            trace_begin("read", trace_ctx);
+
+            // Idle from a response until the first byte of the next request
+            // arrives. A drain closes idle sessions, a partial request or the
+            // first request of a new connection gets its response.
+            entry.idle = (num_response > 0) && (buffer.size() == 0);
+
+            detail::PhaseTimer wait_timer;
+            auto ec = co_await detail::async_read_first(stream, buffer);
+            wait_timer.lap(phases.wait);
+
+            entry.idle = false;
+
+            std::size_t bytes_read = 0;
+            if (!ec) {
+#if defined(SKYE_ENABLE_PHASE_TIMING)
+                std::tie(ec, bytes_read) = co_await detail::async_read_phases(
+                    stream, buffer, req, phases);
+#else
+                std::tie(ec, bytes_read) =
+                    co_await http::async_read(stream, buffer, req);
+#endif
+            }
+            trace_end("read", trace_ctx);
 
             if (ec == http::error::end_of_stream) {
                 stream.shutdown(decltype(stream)::shutdown_send, ec);
@@ -111,28 +521,94 @@ session(AsyncStream auto stream, Handler auto handler, Reporter auto reporter)
                 break;
             }
 
+            SKYE_PROBE3(request, trace_ctx.id, trace_ctx.request, bytes_read);
+
             if constexpr (kEnableMetrics) {
                 metrics.bytes_read += static_cast<int>(bytes_read);
             }
+
+            if constexpr (kEnableRequestMetrics) {
+                ++request_metrics.num_request;
+                request_metrics.method = req.method();
+                request_metrics.set_target(
+                    {req.target().data(), req.target().size()});
+                request_metrics.bytes_read = static_cast<int>(bytes_read);
+                request_metrics.start_time = std::chrono::steady_clock::now();
+            }
         }
 
-        const bool keep_alive = req.keep_alive();
+        bool keep_alive = req.keep_alive();
+
+        detail::PhaseTimer timer;
+
+        set_current_trace_context(trace_ctx);
+        trace_begin("handler", trace_ctx);
+        SKYE_PROBE2(handler_start, trace_ctx.id, trace_ctx.request);
 
         // res = handler(req)
-        response res = co_await std::invoke(handler, std::move(req));
+#if defined(SKYE_CANCEL_ON_DISCONNECT)
+        handler_response_t<decltype(handler)> res;
+        if (keep_alive) {
+            // Race the handler against the client going away, cancel the
+            // loser.
+            using asio::experimental::awaitable_operators::operator||;
+
+            auto result = co_await (
+                std::invoke(handler, std::move(req)) ||
+                detail::wait_disconnect(stream, buffer));
+
+            if (result.index() != 0) {
+                trace_end("handler", trace_ctx);
+                SKYE_PROBE2(handler_end, trace_ctx.id, trace_ctx.request);
+                break;
+            }
+
+            res = std::get<0>(std::move(result));
+        } else {
+            res = co_await std::invoke(handler, std::move(req));
+        }
+#else
+        auto res = co_await std::invoke(handler, std::move(req));
+#endif
+        timer.lap(phases.handler);
+        trace_end("handler", trace_ctx);
+        SKYE_PROBE2(handler_end, trace_ctx.id, trace_ctx.request);
+
+        // Connection: close if the server started to drain meanwhile
+        keep_alive = keep_alive && !entry.draining();
+
         res.prepare_payload();
         res.keep_alive(keep_alive);
 
         // write(res)
+        trace_begin("write", trace_ctx);
         auto [ec, bytes_write] = co_await http::async_write(stream, res);
+        trace_end("write", trace_ctx);
+
+        timer.lap(phases.write);
+
+        SKYE_PROBE4(
+            response, trace_ctx.id, trace_ctx.request, res.result_int(),
+            bytes_write);
+
+        if constexpr (kEnableRequestMetrics) {
+            request_metrics.status = static_cast<int>(res.result_int());
+            request_metrics.bytes_write = static_cast<int>(bytes_write);
+            request_metrics.end_time = std::chrono::steady_clock::now();
+            request_metrics.phases = phases;
+            std::invoke(reporter, std::as_const(request_metrics));
+        }
 
         if (ec) {
             break;
         }
 
+        ++num_response;
+
         if constexpr (kEnableMetrics) {
             ++metrics.num_request;
             metrics.bytes_write += static_cast<int>(bytes_write);
+            metrics.phases += phases;
         }
 
         if (res.need_eof()) {
@@ -141,6 +617,8 @@ session(AsyncStream auto stream, Handler auto handler, Reporter auto reporter)
         }
     }
 
+    SKYE_PROBE2(session_end, trace_ctx.id, num_response);
+
     if constexpr (kEnableMetrics) {
         metrics.end_time = std::chrono::steady_clock::now();
         std::invoke(reporter, metrics);
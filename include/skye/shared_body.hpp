@@ -0,0 +1,214 @@
+//
+// skye/shared_body.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  A Boost.Beast body type that refers to immutable bytes instead of owning a
+  string. Copying a message with this body increments a reference count and the
+  serializer writes straight from the shared memory.
+
+  Usage:
+
+  // Build the payload once, e.g. a cached query result or a static file.
+  const skye::shared_buffer payload{std::string(1 << 20, 'x')};
+
+  auto handler = [payload](request req) -> asio::awaitable<shared_response> {
+    shared_response res{http::status::ok, req.version()};
+    res.set(http::field::content_type, "text/plain");
+    res.body() = payload;
+
+    co_return res;
+  };
+*/
+#ifndef SKYE_SHARED_BODY_HPP_
+#define SKYE_SHARED_BODY_HPP_
+
+#include <boost/asio/buffer.hpp>
+#include <boost/beast/core/buffers_range.hpp>
+#include <boost/beast/http/error.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/optional/optional.hpp>
+
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+
+namespace skye {
+
+namespace http = boost::beast::http;
+
+/**
+  Reference counted view of immutable bytes. The owner keeps the memory alive
+  and the view points somewhere inside of it. A buffer without an owner refers
+  to static storage.
+*/
+class shared_buffer {
+public:
+    shared_buffer() = default;
+
+    /// Take ownership of a string. The bytes are moved, not copied.
+    explicit shared_buffer(std::string str)
+        : shared_buffer{std::make_shared<const std::string>(std::move(str))}
+    {
+    }
+
+    /// Share an existing string.
+    explicit shared_buffer(std::shared_ptr<const std::string> str)
+        : view_{*str}, owner_{std::move(str)}
+    {
+    }
+
+    /// Share bytes kept alive by any owner, e.g. a vector or a memory map.
+    shared_buffer(std::shared_ptr<const void> owner, std::string_view bytes)
+        : view_{bytes}, owner_{std::move(owner)}
+    {
+    }
+
+    /// Refer to bytes with static storage duration, e.g. a string literal.
+    static shared_buffer from_static(std::string_view bytes)
+    {
+        return shared_buffer{nullptr, bytes};
+    }
+
+    [[nodiscard]] const char* data() const noexcept
+    {
+        return view_.data();
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return view_.size();
+    }
+
+    [[nodiscard]] bool empty() const noexcept
+    {
+        return view_.empty();
+    }
+
+    [[nodiscard]] std::string_view view() const noexcept
+    {
+        return view_;
+    }
+
+private:
+    std::string_view view_;
+    std::shared_ptr<const void> owner_;
+};
+
+/**
+  Body type for http::message that holds a shared_buffer. Meets the Beast Body
+  requirements so the message may be serialized and parsed.
+
+  https://www.boost.org/doc/libs/release/libs/beast/doc/html/beast/concepts/Body.html
+*/
+struct shared_body {
+    using value_type = shared_buffer;
+
+    static std::uint64_t size(const value_type& body)
+    {
+        return body.size();
+    }
+
+    /**
+      Parse into a private string and share it once the body is complete.
+    */
+    class reader {
+    public:
+        template <bool IsRequest, typename Fields>
+        explicit reader(
+            http::header<IsRequest, Fields>& /*header*/, value_type& body)
+            : body_{body}
+        {
+        }
+
+        void init(
+            const boost::optional<std::uint64_t>& length,
+            boost::system::error_code& ec)
+        {
+            if (length) {
+                if (*length > buf_.max_size()) {
+                    ec = http::error::buffer_overflow;
+                    return;
+                }
+                buf_.reserve(static_cast<std::size_t>(*length));
+            }
+            ec = {};
+        }
+
+        template <typename ConstBufferSequence>
+        std::size_t
+        put(const ConstBufferSequence& buffers, boost::system::error_code& ec)
+        {
+            const auto extra = boost::asio::buffer_size(buffers);
+            const auto size = buf_.size();
+            if (extra > buf_.max_size() - size) {
+                ec = http::error::buffer_overflow;
+                return 0;
+            }
+
+            buf_.resize(size + extra);
+            ec = {};
+            char* dest = buf_.data() + size;
+            for (const auto b : boost::beast::buffers_range_ref(buffers)) {
+                std::memcpy(dest, b.data(), b.size());
+                dest += b.size();
+            }
+            return extra;
+        }
+
+        void finish(boost::system::error_code& ec)
+        {
+            body_ = value_type{std::move(buf_)};
+            ec = {};
+        }
+
+    private:
+        value_type& body_;
+        std::string buf_;
+    };
+
+    /**
+      Serialize directly from the shared memory in one buffer.
+    */
+    class writer {
+    public:
+        using const_buffers_type = boost::asio::const_buffer;
+
+        template <bool IsRequest, typename Fields>
+        explicit writer(
+            const http::header<IsRequest, Fields>& /*header*/,
+            const value_type& body)
+            : body_{body}
+        {
+        }
+
+        void init(boost::system::error_code& ec)
+        {
+            ec = {};
+        }
+
+        boost::optional<std::pair<const_buffers_type, bool>>
+        get(boost::system::error_code& ec)
+        {
+            ec = {};
+            return {{const_buffers_type{body_.data(), body_.size()}, false}};
+        }
+
+    private:
+        const value_type& body_;
+    };
+};
+
+/**
+  Response with a shared body. Copies of the response share the body bytes so
+  a large cached payload costs a reference count increment per request.
+*/
+using shared_response = http::response<shared_body>;
+
+} // namespace skye
+
+#endif // SKYE_SHARED_BODY_HPP_
@@ -0,0 +1,317 @@
+//
+// skye/single_flight.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Coalesce identical concurrent requests into one call to the user handler. The
+  first request for a key runs the handler and any identical request that
+  arrives while it is in flight waits for the same response.
+
+  A response with a string body is moved into a shared body once, so the
+  waiters share the bytes instead of copying them.
+
+  Usage:
+
+  // Concurrent GET requests for the same target share one database query.
+  auto handler = skye::make_single_flight(
+    skye::make_co_handler(pool, database_handler));
+
+  run(8080, handler);
+*/
+#ifndef SKYE_SINGLE_FLIGHT_HPP_
+#define SKYE_SINGLE_FLIGHT_HPP_
+
+#include <skye/session.hpp>
+#include <skye/shared_body.hpp>
+#include <skye/types.hpp>
+
+#include <boost/asio/any_io_executor.hpp>
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/cancellation_state.hpp>
+#include <boost/asio/cancellation_type.hpp>
+#include <boost/asio/error.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/beast/http/message.hpp>
+#include <boost/beast/http/string_body.hpp>
+#include <boost/system/system_error.hpp>
+
+#include <chrono>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+
+namespace skye {
+
+namespace asio = boost::asio;
+
+namespace detail {
+
+/**
+  Response type of a flight. A string body is copied for every waiter, swap it
+  for a shared body. Other body types are used as is.
+*/
+template <typename Response>
+struct flight_response {
+    using type = Response;
+};
+
+template <typename Fields>
+struct flight_response<http::response<http::string_body, Fields>> {
+    using type = http::response<shared_body, Fields>;
+};
+
+template <typename Response>
+using flight_response_t = typename flight_response<Response>::type;
+
+/// Move the string body of the handler response into a shared body.
+template <typename Response>
+asio::awaitable<flight_response_t<Response>>
+share_body(asio::awaitable<Response> work)
+{
+    Response res = co_await std::move(work);
+
+    flight_response_t<Response> shared{std::move(res.base())};
+    shared.body() = shared_buffer{std::move(res.body())};
+
+    co_return shared;
+}
+
+/// Handler call as an awaitable of the flight response type.
+template <typename Response>
+auto to_flight_response(asio::awaitable<Response> work)
+{
+    if constexpr (std::is_same_v<flight_response_t<Response>, Response>) {
+        return work;
+    } else {
+        return share_body(std::move(work));
+    }
+}
+
+/**
+  One in flight handler call. The leader stores the result once and every waiter
+  gets a copy of the same immutable response.
+*/
+template <typename Response>
+struct Flight {
+    explicit Flight(const asio::any_io_executor& ex)
+        : done{ex, std::chrono::steady_clock::time_point::max()}
+    {
+    }
+
+    // Waiters block on a timer that never expires. The leader cancels it when
+    // the result is ready.
+    asio::steady_timer done;
+    std::shared_ptr<const Response> result;
+    std::exception_ptr error;
+};
+
+template <typename Response>
+using FlightMap =
+    std::unordered_map<std::string, std::shared_ptr<Flight<Response>>>;
+
+/**
+  Default key. Coalesce GET requests with the same target. All other methods
+  may have side effects and are passed straight through to the handler.
+*/
+struct FlightKey {
+    template <typename Request>
+    std::string operator()(const Request& req) const
+    {
+        if (req.method() != http::verb::get) {
+            return {};
+        }
+
+        return std::string{req.target().data(), req.target().size()};
+    }
+};
+
+/**
+  Remove the flight from the map and wake up the waiters. Runs when the leader
+  finishes for any reason, including when its coroutine frame is destroyed
+  before the handler completes.
+*/
+template <typename Response>
+class FlightLanding {
+public:
+    FlightLanding(
+        FlightMap<Response>& flights, const std::string& key,
+        const std::shared_ptr<Flight<Response>>& flight)
+        : flights_{flights}, key_{key}, flight_{flight}
+    {
+    }
+
+    FlightLanding(const FlightLanding&) = delete;
+    FlightLanding& operator=(const FlightLanding&) = delete;
+
+    ~FlightLanding()
+    {
+        if (auto itr = flights_.find(key_);
+            (itr != flights_.end()) && (itr->second == flight_)) {
+            flights_.erase(itr);
+        }
+
+        flight_->done.cancel();
+    }
+
+private:
+    FlightMap<Response>& flights_;
+    const std::string& key_;
+    const std::shared_ptr<Flight<Response>>& flight_;
+};
+
+/**
+  True if the coroutine got a cancellation signal, e.g. its client went away and
+  SKYE_CANCEL_ON_DISCONNECT is defined. Pass in this_coro::cancellation_state,
+  awaiting another coroutine would throw once cancelled.
+*/
+inline bool is_cancelled(const asio::cancellation_state& state)
+{
+    return state.cancelled() != asio::cancellation_type::none;
+}
+
+template <typename Response>
+asio::awaitable<Response> lead_flight(
+    std::shared_ptr<FlightMap<Response>> flights, std::string key,
+    std::shared_ptr<Flight<Response>> flight, asio::awaitable<Response> work)
+{
+    const FlightLanding<Response> landing{*flights, key, flight};
+
+    std::exception_ptr error;
+    try {
+        Response res = co_await std::move(work);
+
+        // Only the map and this coroutine own the flight, nobody is waiting on
+        // the result so skip the shared copy.
+        if (flight.use_count() <= 2) {
+            co_return res;
+        }
+
+        flight->result = std::make_shared<const Response>(std::move(res));
+    } catch (...) {
+        error = std::current_exception();
+    }
+
+    if (error) {
+        // The leader was cancelled for its own reasons. Leave the error out of
+        // the flight so a waiter runs the handler instead.
+        if (!is_cancelled(co_await asio::this_coro::cancellation_state)) {
+            flight->error = error;
+        }
+
+        std::rethrow_exception(error);
+    }
+
+    co_return *flight->result;
+}
+
+/**
+  Wait for the leader. Returns null if the leader went away without a result,
+  e.g. it was cancelled, and the caller should take over.
+*/
+template <typename Response>
+asio::awaitable<std::shared_ptr<const Response>>
+join_flight(std::shared_ptr<Flight<Response>> flight)
+{
+    boost::system::error_code ec;
+    co_await flight->done.async_wait(
+        asio::redirect_error(asio::use_awaitable, ec));
+
+    if (flight->error) {
+        std::rethrow_exception(flight->error);
+    }
+
+    if (!flight->result &&
+        is_cancelled(co_await asio::this_coro::cancellation_state)) {
+        throw boost::system::system_error{asio::error::operation_aborted};
+    }
+
+    co_return flight->result;
+}
+
+/**
+  Join the flight for this key or start a new one. Runs as one step when the
+  session awaits it so the flight is in the map, with its timer, before any
+  other request can see it. If the leader is cancelled the first waiter to wake
+  up starts a new flight and the others join that one.
+*/
+template <typename Response, typename Handler, typename Request>
+asio::awaitable<Response> fly(
+    std::shared_ptr<FlightMap<Response>> flights, std::string key,
+    Handler handler, Request req)
+{
+    for (auto itr = flights->find(key); itr != flights->end();
+         itr = flights->find(key)) {
+        if (auto result = co_await join_flight(itr->second)) {
+            co_return *result;
+        }
+    }
+
+    auto flight = std::make_shared<Flight<Response>>(
+        co_await asio::this_coro::executor);
+    flights->emplace(key, flight);
+
+    co_return co_await lead_flight(
+        flights, std::move(key), std::move(flight),
+        std::invoke(handler, std::move(req)));
+}
+
+} // namespace detail
+
+/**
+  Wrap a HTTP request handler so identical concurrent requests run the handler
+  once. The key function object maps a request to a string, requests with equal
+  keys are identical. An empty key opts the request out of coalescing.
+
+  The default key is the target of a GET request. Use a custom key function if
+  the response also depends on header values, e.g. Authorization or
+  Accept-Encoding.
+
+  Waiters share one immutable response object and each session gets a copy of
+  it. The handler may return a response with a string body, the wrapper
+  returns it with a shared_body so the copies share the bytes. Other body types
+  are copied as is, use one that shares its storage.
+
+  If the leader is cancelled, e.g. its client disconnects, one of the waiters
+  calls the handler in its place. An error from the handler goes to everyone.
+
+  The in flight map is shared by all copies of the returned function object and
+  is not thread safe. Call it from the main I/O thread only, which is the
+  default with run and async_run. To combine with make_co_handler wrap the
+  co_handler, not the other way around.
+*/
+template <Handler Handler, typename KeyFunction = detail::FlightKey>
+auto make_single_flight(Handler handler, KeyFunction key = {})
+{
+    using request_type = handler_request_t<Handler>;
+    using response_type =
+        detail::flight_response_t<handler_response_t<Handler>>;
+
+    auto flights = std::make_shared<detail::FlightMap<response_type>>();
+
+    auto call = [handler](request_type req) {
+        return detail::to_flight_response(
+            std::invoke(handler, std::move(req)));
+    };
+
+    return [=](request_type req) -> asio::awaitable<response_type> {
+        std::string name = std::invoke(key, std::as_const(req));
+        if (name.empty()) {
+            return call(std::move(req));
+        }
+
+        return detail::fly<response_type>(
+            flights, std::move(name), call, std::move(req));
+    };
+}
+
+} // namespace skye
+
+#endif // SKYE_SINGLE_FLIGHT_HPP_
@@ -0,0 +1,429 @@
+//
+// skye/threads.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Run the server on N I/O threads, each pinned to one CPU with its own
+  io_context, SO_REUSEPORT listener, and handler instance. Nothing is shared
+  between threads so per thread state in the handler, e.g. a database
+  connection, cache, or random number generator, needs no synchronization.
+
+  The handler factory is called once on each thread after it is pinned, so the
+  memory it allocates comes from the NUMA node of that CPU. Sessions call the
+  thread's handler by reference, a handler that holds a shared_ptr is not
+  copied into each connection.
+
+  Usage:
+
+  struct Handler {
+    std::mt19937 rng;  // No lock, one per thread
+
+    asio::awaitable<skye::response> operator()(skye::request req);
+  };
+
+  // One thread per CPU in the affinity mask of the process
+  skye::run_threads(8080, {}, {}, [](std::size_t index) {
+    return Handler{std::mt19937(index)};
+  });
+*/
+#ifndef SKYE_THREADS_HPP_
+#define SKYE_THREADS_HPP_
+
+#include <skye/drain.hpp>
+#include <skye/listen_options.hpp>
+#include <skye/service.hpp>
+#include <skye/session.hpp>
+
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/signal_set.hpp>
+
+#if defined(__linux__)
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace skye {
+
+namespace asio = boost::asio;
+
+struct thread_options {
+    /// Number of I/O threads, zero is one per CPU in the affinity mask.
+    std::size_t num_thread{0};
+
+    /// Pin each thread to one CPU, round robin over the CPU list.
+    bool pin{true};
+
+    /**
+      Allocate memory for each thread from the NUMA node of its CPU. Only
+      applies to pinned threads.
+    */
+    bool numa_local{true};
+
+    /// CPUs to run on, empty is the affinity mask of the process.
+    std::vector<int> cpus;
+};
+
+/**
+  Handler factory function object must be:
+  - Callable with the thread index
+  - Return a handler, see Handler. The handler need not be copyable, there is
+    exactly one instance per thread.
+*/
+// clang-format off
+template <typename T>
+concept HandlerFactory = std::invocable<T, std::size_t> &&
+    requires(std::invoke_result_t<T, std::size_t>& handler,
+             handler_request_t<std::invoke_result_t<T, std::size_t>> req) {
+        { handler(std::move(req)) };
+    };
+// clang-format on
+
+namespace detail {
+
+/// CPUs this process may run on, in order.
+inline std::vector<int> allowed_cpus()
+{
+    std::vector<int> cpus;
+
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (::sched_getaffinity(0, sizeof(set), &set) == 0) {
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+            if (CPU_ISSET(cpu, &set)) {
+                cpus.push_back(cpu);
+            }
+        }
+    }
+#endif
+
+    if (cpus.empty()) {
+        const auto n = std::max(1u, std::thread::hardware_concurrency());
+        for (unsigned cpu = 0; cpu < n; ++cpu) {
+            cpus.push_back(static_cast<int>(cpu));
+        }
+    }
+
+    return cpus;
+}
+
+/**
+  Pin the calling thread to one CPU and prefer memory from its NUMA node.
+  Returns false if the platform does not support it or the call failed.
+*/
+inline bool pin_thread(int cpu, bool numa_local)
+{
+#if defined(__linux__)
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set) != 0) {
+        return false;
+    }
+
+    // MPOL_LOCAL allocates on the node of the CPU that touches the page first,
+    // i.e. this one. No libnuma required.
+    if (numa_local) {
+        ::syscall(SYS_set_mempolicy, MPOL_LOCAL, nullptr, 0);
+    }
+
+    return true;
+#else
+    (void)cpu;
+    (void)numa_local;
+    return false;
+#endif
+}
+
+/// Call the thread's handler by reference, one pointer to copy per session.
+template <typename Handler>
+auto make_handler_ref(Handler& handler)
+{
+    using request_type = handler_request_t<Handler>;
+
+    return [&handler](request_type req) { return handler(std::move(req)); };
+}
+
+} // namespace detail
+
+/**
+  Group of I/O threads, each with its own io_context and listener. The
+  listeners are opened in the constructor, so a bind error throws there. The
+  threads run until stop is called or the group is destroyed.
+
+  An exception in any thread, e.g. from a handler, stops the whole group. The
+  kernel would otherwise keep sending a share of the new connections to the
+  listener of the thread that exited. join rethrows the exception.
+*/
+class ServerThreads {
+public:
+    template <
+        Endpoint Endpoint, HandlerFactory HandlerFactory,
+        Reporter Reporter = bool>
+    ServerThreads(
+        const Endpoint& endpoint, listen_options listen,
+        thread_options threads, HandlerFactory factory,
+        Reporter reporter = {})
+    {
+        auto cpus = threads.cpus.empty() ? detail::allowed_cpus()
+                                         : std::move(threads.cpus);
+        const std::size_t num_thread =
+            (threads.num_thread > 0) ? threads.num_thread : cpus.size();
+
+        listen.reuse_port = true;
+
+        // Open all listeners before the first thread starts, a bind error
+        // throws with nothing to clean up
+        std::vector<decltype(detail::open_acceptor(
+            std::declval<asio::any_io_executor>(), endpoint, listen))>
+            acceptors;
+        std::vector<listen_options> per_thread(num_thread, listen);
+        for (std::size_t i = 0; i < num_thread; ++i) {
+            auto& worker = workers_.emplace_back(std::make_unique<Worker>());
+            worker->cpu = threads.pin ? cpus[i % cpus.size()] : -1;
+
+            // Steer connections handled on this CPU to this listener
+            if ((worker->cpu >= 0) && (per_thread[i].incoming_cpu < 0)) {
+                per_thread[i].incoming_cpu = worker->cpu;
+            }
+
+            acceptors.push_back(detail::open_acceptor(
+                worker->ctx.get_executor(), endpoint, per_thread[i]));
+        }
+
+        for (std::size_t i = 0; i < num_thread; ++i) {
+            workers_[i]->thread = std::thread{
+                [this, &worker = *workers_[i], i,
+                 numa_local = threads.numa_local,
+                 acceptor = std::move(acceptors[i]), options = per_thread[i],
+                 factory, reporter]() mutable {
+                    worker.run(
+                        i, numa_local, std::move(acceptor), options, factory,
+                        reporter);
+
+                    if (worker.error) {
+                        fail();
+                    }
+                }};
+        }
+    }
+
+    ServerThreads(const ServerThreads&) = delete;
+    ServerThreads& operator=(const ServerThreads&) = delete;
+
+    ~ServerThreads()
+    {
+        stop();
+        try {
+            join();
+        } catch (...) {
+        }
+    }
+
+    void stop()
+    {
+        for (auto& worker : workers_) {
+            worker->ctx.stop();
+        }
+    }
+
+    /**
+      Call fn once a thread exits with an exception, on that thread. Calls it
+      right away if one already has. Use it to wake up the thread that will
+      join the group.
+    */
+    void on_error(std::function<void()> fn)
+    {
+        std::unique_lock lock{mutex_};
+        if (failed_) {
+            lock.unlock();
+            fn();
+            return;
+        }
+
+        on_error_ = std::move(fn);
+    }
+
+    /**
+      Drain the server on every thread, see async_drain. Call the handler with
+      the sum of the metrics once all are done, on the last thread to finish.
+      A thread exits once its sessions are done and it runs out of work.
+    */
+    template <typename DrainHandler>
+    void async_drain(std::chrono::nanoseconds timeout, DrainHandler handler)
+    {
+        auto join = std::make_shared<detail::DrainJoin<DrainHandler>>(
+            workers_.size(), std::move(handler));
+
+        for (auto& worker : workers_) {
+            skye::async_drain(
+                worker->ctx, timeout,
+                [join](const DrainMetrics& metrics) { join->add(metrics); });
+        }
+    }
+
+    /// Wait for all threads. Rethrows the first exception from a thread.
+    void join()
+    {
+        std::exception_ptr ptr;
+        for (auto& worker : workers_) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+            if (!ptr) {
+                ptr = std::exchange(worker->error, nullptr);
+            }
+        }
+
+        if (ptr) {
+            std::rethrow_exception(ptr);
+        }
+    }
+
+    [[nodiscard]] std::size_t size() const noexcept
+    {
+        return workers_.size();
+    }
+
+    /// CPU that thread i is pinned to, or -1.
+    [[nodiscard]] int cpu(std::size_t i) const noexcept
+    {
+        return workers_[i]->cpu;
+    }
+
+private:
+    struct Worker {
+        // Declared first so the handler outlives the sessions destroyed with
+        // the context
+        std::shared_ptr<void> handler;
+        asio::io_context ctx{1};
+        std::thread thread;
+        std::exception_ptr error;
+        int cpu{-1};
+
+        void run(
+            std::size_t index, bool numa_local, auto acceptor,
+            listen_options options, auto& factory, auto& reporter)
+        {
+            try {
+                if (cpu >= 0) {
+                    detail::pin_thread(cpu, numa_local);
+                }
+
+                // Build the handler on this thread, after it is pinned
+                using handler_type = std::invoke_result_t<
+                    decltype(factory)&, std::size_t>;
+                auto ptr = std::make_shared<handler_type>(factory(index));
+                handler = ptr;
+
+                co_spawn(
+                    ctx,
+                    detail::accept(
+                        std::move(acceptor), options,
+                        detail::make_handler_ref(*ptr), reporter),
+                    [](auto ptr) {
+                        // Propagate exception from the coroutine
+                        if (ptr) {
+                            std::rethrow_exception(ptr);
+                        }
+                    });
+
+                ctx.run();
+            } catch (...) {
+                error = std::current_exception();
+            }
+        }
+    };
+
+    /// Stop all threads and tell the owner, see on_error.
+    void fail()
+    {
+        stop();
+
+        std::function<void()> fn;
+        {
+            const std::lock_guard lock{mutex_};
+            failed_ = true;
+            fn = std::exchange(on_error_, nullptr);
+        }
+
+        if (fn) {
+            fn();
+        }
+    }
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::mutex mutex_;
+    std::function<void()> on_error_;
+    bool failed_{false};
+};
+
+/**
+  Run a server on multiple pinned I/O threads. Listen on endpoint and route all
+  requests to the handler built for each thread by the factory.
+
+  Run "forever" until a SIGINT or SIGTERM signal, then drain every thread, same
+  as run. If a thread exits with an exception the others are stopped and it is
+  rethrown here.
+*/
+template <
+    Endpoint Endpoint, HandlerFactory HandlerFactory, Reporter Reporter = bool>
+void run_threads(
+    Endpoint endpoint, listen_options listen, thread_options threads,
+    HandlerFactory factory, Reporter reporter = {})
+{
+    ServerThreads group{
+        endpoint, listen, std::move(threads), std::move(factory), reporter};
+
+    // SIGTERM is sent by Docker to ask us to stop (politely)
+    // SIGINT handles local Ctrl+C in a terminal
+    asio::io_context ioc{1};
+    asio::signal_set signals{ioc, SIGINT, SIGTERM};
+    detail::drain_on_signal_with(
+        ioc, signals,
+        [&group, timeout = listen.drain_timeout](auto handler) {
+            group.async_drain(timeout, std::move(handler));
+        },
+        std::move(reporter));
+
+    // A thread failed, stop waiting for a signal so join rethrows its error
+    group.on_error([&ioc]() { ioc.stop(); });
+
+    ioc.run();
+
+    group.stop();
+    group.join();
+}
+
+/// Run a server on the TCP port on all IPv4 addresses.
+template <HandlerFactory HandlerFactory, Reporter Reporter = bool>
+void run_threads(
+    int port, listen_options listen, thread_options threads,
+    HandlerFactory factory, Reporter reporter = {})
+{
+    run_threads(
+        detail::tcp_endpoint(port), listen, std::move(threads),
+        std::move(factory), std::move(reporter));
+}
+
+} // namespace skye
+
+#endif // SKYE_THREADS_HPP_
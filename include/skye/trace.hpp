@@ -0,0 +1,402 @@
+//
+// skye/trace.hpp
+//
+// Copyright 2023 Luke Tokheim
+//
+/**
+  Record begin and end events for the phases of each session and export them as
+  Chrome trace event JSON. Open the file in https://ui.perfetto.dev or
+  chrome://tracing to see when each session was running and when it was
+  suspended on the I/O thread.
+
+  Events are async spans keyed by the socket fd so the spans of one session
+  share one track, even if a coroutine resumes on another thread. The request
+  number within the session is in the span arguments.
+
+  Recording is compiled out unless SKYE_ENABLE_TRACE is defined, or the
+  ENABLE_TRACE CMake option is on. If enabled, it is off at runtime until
+  trace_start is called.
+
+  Usage:
+
+  // Capture 10 seconds of trace events, e.g. GET /debug/trace
+  auto handler = [](request req) -> asio::awaitable<response> {
+    response res{http::status::ok, req.version()};
+    res.set(http::field::content_type, "application/json");
+    res.body() = co_await skye::trace_capture(std::chrono::seconds{10});
+
+    co_return res;
+  };
+*/
+#ifndef SKYE_TRACE_HPP_
+#define SKYE_TRACE_HPP_
+
+#include <skye/clock.hpp>
+
+#include <boost/asio/awaitable.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/this_coro.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <concepts>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace skye {
+
+namespace asio = boost::asio;
+
+#if defined(SKYE_ENABLE_TRACE)
+constexpr bool kEnableTrace = true;
+#else
+constexpr bool kEnableTrace = false;
+#endif
+
+/**
+  Identify the spans of one session. The id is the socket fd, or the listener
+  fd for accept spans, and the request is the request number in the session.
+*/
+struct TraceContext {
+    int id{};
+    int request{};
+};
+
+namespace detail {
+
+// Trivial type so a large buffer is allocated without touching the pages
+struct TraceEvent {
+    std::int64_t ts;
+    const char* name;
+    int id;
+    int request;
+    char phase;
+};
+
+/**
+  Per thread event buffer. Only the owner thread writes, it publishes the size
+  after each event so a reader on another thread sees complete events. The
+  buffer does not wrap, events are dropped once it is full.
+
+  The owner resets the buffer on its first event after trace_start. The reset
+  holds the registry mutex so it does not run while an export reads the events.
+*/
+class TraceBuffer {
+public:
+    explicit TraceBuffer(int tid) : tid_{tid}
+    {
+    }
+
+    void push(
+        const TraceEvent& event, unsigned generation, std::size_t capacity,
+        std::mutex& mutex) noexcept
+    {
+        // First event since trace_start, reset and allocate on this thread
+        if (generation_.load(std::memory_order_relaxed) != generation) {
+            try {
+                const std::lock_guard lock{mutex};
+                if (capacity != capacity_) {
+                    events_ = std::make_unique_for_overwrite<TraceEvent[]>(
+                        capacity);
+                    capacity_ = capacity;
+                }
+                size_.store(0, std::memory_order_relaxed);
+                generation_.store(generation, std::memory_order_release);
+            } catch (...) {
+                return;
+            }
+        }
+
+        const std::size_t size = size_.load(std::memory_order_relaxed);
+        if (size == capacity_) {
+            return;
+        }
+
+        events_[size] = event;
+        size_.store(size + 1, std::memory_order_release);
+    }
+
+    template <typename Function>
+    void for_each(unsigned generation, Function&& fn) const
+    {
+        if (generation_.load(std::memory_order_acquire) != generation) {
+            return;
+        }
+
+        const std::size_t size = size_.load(std::memory_order_acquire);
+        for (std::size_t i = 0; i < size; ++i) {
+            fn(events_[i]);
+        }
+    }
+
+    [[nodiscard]] int tid() const noexcept
+    {
+        return tid_;
+    }
+
+private:
+    std::unique_ptr<TraceEvent[]> events_;
+    std::size_t capacity_{0};
+    std::atomic<std::size_t> size_{0};
+    std::atomic<unsigned> generation_{0};
+    int tid_;
+};
+
+struct TraceState {
+    std::atomic<bool> enabled{false};
+    std::atomic<unsigned> generation{0};
+    std::atomic<std::size_t> capacity{0};
+    std::atomic<std::int64_t> start_time{0};
+
+    std::mutex mutex;
+    std::vector<std::shared_ptr<TraceBuffer>> buffers;
+};
+
+inline TraceState& trace_state()
+{
+    static TraceState state;
+    return state;
+}
+
+inline TraceBuffer& local_trace_buffer()
+{
+    thread_local const std::shared_ptr<TraceBuffer> buffer = []() {
+        auto& state = trace_state();
+        const std::lock_guard lock{state.mutex};
+
+        const int tid = static_cast<int>(state.buffers.size()) + 1;
+        return state.buffers.emplace_back(std::make_shared<TraceBuffer>(tid));
+    }();
+
+    return *buffer;
+}
+
+inline thread_local TraceContext local_trace_context;
+
+inline std::int64_t trace_now() noexcept
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               phase_clock::now().time_since_epoch())
+        .count();
+}
+
+inline void trace_event(char phase, const char* name, TraceContext ctx) noexcept
+{
+    if constexpr (kEnableTrace) {
+        auto& state = trace_state();
+        if (!state.enabled.load(std::memory_order_relaxed)) {
+            return;
+        }
+
+        local_trace_buffer().push(
+            {trace_now(), name, ctx.id, ctx.request, phase},
+            state.generation.load(std::memory_order_acquire),
+            state.capacity.load(std::memory_order_relaxed), state.mutex);
+    }
+}
+
+inline void append_number(std::string& out, std::integral auto value)
+{
+    std::array<char, 32> buf{};
+    const auto [ptr, ec] =
+        std::to_chars(buf.data(), buf.data() + buf.size(), value);
+    out.append(buf.data(), ptr);
+}
+
+/**
+  Nanoseconds as microseconds with three decimals. Integer math only, the
+  floating point to_chars is missing from older libc++, e.g. on macOS 12.
+*/
+inline void append_micros(std::string& out, std::int64_t ns)
+{
+    if (ns < 0) {
+        out += '-';
+        ns = -ns;
+    }
+
+    append_number(out, ns / 1000);
+
+    const auto frac = static_cast<int>(ns % 1000);
+    out += '.';
+    out += static_cast<char>('0' + frac / 100);
+    out += static_cast<char>('0' + frac / 10 % 10);
+    out += static_cast<char>('0' + frac % 10);
+}
+
+} // namespace detail
+
+/// Events per thread for one capture, 32 bytes each.
+constexpr std::size_t kTraceCapacity = 1 << 20;
+
+/**
+  Begin an async span. Names must be string literals or otherwise outlive the
+  capture.
+*/
+inline void trace_begin(const char* name, TraceContext ctx) noexcept
+{
+    detail::trace_event('b', name, ctx);
+}
+
+/// End the async span with the same name and context.
+inline void trace_end(const char* name, TraceContext ctx) noexcept
+{
+    detail::trace_event('e', name, ctx);
+}
+
+/**
+  Span for the lifetime of this object. Works in a coroutine frame, the span
+  stays open while the coroutine is suspended.
+*/
+class TraceSpan {
+public:
+    TraceSpan(const char* name, TraceContext ctx) noexcept
+        : name_{name}, ctx_{ctx}
+    {
+        trace_begin(name_, ctx_);
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    ~TraceSpan()
+    {
+        trace_end(name_, ctx_);
+    }
+
+private:
+    const char* name_;
+    TraceContext ctx_;
+};
+
+/**
+  The context of the request whose handler is being called on this thread. The
+  session sets it right before it calls the handler so a handler wrapper, e.g.
+  make_co_handler, may tag its own spans. Only valid during the synchronous part
+  of the handler call.
+*/
+inline TraceContext current_trace_context() noexcept
+{
+    return detail::local_trace_context;
+}
+
+inline void set_current_trace_context(TraceContext ctx) noexcept
+{
+    if constexpr (kEnableTrace) {
+        detail::local_trace_context = ctx;
+    }
+}
+
+/**
+  Clear previous events and start recording. Each thread allocates a buffer of
+  capacity events on its first event.
+*/
+inline void trace_start(std::size_t capacity = kTraceCapacity)
+{
+    auto& state = detail::trace_state();
+    const std::lock_guard lock{state.mutex};
+
+    state.capacity.store(capacity, std::memory_order_relaxed);
+    state.start_time.store(detail::trace_now(), std::memory_order_relaxed);
+    state.generation.fetch_add(1, std::memory_order_release);
+    state.enabled.store(true, std::memory_order_relaxed);
+}
+
+inline void trace_stop()
+{
+    detail::trace_state().enabled.store(false, std::memory_order_relaxed);
+}
+
+/**
+  Export the events from the last capture as Chrome trace event JSON. Call
+  after trace_stop. Holds the registry mutex for the whole export so a
+  concurrent trace_start waits for it to finish.
+
+  https://docs.google.com/document/d/1CvAClvFfyA5R-PhYUmn5OOQtYMH4h6I0nxsKchNAySU
+*/
+inline std::string trace_to_json()
+{
+    using namespace std::literals;
+
+    auto& state = detail::trace_state();
+    const std::lock_guard lock{state.mutex};
+
+    const unsigned generation =
+        state.generation.load(std::memory_order_acquire);
+    const std::int64_t start_time =
+        state.start_time.load(std::memory_order_relaxed);
+
+    std::string out = "{\"traceEvents\":[";
+    bool first = true;
+
+    const auto next = [&out, &first]() {
+        if (!first) {
+            out += ',';
+        }
+        first = false;
+    };
+
+    for (const auto& buffer : state.buffers) {
+        const int tid = buffer->tid();
+
+        next();
+        out += R"({"name":"thread_name","ph":"M","pid":1,"tid":)";
+        detail::append_number(out, tid);
+        out += R"(,"args":{"name":"skye-)";
+        detail::append_number(out, tid);
+        out += "\"}}";
+
+        buffer->for_each(generation, [&](const detail::TraceEvent& event) {
+            next();
+            out += R"({"name":")"sv;
+            out += event.name;
+            out += R"(","cat":"skye","ph":")"sv;
+            out += event.phase;
+            out += R"(","ts":)"sv;
+            // Microseconds with nanosecond precision
+            detail::append_micros(out, event.ts - start_time);
+            out += R"(,"pid":1,"tid":)"sv;
+            detail::append_number(out, tid);
+            out += R"(,"id":)"sv;
+            detail::append_number(out, event.id);
+            out += R"(,"args":{"request":)"sv;
+            detail::append_number(out, event.request);
+            out += "}}";
+        });
+    }
+
+    out += "]}";
+
+    return out;
+}
+
+/**
+  Record events for a duration and return the JSON. Intended for a debug
+  endpoint, the timer does not block the I/O thread.
+*/
+inline asio::awaitable<std::string>
+trace_capture(std::chrono::steady_clock::duration duration)
+{
+    trace_start();
+
+    asio::steady_timer timer{co_await asio::this_coro::executor, duration};
+
+    boost::system::error_code ec;
+    co_await timer.async_wait(asio::redirect_error(asio::use_awaitable, ec));
+
+    trace_stop();
+
+    co_return trace_to_json();
+}
+
+} // namespace skye
+
+#endif // SKYE_TRACE_HPP_
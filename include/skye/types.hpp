@@ -13,7 +13,12 @@
 #include <boost/beast/http/message.hpp>
 #include <boost/beast/http/string_body.hpp>
 
+#include <algorithm>
+#include <array>
 #include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
 
 namespace skye {
 
@@ -54,6 +59,41 @@ using request = http::request<http::string_body>;
 */
 using response = http::response<http::string_body>;
 
+#if defined(SKYE_ENABLE_PHASE_TIMING)
+constexpr bool kEnablePhaseTiming = true;
+#else
+constexpr bool kEnablePhaseTiming = false;
+#endif
+
+/**
+  Time spent in each phase of one request. Only collected if the library is
+  built with SKYE_ENABLE_PHASE_TIMING, otherwise all durations are zero.
+
+  - wait, from the start of the read to the first byte of the request. This is
+    the client think time on a keep alive connection.
+  - header, from the first byte until the header is parsed.
+  - body, from the header until the body is complete.
+  - handler, the user handler call.
+  - write, from the end of the handler until the response is written.
+*/
+struct PhaseTimes {
+    std::chrono::nanoseconds wait{};
+    std::chrono::nanoseconds header{};
+    std::chrono::nanoseconds body{};
+    std::chrono::nanoseconds handler{};
+    std::chrono::nanoseconds write{};
+
+    PhaseTimes& operator+=(const PhaseTimes& other)
+    {
+        wait += other.wait;
+        header += other.header;
+        body += other.body;
+        handler += other.handler;
+        write += other.write;
+        return *this;
+    }
+};
+
 /**
   A simple mechanism to record byte counts for incoming and outgoing HTTP
   messages and other basic metrics for service observability. The user supplies
@@ -67,7 +107,8 @@ using response = http::response<http::string_body>;
   HTTP session loop.
 
   One SessionMetrics object is intended to represent the aggregate data from one
-  session loop. The reporter function object is called once per session.
+  session loop. The reporter function object is called once per session. The
+  phase times are the sum over all requests in the session.
 */
 struct SessionMetrics {
     int fd{};
@@ -76,6 +117,133 @@ struct SessionMetrics {
     int bytes_write{};
     std::chrono::steady_clock::time_point start_time{};
     std::chrono::steady_clock::time_point end_time{};
+    PhaseTimes phases{};
+};
+
+/**
+  Length of the longest prefix of str that fits in max_size bytes and does not
+  cut a multi byte UTF-8 sequence in two.
+*/
+inline std::size_t truncate_utf8(std::string_view str, std::size_t max_size)
+{
+    if (str.size() <= max_size) {
+        return str.size();
+    }
+
+    // Back up to the start of the character that did not fit
+    std::size_t size = max_size;
+    while ((size > 0) &&
+           ((static_cast<unsigned char>(str[size]) & 0xC0) == 0x80)) {
+        --size;
+    }
+
+    return size;
+}
+
+/**
+  Per request metrics for access logs. The session(...) function calls the
+  reporter once per request if it accepts a RequestMetrics object.
+
+  The object is a fixed size record with no pointers to the request so it may be
+  copied into a ring buffer and formatted later on another thread. Long request
+  targets are truncated on a UTF-8 character boundary.
+
+  The start time is when the request is read and the end time is when the
+  response is written.
+*/
+struct RequestMetrics {
+    static constexpr std::size_t kMaxTarget = 64;
+
+    int fd{};
+    int num_request{};
+    http::verb method{};
+    int status{};
+    int bytes_read{};
+    int bytes_write{};
+    std::chrono::steady_clock::time_point start_time{};
+    std::chrono::steady_clock::time_point end_time{};
+    PhaseTimes phases{};
+    std::size_t target_size{};
+    std::array<char, kMaxTarget> target_data{};
+
+    [[nodiscard]] std::string_view target() const
+    {
+        return {target_data.data(), target_size};
+    }
+
+    void set_target(std::string_view str)
+    {
+        target_size = truncate_utf8(str, kMaxTarget);
+        std::copy_n(str.data(), target_size, target_data.data());
+    }
+};
+
+/**
+  Event loop health for the I/O thread, see LoopMonitor.
+
+  The lag is how late the periodic timer fired, a measure of how long the loop
+  was busy. Ticks with a lag over the threshold are counted in num_lag. Handlers
+  in flight includes handlers suspended on I/O, handlers that ran longer than
+  the threshold are counted in num_slow.
+*/
+struct LoopMetrics {
+    int num_tick{};
+    int num_lag{};
+    std::chrono::nanoseconds lag{};
+    std::chrono::nanoseconds max_lag{};
+    std::chrono::nanoseconds total_lag{};
+    int in_flight{};
+    int max_in_flight{};
+    int num_handler{};
+    int num_slow{};
+    std::chrono::nanoseconds max_handler{};
+};
+
+/**
+  Time split of the busy poll run loop, see run_busy_poll.
+
+  Spin is the time spent polling with no work ready. Sleep is the time blocked
+  in the kernel after the spin budget ran out, including the one handler that
+  woke the loop up. Work is the time in polls that ran handlers.
+*/
+struct BusyPollMetrics {
+    std::chrono::nanoseconds spin{};
+    std::chrono::nanoseconds sleep{};
+    std::chrono::nanoseconds work{};
+    std::uint64_t num_poll{};
+    std::uint64_t num_sleep{};
+    std::uint64_t num_handler{};
+};
+
+/**
+  Graceful stop of the server, see async_drain.
+
+  The drain time is from the start of the drain until the last session ended,
+  or the timeout. The sessions open at the start are counted in num_session.
+  Of those, num_idle were idle keep alive connections closed right away and
+  num_abandoned were still open at the timeout.
+*/
+struct DrainMetrics {
+    std::chrono::nanoseconds drain_time{};
+    int num_session{};
+    int num_idle{};
+    int num_abandoned{};
+};
+
+/**
+  Aggregate of all workers in prefork mode, see PreforkServer.
+
+  Each worker adds its session metrics to shared memory when a session ends, so
+  the counts cover closed connections. The counts of a restarted worker carry
+  over to its replacement.
+*/
+struct PreforkMetrics {
+    int num_worker{};
+    int num_restart{};
+    std::uint64_t num_session{};
+    std::uint64_t num_request{};
+    std::uint64_t bytes_read{};
+    std::uint64_t bytes_write{};
 };
 
 } // namespace skye
@@ -1,8 +1,12 @@
 #pragma once
 
+#include <boost/asio/async_result.hpp>
 #include <boost/asio/buffer.hpp>
 #include <boost/asio/error.hpp>
 
+#include <algorithm>
+#include <cstddef>
+#include <limits>
 #include <memory>
 
 namespace test {
@@ -11,6 +15,14 @@ namespace test {
   Model the AsyncStream type concept for Boost beast and asio. Allow us to test
   the session(...) loop with random input data and verify the roundtrip.
 
+  Copies of a socket share the rx and tx buffers, the fragment sizes, and the
+  call counts. Each copy reads rx from the start so a benchmark may run a new
+  session on the same input.
+
+  Set a read size to model TCP segments, each read returns at most that many
+  bytes and splits the request headers mid-line. Set a write size to model a
+  full socket send buffer, each write accepts at most that many bytes.
+
   https://www.boost.org/doc/libs/release/doc/html/boost_asio/reference/AsyncReadStream.html
   https://www.boost.org/doc/libs/release/doc/html/boost_asio/reference/AsyncWriteStream.html
  */
@@ -32,47 +44,75 @@ public:
     // NOLINTEND(readability-identifier-naming)
 
     explicit MockSock(executor_type ex)
-        : ex_{std::move(ex)}, rx_{std::make_shared<Buffer>()},
-          tx_{std::make_shared<Buffer>()}
+        : ex_{std::move(ex)}, state_{std::make_shared<State>()}
     {
     }
 
     // NOLINTBEGIN(misc-no-recursion)
     auto async_read_some(const auto& buffers, auto&& token)
     {
-        if (rx_offset_ >= rx_->size()) {
-            return token(boost::asio::error::eof, 0);
-        }
-
-        const auto n = boost::asio::buffer_copy(
-            buffers,
-            boost::asio::buffer(&(*rx_)[rx_offset_], rx_->size() - rx_offset_));
-
-        boost::system::error_code ec;
-        if (n == 0) {
-            ec = boost::asio::error::eof;
-        } else {
-            rx_offset_ += n;
-        }
-
-        return token(ec, n);
+        return boost::asio::async_initiate<
+            decltype(token), void(boost::system::error_code, std::size_t)>(
+            [this](auto handler, const auto& buffers) {
+                auto& state = *state_;
+                ++state.num_read;
+
+                if (rx_offset_ >= state.rx.size()) {
+                    return std::move(handler)(boost::asio::error::eof, 0);
+                }
+
+                const auto n = boost::asio::buffer_copy(
+                    buffers,
+                    boost::asio::buffer(
+                        &state.rx[rx_offset_],
+                        std::min(
+                            state.rx.size() - rx_offset_, state.read_size)));
+
+                boost::system::error_code ec;
+                if (n == 0) {
+                    ec = boost::asio::error::eof;
+                } else {
+                    rx_offset_ += n;
+                }
+
+                std::move(handler)(ec, n);
+            },
+            token, buffers);
     }
 
     auto async_write_some(const auto& buffers, auto&& token)
     {
-        Buffer buf(boost::asio::buffer_size(buffers), 0);
-
-        const auto n =
-            boost::asio::buffer_copy(boost::asio::buffer(buf), buffers);
-
-        boost::system::error_code ec;
-        if (n == 0) {
-            ec = boost::asio::error::eof;
-        } else {
-            tx_->insert(tx_->end(), buf.begin(), buf.end());
-        }
-
-        return token(ec, n);
+        return boost::asio::async_initiate<
+            decltype(token), void(boost::system::error_code, std::size_t)>(
+            [this](auto handler, const auto& buffers) {
+                auto& state = *state_;
+                ++state.num_write;
+
+                // Append each buffer in the sequence straight into tx
+                std::size_t n = 0;
+                for (auto it = boost::asio::buffer_sequence_begin(buffers);
+                     it != boost::asio::buffer_sequence_end(buffers); ++it) {
+                    const boost::asio::const_buffer buf{*it};
+                    const auto size =
+                        std::min(buf.size(), state.write_size - n);
+
+                    const auto* data = static_cast<const char*>(buf.data());
+                    state.tx.insert(state.tx.end(), data, data + size);
+
+                    n += size;
+                    if (n == state.write_size) {
+                        break;
+                    }
+                }
+
+                boost::system::error_code ec;
+                if (n == 0) {
+                    ec = boost::asio::error::eof;
+                }
+
+                std::move(handler)(ec, n);
+            },
+            token, buffers);
     }
     // NOLINTEND(misc-no-recursion)
 
@@ -98,18 +138,57 @@ public:
 
     void set_rx(const Buffer& buf)
     {
-        *rx_ = buf;
+        state_->rx = buf;
+    }
+
+    const Buffer& get_tx() const
+    {
+        return state_->tx;
+    }
+
+    // Keep the capacity so a benchmark loop does not allocate
+    void clear_tx()
+    {
+        state_->tx.clear();
     }
 
-    Buffer get_tx()
+    /// Max bytes returned by one read, zero for no limit.
+    void set_read_size(std::size_t n)
     {
-        return *tx_;
+        state_->read_size = (n > 0) ? n : kNoLimit;
+    }
+
+    /// Max bytes accepted by one write, zero for no limit.
+    void set_write_size(std::size_t n)
+    {
+        state_->write_size = (n > 0) ? n : kNoLimit;
+    }
+
+    [[nodiscard]] std::size_t num_read() const
+    {
+        return state_->num_read;
+    }
+
+    [[nodiscard]] std::size_t num_write() const
+    {
+        return state_->num_write;
     }
 
 private:
+    static constexpr std::size_t kNoLimit =
+        std::numeric_limits<std::size_t>::max();
+
+    struct State {
+        Buffer rx;
+        Buffer tx;
+        std::size_t read_size{kNoLimit};
+        std::size_t write_size{kNoLimit};
+        std::size_t num_read{};
+        std::size_t num_write{};
+    };
+
     executor_type ex_;
-    std::shared_ptr<Buffer> rx_;
-    std::shared_ptr<Buffer> tx_;
+    std::shared_ptr<State> state_;
     std::size_t rx_offset_{};
 };
 
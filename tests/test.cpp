@@ -1,12 +1,22 @@
+#include <skye/access_log.hpp>
+#include <skye/buffer_pool.hpp>
+#include <skye/clock.hpp>
 #include <skye/format.hpp>
+#include <skye/query_params.hpp>
 #include <skye/utility.hpp>
 
 #include <catch2/catch_test_macros.hpp>
 #include <fmt/core.h>
 
 #include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
 #include <cstdlib>
+#include <optional>
 #include <string>
+#include <string_view>
+#include <thread>
 
 #if !defined(_WIN32)
 
@@ -61,4 +71,217 @@ TEST_CASE("SessionMetrics", "[skye][format]")
     REQUIRE(!str.empty());
     REQUIRE(str.starts_with("{"));
     REQUIRE(str.ends_with("}"));
-}
\ No newline at end of file
+}
+
+TEST_CASE("RequestMetrics", "[skye][format]")
+{
+    skye::RequestMetrics metrics;
+    metrics.method = skye::http::verb::get;
+    metrics.status = 200;
+    metrics.set_target("/a\"b\\c\n");
+
+    const std::string str = fmt::format("{}", metrics);
+
+    REQUIRE(str.starts_with("{"));
+    REQUIRE(str.ends_with("}"));
+    REQUIRE(str.find("\"method\":\"GET\"") != std::string::npos);
+    REQUIRE(str.find("\"status\":200") != std::string::npos);
+    REQUIRE(
+        str.find("\"target\":\"/a\\\"b\\\\c\\u000a\"") !=
+        std::string::npos);
+
+    // Long targets are truncated to fit the fixed size record
+    metrics.set_target(std::string(1000, 'x'));
+    REQUIRE(metrics.target().size() == skye::RequestMetrics::kMaxTarget);
+
+    // A two byte character that straddles the limit is left out whole
+    std::string utf8(skye::RequestMetrics::kMaxTarget - 1, 'x');
+    utf8 += "\xc3\xa9";
+    metrics.set_target(utf8);
+    REQUIRE(
+        metrics.target() ==
+        std::string_view{utf8}.substr(0, skye::RequestMetrics::kMaxTarget - 1));
+}
+
+TEST_CASE("AccessLog", "[skye][access_log]")
+{
+    constexpr int kNumRecord = 100;
+
+    std::FILE* file = std::tmpfile();
+    REQUIRE(file != nullptr);
+
+    std::uint64_t dropped = 0;
+    {
+        skye::AccessLog log{file, 16};
+
+        auto reporter = log.reporter();
+
+        skye::RequestMetrics metrics;
+        metrics.set_target("/");
+        for (int i = 0; i < kNumRecord; ++i) {
+            metrics.num_request = i + 1;
+            reporter(metrics);
+        }
+
+        // Ring is smaller than the burst so some records are dropped
+        REQUIRE(log.dropped() > 0);
+        REQUIRE(log.dropped() < kNumRecord);
+
+        dropped = log.dropped();
+    }
+
+    std::rewind(file);
+
+    int num_line = 0;
+    for (int ch = std::fgetc(file); ch != EOF; ch = std::fgetc(file)) {
+        if (ch == '\n') {
+            ++num_line;
+        }
+    }
+
+    std::fclose(file);
+
+    // Destructor writes every record that made it into the ring
+    REQUIRE(num_line + dropped == kNumRecord);
+}
+
+TEST_CASE("PhaseTimes", "[skye][format]")
+{
+    using namespace std::chrono_literals;
+
+    skye::PhaseTimes total;
+    total += skye::PhaseTimes{1ms, 2ms, 3ms, 4ms, 5ms};
+    total += skye::PhaseTimes{1ms, 2ms, 3ms, 4ms, 5ms};
+
+    REQUIRE(total.wait == 2ms);
+    REQUIRE(total.write == 10ms);
+
+    const std::string str = fmt::format("{}", total);
+
+    REQUIRE(str.starts_with("{\"wait\":0.002,"));
+    REQUIRE(str.ends_with("\"write\":0.01}"));
+}
+
+template <typename Clock>
+void check_clock()
+{
+    static_assert(Clock::is_steady);
+
+    const auto start = Clock::now();
+    std::this_thread::sleep_for(std::chrono::milliseconds{20});
+    const auto end = Clock::now();
+
+    REQUIRE(end > start);
+    REQUIRE(end - start >= std::chrono::milliseconds{10});
+    REQUIRE(end - start < std::chrono::seconds{10});
+}
+
+TEST_CASE("clock", "[skye][clock]")
+{
+    check_clock<skye::coarse_clock>();
+    check_clock<skye::phase_clock>();
+#if defined(SKYE_HAS_TSC_CLOCK)
+    check_clock<skye::tsc_clock>();
+#endif
+}
+
+TEST_CASE("BufferPool", "[skye][buffer_pool]")
+{
+    auto& pool = skye::detail::BufferPool::local();
+    const std::size_t cached = pool.cached_bytes();
+
+    // Blocks in the same size class are reused
+    void* a = pool.allocate(3000);
+    pool.deallocate(a, 3000);
+    REQUIRE(pool.cached_bytes() == cached + 4096);
+
+    void* b = pool.allocate(4096);
+    REQUIRE(b == a);
+    REQUIRE(pool.cached_bytes() == cached);
+    pool.deallocate(b, 4096);
+
+    // Larger than the largest size class goes straight to operator new
+    void* c = pool.allocate(std::size_t{4} << 20);
+    pool.deallocate(c, std::size_t{4} << 20);
+    REQUIRE(pool.cached_bytes() == cached + 4096);
+
+    // Flat buffer returns its storage on shrink_to_fit
+    {
+        const std::string data(10000, 'a');
+
+        skye::pooled_flat_buffer buffer{1000 * 1000};
+        buffer.commit(boost::asio::buffer_copy(
+            buffer.prepare(data.size()), boost::asio::buffer(data)));
+        REQUIRE(buffer.size() == data.size());
+
+        const std::size_t before = pool.cached_bytes();
+        buffer.consume(buffer.size());
+        buffer.shrink_to_fit();
+        REQUIRE(buffer.capacity() == 0);
+        REQUIRE(pool.cached_bytes() > before);
+    }
+}
+
+TEST_CASE("query_params", "[skye][query_params]")
+{
+    using namespace std::literals;
+
+    constexpr skye::query_params kParams{
+        "/users/42/posts?limit=10&&sort=date&name=J%C3%BCrgen+K&verbose&n=-7"};
+
+    static_assert(kParams.path() == "/users/42/posts");
+    static_assert(kParams.segment(0) == "users"sv);
+    static_assert(kParams.segment(1) == "42"sv);
+    static_assert(kParams.segment(2) == "posts"sv);
+    static_assert(!kParams.segment(3));
+
+    REQUIRE(kParams.get<int>("limit") == 10);
+    REQUIRE(kParams.get<int>("n") == -7);
+    REQUIRE(!kParams.get<unsigned>("n"));
+    REQUIRE(!kParams.get<int>("sort"));
+    REQUIRE(!kParams.get<int>("missing"));
+    REQUIRE(kParams.get<std::string_view>("sort") == "date"sv);
+
+    REQUIRE(kParams.contains("verbose"));
+    REQUIRE(kParams.find("verbose") == ""sv);
+    REQUIRE(!kParams.contains("limit=10"));
+
+    int count = 0;
+    for (const auto& param : kParams) {
+        REQUIRE(!param.key.empty());
+        ++count;
+    }
+    REQUIRE(count == 5);
+
+    std::array<char, 16> buf{};
+    REQUIRE(kParams.get("name", buf) == "J\xC3\xBCrgen K"sv);
+
+    // Too small to hold the decoded value
+    std::array<char, 4> small{};
+    REQUIRE(!kParams.get("name", small));
+
+    REQUIRE(skye::query_params{"/"}.begin() == skye::query_params{"/"}.end());
+    REQUIRE(!skye::query_params{"/"}.segment(0));
+
+    const skye::request req{skye::http::verb::get, "/db?queries=500", 11};
+    REQUIRE(skye::query_params{req}.get<int>("queries") == 500);
+}
+
+TEST_CASE("percent_decode", "[skye][query_params]")
+{
+    using namespace std::literals;
+
+    std::array<char, 32> buf{};
+
+    REQUIRE(skye::percent_decode("a%2Fb%2fc", buf) == "a/b/c"sv);
+    REQUIRE(skye::percent_decode("", buf) == ""sv);
+    REQUIRE(!skye::percent_decode("%", buf));
+    REQUIRE(!skye::percent_decode("%2", buf));
+    REQUIRE(!skye::percent_decode("%zz", buf));
+
+    // Decode in place
+    std::string str = "hello+%77orld";
+    const auto decoded = skye::percent_decode(str, str);
+    REQUIRE(decoded == "hello world"sv);
+    REQUIRE(decoded->data() == str.data());
+}
@@ -0,0 +1,239 @@
+#include <skye/dispatch.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <functional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+TEST_CASE("DispatchPool", "[skye][dispatch]")
+{
+    using namespace std::chrono_literals;
+
+    SECTION("sessions")
+    {
+        skye::DispatchPool pool{3};
+
+        REQUIRE(pool.size() == 3);
+
+        // Round robin while the sessions are open
+        for (int i = 0; i < 6; ++i) {
+            pool.acquire();
+        }
+
+        for (std::size_t i = 0; i < pool.size(); ++i) {
+            REQUIRE(pool.sessions(i) == 2);
+        }
+    }
+
+    SECTION("handler_time")
+    {
+        skye::DispatchPool pool{2, skye::DispatchLoad::handler_time};
+
+        // First worker is busy, the next session goes to the second
+        auto& busy = pool.acquire();
+        busy.handler_ns += std::chrono::nanoseconds{100ms}.count();
+
+        auto& idle = pool.acquire();
+        REQUIRE(&idle != &busy);
+
+        // A burst of new sessions is charged an estimate before any of their
+        // handler time shows up, so it does not all go to the idle worker
+        for (int i = 0; i < 6; ++i) {
+            pool.acquire();
+        }
+
+        REQUIRE(pool.sessions(0) > 2);
+        REQUIRE(pool.sessions(1) > 2);
+        REQUIRE(pool.sessions(0) + pool.sessions(1) == 8);
+    }
+}
+
+TEST_CASE("async_dispatch", "[skye][dispatch]")
+{
+    using namespace std::chrono_literals;
+    using tcp = asio::ip::tcp;
+
+    constexpr auto kPort = 8083;
+    constexpr int kNumConnection = 4;
+
+    auto load = skye::DispatchLoad::sessions;
+
+    SECTION("sessions")
+    {
+        load = skye::DispatchLoad::sessions;
+    }
+
+    SECTION("handler_time")
+    {
+        load = skye::DispatchLoad::handler_time;
+    }
+
+    skye::DispatchPool pool{2, load};
+
+    // Respond with the worker thread id
+    auto handler = [](skye::request req) -> asio::awaitable<skye::response> {
+        skye::response res{http::status::ok, req.version()};
+        res.body() = std::to_string(
+            std::hash<std::thread::id>{}(std::this_thread::get_id()));
+        co_return res;
+    };
+
+    asio::io_context ctx{1};
+
+    skye::async_dispatch(ctx, pool, kPort, {}, handler);
+
+    // Run the listen coroutine up to its first accept
+    ctx.poll();
+
+    const auto acceptor_thread = std::to_string(
+        std::hash<std::thread::id>{}(std::this_thread::get_id()));
+
+    // Keep alive connections stay open until the end of the test
+    std::vector<tcp::socket> sockets;
+    sockets.reserve(kNumConnection);
+    std::vector<std::string> threads;
+    auto client = [&]() -> asio::awaitable<void> {
+        for (int i = 0; i < kNumConnection; ++i) {
+            auto& socket = sockets.emplace_back(ctx);
+            co_await socket.async_connect(
+                {asio::ip::address_v4::loopback(), kPort},
+                asio::use_awaitable);
+
+            skye::request req{http::verb::get, "/", 11};
+            co_await http::async_write(socket, req, asio::use_awaitable);
+
+            boost::beast::flat_buffer buffer;
+            skye::response res;
+            co_await http::async_read(
+                socket, buffer, res, asio::use_awaitable);
+
+            threads.push_back(res.body());
+        }
+
+        ctx.stop();
+    };
+
+    co_spawn(ctx, client(), [](auto ptr) {
+        if (ptr) {
+            std::rethrow_exception(ptr);
+        }
+    });
+
+    ctx.run_for(2s);
+
+    REQUIRE(threads.size() == kNumConnection);
+
+    // Sessions run on the pool threads, balanced over both
+    for (const auto& id : threads) {
+        REQUIRE(id != acceptor_thread);
+    }
+
+    // The second connection avoids the worker that served the first
+    REQUIRE(threads[0] != threads[1]);
+
+    if (load == skye::DispatchLoad::sessions) {
+        REQUIRE(pool.sessions(0) == 2);
+        REQUIRE(pool.sessions(1) == 2);
+    } else {
+        // Handler time is counted on both workers
+        REQUIRE(pool.handler_time(0) > 0ns);
+        REQUIRE(pool.handler_time(1) > 0ns);
+    }
+}
+
+TEST_CASE("async_drain_dispatch", "[skye][dispatch][drain]")
+{
+    using namespace std::chrono_literals;
+    using tcp = asio::ip::tcp;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+
+    constexpr auto kPort = 8090;
+    constexpr int kNumConnection = 2;
+
+    skye::DispatchPool pool{2};
+
+    auto handler = [](skye::request req) -> asio::awaitable<skye::response> {
+        co_return skye::response{http::status::ok, req.version()};
+    };
+
+    asio::io_context ctx{1};
+
+    skye::async_dispatch(ctx, pool, kPort, {}, handler);
+
+    const tcp::endpoint endpoint{asio::ip::address_v4::loopback(), kPort};
+
+    bool drained = false;
+    skye::DrainMetrics metrics;
+    int num_closed = 0;
+    bool refused = false;
+
+    auto client = [&]() -> asio::awaitable<void> {
+        auto ex = co_await asio::this_coro::executor;
+
+        // Keep alive connections, idle on the pool after one request
+        std::vector<default_token::as_default_on_t<tcp::socket>> sockets;
+        for (int i = 0; i < kNumConnection; ++i) {
+            auto& socket = sockets.emplace_back(ex);
+            co_await socket.async_connect(endpoint);
+            co_await http::async_write(
+                socket, skye::request{http::verb::get, "/", 11});
+
+            boost::beast::flat_buffer buffer;
+            skye::response res;
+            co_await http::async_read(socket, buffer, res);
+        }
+
+        // The handler runs on a pool thread
+        skye::async_drain(ctx, pool, 500ms, [&](const auto& m) {
+            asio::post(ctx, [&, m]() {
+                metrics = m;
+                drained = true;
+            });
+        });
+
+        for (auto& socket : sockets) {
+            boost::beast::flat_buffer buffer;
+            skye::response res;
+            auto [ec, n] = co_await http::async_read(socket, buffer, res);
+            if (ec == http::error::end_of_stream) {
+                ++num_closed;
+            }
+        }
+
+        default_token::as_default_on_t<tcp::socket> late{ex};
+        auto [ec] = co_await late.async_connect(endpoint);
+        refused = (ec == asio::error::connection_refused);
+
+        asio::steady_timer timer{ex};
+        while (!drained) {
+            timer.expires_after(1ms);
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+
+        ctx.stop();
+    };
+
+    co_spawn(ctx, client(), [](auto ptr) {
+        if (ptr) {
+            std::rethrow_exception(ptr);
+        }
+    });
+
+    ctx.run_for(2s);
+
+    REQUIRE(drained);
+    REQUIRE(metrics.num_session == kNumConnection);
+    REQUIRE(metrics.num_idle == kNumConnection);
+    REQUIRE(metrics.num_abandoned == 0);
+    REQUIRE(num_closed == kNumConnection);
+    REQUIRE(refused);
+}
@@ -0,0 +1,206 @@
+#include <skye/drain.hpp>
+#include <skye/format.hpp>
+#include <skye/service.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/format.h>
+
+#include <chrono>
+#include <string>
+#include <string_view>
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+TEST_CASE("DrainMetrics", "[skye][format]")
+{
+    skye::DrainMetrics metrics;
+    metrics.num_session = 2;
+
+    REQUIRE(
+        fmt::format("{}", metrics) ==
+        "{\"drain_time\":0,\"num_session\":2,\"num_idle\":0,"
+        "\"num_abandoned\":0}");
+}
+
+TEST_CASE("async_drain", "[skye][drain]")
+{
+    using namespace std::chrono_literals;
+    using tcp = asio::ip::tcp;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+
+    constexpr auto kPort = 8087;
+    constexpr auto kDrainTimeout = 500ms;
+
+    auto handler_time = 50ms;
+    bool abandon = false;
+
+    SECTION("in_flight")
+    {
+        handler_time = 50ms;
+    }
+
+    SECTION("timeout")
+    {
+        handler_time = 5s;
+        abandon = true;
+    }
+
+    asio::io_context ctx{1};
+
+    // The slow handler is in flight when the drain starts
+    bool started = false;
+    auto handler = [&started, handler_time](
+                       skye::request req) -> asio::awaitable<skye::response> {
+        if (req.target() == "/slow") {
+            started = true;
+
+            asio::steady_timer timer{
+                co_await asio::this_coro::executor, handler_time};
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+
+        co_return skye::response{http::status::ok, req.version()};
+    };
+
+    skye::async_run(ctx, kPort, handler);
+
+    const tcp::endpoint endpoint{asio::ip::address_v4::loopback(), kPort};
+
+    bool drained = false;
+    skye::DrainMetrics metrics;
+    bool slow_keep_alive = true;
+    bool partial_keep_alive = true;
+    bool fresh_keep_alive = true;
+    bool idle_closed = false;
+    bool refused = false;
+
+    auto client = [&]() -> asio::awaitable<void> {
+        auto ex = co_await asio::this_coro::executor;
+
+        // Keep alive connection, idle after one request
+        default_token::as_default_on_t<tcp::socket> idle{ex};
+        co_await idle.async_connect(endpoint);
+
+        boost::beast::flat_buffer buffer;
+        {
+            co_await http::async_write(
+                idle, skye::request{http::verb::get, "/", 11});
+
+            skye::response res;
+            co_await http::async_read(idle, buffer, res);
+        }
+
+        // New connection, its first request has not been sent yet
+        default_token::as_default_on_t<tcp::socket> fresh{ex};
+        co_await fresh.async_connect(endpoint);
+
+        // Part of a request has arrived, not idle
+        default_token::as_default_on_t<tcp::socket> partial{ex};
+        co_await partial.async_connect(endpoint);
+        co_await asio::async_write(
+            partial,
+            asio::buffer(std::string_view{"GET / HTTP/1.1\r\nHost: skye\r\n"}));
+
+        default_token::as_default_on_t<tcp::socket> slow{ex};
+        co_await slow.async_connect(endpoint);
+        co_await http::async_write(
+            slow, skye::request{http::verb::get, "/slow", 11});
+
+        asio::steady_timer timer{ex};
+        while (!started) {
+            timer.expires_after(1ms);
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+
+        // Let the session read the first part
+        timer.expires_after(10ms);
+        co_await timer.async_wait(asio::use_awaitable);
+
+        skye::async_drain(ctx, kDrainTimeout, [&](const auto& m) {
+            metrics = m;
+            drained = true;
+
+            if (abandon) {
+                ctx.stop();
+            }
+        });
+
+        // Idle connection is closed right away
+        {
+            skye::response res;
+            auto [ec, n] = co_await http::async_read(idle, buffer, res);
+            idle_closed = (ec == http::error::end_of_stream);
+        }
+
+        // Rest of the partial request, answered with Connection: close
+        {
+            co_await asio::async_write(
+                partial, asio::buffer(std::string_view{"\r\n"}));
+
+            boost::beast::flat_buffer partial_buffer;
+            skye::response res;
+            auto [ec, n] =
+                co_await http::async_read(partial, partial_buffer, res);
+            REQUIRE(!ec);
+            partial_keep_alive = res.keep_alive();
+        }
+
+        // First request of the new connection, answered with Connection: close
+        {
+            co_await http::async_write(
+                fresh, skye::request{http::verb::get, "/", 11});
+
+            boost::beast::flat_buffer fresh_buffer;
+            skye::response res;
+            auto [ec, n] = co_await http::async_read(fresh, fresh_buffer, res);
+            REQUIRE(!ec);
+            fresh_keep_alive = res.keep_alive();
+        }
+
+        // In flight request gets its response, then the connection closes
+        {
+            boost::beast::flat_buffer slow_buffer;
+            skye::response res;
+            auto [ec, n] = co_await http::async_read(slow, slow_buffer, res);
+            REQUIRE(!ec);
+            slow_keep_alive = res.keep_alive();
+        }
+
+        // No longer accepting
+        default_token::as_default_on_t<tcp::socket> late{ex};
+        auto [ec] = co_await late.async_connect(endpoint);
+        refused = (ec == asio::error::connection_refused);
+    };
+
+    co_spawn(ctx, client(), [](auto ptr) {
+        if (ptr) {
+            std::rethrow_exception(ptr);
+        }
+    });
+
+    ctx.run_for(5s);
+
+    REQUIRE(drained);
+    REQUIRE(metrics.num_session == 4);
+    REQUIRE(metrics.num_idle == 1);
+    REQUIRE(idle_closed);
+    REQUIRE(!partial_keep_alive);
+    REQUIRE(!fresh_keep_alive);
+
+    if (abandon) {
+        REQUIRE(metrics.num_abandoned == 1);
+        REQUIRE(metrics.drain_time >= kDrainTimeout);
+    } else {
+        REQUIRE(metrics.num_abandoned == 0);
+        REQUIRE(metrics.drain_time < kDrainTimeout);
+        REQUIRE(!slow_keep_alive);
+        REQUIRE(refused);
+
+        // Nothing left to run once the sessions are done
+        REQUIRE(ctx.stopped());
+    }
+}
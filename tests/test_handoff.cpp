@@ -0,0 +1,268 @@
+#include <skye/handoff.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <signal.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <string>
+#include <thread>
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+namespace {
+
+using tcp = asio::ip::tcp;
+
+constexpr auto kPort = 8086;
+
+// Bind the port like the first instance of a server would, return the fd
+int bind_listener(asio::io_context& ioc)
+{
+    tcp::acceptor acceptor{ioc};
+    skye::detail::open_listener(
+        acceptor, tcp::endpoint{asio::ip::address_v4::loopback(), kPort}, {});
+
+    return acceptor.release();
+}
+
+// Respond with a fixed body to tell the server instances apart
+auto make_handler(std::string name)
+{
+    return [name](skye::request req) -> asio::awaitable<skye::response> {
+        skye::response res{http::status::ok, req.version()};
+        res.body() = name;
+        co_return res;
+    };
+}
+
+std::string get(asio::ip::port_type port = kPort)
+{
+    asio::io_context ioc;
+    tcp::socket socket{ioc};
+    socket.connect({asio::ip::address_v4::loopback(), port});
+
+    skye::request req{http::verb::get, "/", 11};
+    req.keep_alive(false);
+    http::write(socket, req);
+
+    boost::beast::flat_buffer buffer;
+    skye::response res;
+    http::read(socket, buffer, res);
+
+    return res.body();
+}
+
+} // namespace
+
+TEST_CASE("listen_fd", "[skye][handoff]")
+{
+    using namespace std::chrono_literals;
+
+    asio::io_context ioc{1};
+
+    const int fd = bind_listener(ioc);
+
+    skye::async_run(ioc, skye::listen_fd<tcp>{fd}, make_handler("old"));
+
+    std::thread server{[&ioc]() { ioc.run_for(5s); }};
+
+    REQUIRE(get() == "old");
+
+    // Stop accepting, the loop runs out of work and returns
+    asio::post(ioc, [&ioc]() { skye::stop_listening(ioc); });
+    server.join();
+
+    REQUIRE(ioc.stopped());
+
+    // The caller still owns the listening socket
+    REQUIRE(::close(fd) == 0);
+}
+
+TEST_CASE("systemd_listen_fds", "[skye][handoff]")
+{
+    // Passed to some other process
+    ::setenv("LISTEN_PID", std::to_string(::getpid() + 1).c_str(), 1);
+    ::setenv("LISTEN_FDS", "1", 1);
+    REQUIRE(skye::systemd_listen_fds().empty());
+    REQUIRE(std::getenv("LISTEN_FDS") != nullptr);
+
+    // Passed to this process, no sockets
+    ::setenv("LISTEN_PID", std::to_string(::getpid()).c_str(), 1);
+    ::setenv("LISTEN_FDS", "0", 1);
+    REQUIRE(skye::systemd_listen_fds().empty());
+    REQUIRE(std::getenv("LISTEN_PID") == nullptr);
+    REQUIRE(std::getenv("LISTEN_FDS") == nullptr);
+
+    ::unsetenv("LISTEN_PID");
+    ::unsetenv("LISTEN_FDS");
+    REQUIRE(skye::systemd_listen_fds().empty());
+}
+
+TEST_CASE("handoff", "[skye][handoff]")
+{
+    using namespace std::chrono_literals;
+
+    const auto path =
+        (std::filesystem::temp_directory_path() / "skye-test.handoff")
+            .string();
+
+    // Nobody to take over from
+    std::filesystem::remove(path);
+    REQUIRE(skye::receive_listener(path, tcp::v4()) == -1);
+
+    // Old instance serves and offers its listener
+    asio::io_context old_ioc{1};
+
+    const int old_fd = bind_listener(old_ioc);
+
+    skye::async_run(old_ioc, skye::listen_fd<tcp>{old_fd}, make_handler("old"));
+
+    bool handed_off = false;
+    skye::async_offer_listener(old_ioc, path, old_fd, [&]() {
+        handed_off = true;
+        skye::stop_listening(old_ioc);
+    });
+
+    std::thread old_server{[&old_ioc]() { old_ioc.run_for(5s); }};
+
+    REQUIRE(get() == "old");
+
+    // New instance takes over, the old one runs out of work
+    const int new_fd = skye::receive_listener(path, tcp::v4());
+    REQUIRE(new_fd >= 0);
+
+    old_server.join();
+    REQUIRE(handed_off);
+    REQUIRE(old_ioc.stopped());
+    ::close(old_fd);
+
+    asio::io_context new_ioc{1};
+    skye::async_run(new_ioc, skye::listen_fd<tcp>{new_fd}, make_handler("new"));
+
+    std::thread new_server{[&new_ioc]() { new_ioc.run_for(5s); }};
+
+    REQUIRE(get() == "new");
+
+    asio::post(new_ioc, [&new_ioc]() { skye::stop_listening(new_ioc); });
+    new_server.join();
+
+    ::close(new_fd);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("handoff_protocol", "[skye][handoff]")
+{
+    using namespace std::chrono_literals;
+
+    const auto path =
+        (std::filesystem::temp_directory_path() / "skye-test-protocol.handoff")
+            .string();
+    std::filesystem::remove(path);
+
+    asio::io_context ioc{1};
+
+    const int fd = bind_listener(ioc);
+
+    bool handed_off = false;
+    skye::async_offer_listener(
+        ioc, path, fd, [&handed_off]() { handed_off = true; });
+
+    // Open the control socket before the client connects
+    ioc.poll();
+
+    std::thread server{[&ioc]() { ioc.run_for(5s); }};
+
+    // Not the protocol the new instance listens on, the old one keeps it
+    REQUIRE_THROWS(skye::receive_listener(path, tcp::v6()));
+
+    const int new_fd = skye::receive_listener(path, tcp::v4());
+    REQUIRE(new_fd >= 0);
+
+    server.join();
+    REQUIRE(handed_off);
+
+    ::close(new_fd);
+    ::close(fd);
+    std::filesystem::remove(path);
+}
+
+TEST_CASE("run_handoff", "[skye][handoff]")
+{
+    using namespace std::chrono_literals;
+
+    constexpr asio::ip::port_type kRunPort = 8091;
+
+    const auto path =
+        (std::filesystem::temp_directory_path() / "skye-test-run.handoff")
+            .string();
+    std::filesystem::remove(path);
+
+    // Each instance in its own process, the stop signals are per process
+    const auto spawn = [&path](std::string name) {
+        const pid_t pid = ::fork();
+        if (pid == 0) {
+            int status = 0;
+            try {
+                skye::run_handoff(
+                    tcp::endpoint{asio::ip::address_v4::loopback(), kRunPort},
+                    path, {}, make_handler(std::move(name)));
+            } catch (...) {
+                status = 1;
+            }
+
+            ::_exit(status);
+        }
+
+        return pid;
+    };
+
+    // Retry until the instance is up
+    const auto get_body = [&]() {
+        for (int i = 0; i < 100; ++i) {
+            try {
+                return get(kRunPort);
+            } catch (const std::exception&) {
+                std::this_thread::sleep_for(10ms);
+            }
+        }
+
+        return std::string{};
+    };
+
+    const pid_t old_pid = spawn("old");
+    REQUIRE(old_pid > 0);
+    REQUIRE(get_body() == "old");
+
+    // New instance takes over, the old one drains and exits
+    const pid_t new_pid = spawn("new");
+    REQUIRE(new_pid > 0);
+
+    int status = 0;
+    REQUIRE(::waitpid(old_pid, &status, 0) == old_pid);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+
+    REQUIRE(get_body() == "new");
+
+    // Offers its listener in turn instead of failing to bind the control path
+    REQUIRE(::waitpid(new_pid, &status, WNOHANG) == 0);
+    REQUIRE(std::filesystem::exists(path));
+
+    ::kill(new_pid, SIGTERM);
+    REQUIRE(::waitpid(new_pid, &status, 0) == new_pid);
+    REQUIRE(WIFEXITED(status));
+    REQUIRE(WEXITSTATUS(status) == 0);
+
+    std::filesystem::remove(path);
+}
@@ -0,0 +1,132 @@
+#include <skye/busy_poll.hpp>
+#include <skye/format.hpp>
+#include <skye/monitor.hpp>
+
+#include <boost/asio.hpp>
+#include <catch2/catch_test_macros.hpp>
+#include <fmt/core.h>
+
+#include <chrono>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+TEST_CASE("loop_monitor", "[skye][monitor]")
+{
+    using namespace std::chrono_literals;
+
+    constexpr auto kHttpVersion = 11;
+
+    std::vector<std::string> blocked;
+    skye::LoopMonitor monitor{
+        [&blocked](std::string_view target, std::chrono::nanoseconds elapsed) {
+            REQUIRE(elapsed >= 50ms);
+            blocked.emplace_back(target);
+        },
+        5ms, 50ms};
+
+    // Blocks the I/O thread, then suspends so the timer may catch up
+    auto block = [](skye::request req) -> asio::awaitable<skye::response> {
+        std::this_thread::sleep_for(100ms);
+
+        asio::steady_timer timer{co_await asio::this_coro::executor, 20ms};
+        co_await timer.async_wait(asio::use_awaitable);
+
+        co_return skye::response{http::status::ok, req.version()};
+    };
+
+    // Suspends for a long time but never blocks
+    auto wait = [](skye::request req) -> asio::awaitable<skye::response> {
+        asio::steady_timer timer{co_await asio::this_coro::executor, 100ms};
+        co_await timer.async_wait(asio::use_awaitable);
+
+        co_return skye::response{http::status::ok, req.version()};
+    };
+
+    asio::io_context ioc;
+
+    monitor.start(ioc);
+
+    auto client = [&]() -> asio::awaitable<void> {
+        const auto block_handler = monitor.wrap(block);
+        const auto wait_handler = monitor.wrap(wait);
+
+        co_await wait_handler(
+            skye::request{http::verb::get, "/wait", kHttpVersion});
+        co_await block_handler(
+            skye::request{http::verb::get, "/block", kHttpVersion});
+
+        monitor.stop();
+    };
+
+    co_spawn(ioc, client(), [](auto ptr) { REQUIRE(!ptr); });
+
+    REQUIRE(ioc.run() > 0);
+
+    const auto metrics = monitor.metrics();
+
+    REQUIRE(metrics.num_tick > 0);
+    REQUIRE(metrics.num_lag >= 1);
+    REQUIRE(metrics.max_lag >= 50ms);
+    REQUIRE(metrics.num_handler == 2);
+    REQUIRE(metrics.num_slow == 2);
+    REQUIRE(metrics.in_flight == 0);
+    REQUIRE(metrics.max_in_flight == 1);
+
+    REQUIRE(blocked == std::vector<std::string>{"/block"});
+
+    const std::string str = fmt::format("{}", metrics);
+    REQUIRE(str.starts_with("{\"num_tick\":"));
+    REQUIRE(str.ends_with("}"));
+}
+
+TEST_CASE("run_busy_poll", "[skye][busy_poll]")
+{
+    using namespace std::chrono_literals;
+
+    constexpr int kNumTick = 5;
+
+    // Timer that fires every 5ms, the loop is idle in between
+    auto ticker = [](int& num_tick) -> asio::awaitable<void> {
+        asio::steady_timer timer{co_await asio::this_coro::executor};
+        for (; num_tick < kNumTick; ++num_tick) {
+            timer.expires_after(5ms);
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+    };
+
+    asio::io_context ctx{1};
+    skye::BusyPollMetrics metrics;
+    int num_tick = 0;
+
+    co_spawn(ctx, ticker(num_tick), asio::detached);
+
+    SECTION("spin")
+    {
+        // Budget covers the gap between ticks, never sleeps
+        REQUIRE(skye::run_busy_poll(ctx, 1s, metrics) > 0);
+
+        REQUIRE(metrics.num_sleep == 0);
+        REQUIRE(metrics.spin >= 20ms);
+        REQUIRE(metrics.sleep == 0ns);
+    }
+
+    SECTION("sleep")
+    {
+        REQUIRE(skye::run_busy_poll(ctx, 100us, metrics) > 0);
+
+        REQUIRE(metrics.num_sleep >= kNumTick);
+        REQUIRE(metrics.sleep >= 15ms);
+    }
+
+    REQUIRE(num_tick == kNumTick);
+    REQUIRE(metrics.num_handler > 0);
+    REQUIRE(ctx.stopped());
+
+    const auto str = fmt::format("{}", metrics);
+    REQUIRE(str.starts_with("{\"spin\":"));
+}
@@ -0,0 +1,171 @@
+#include <skye/prefork.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <signal.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <set>
+#include <string>
+#include <thread>
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+namespace {
+
+// Send one request on a new connection, return the response body
+std::string get(int port)
+{
+    using tcp = asio::ip::tcp;
+
+    asio::io_context ioc;
+    tcp::socket socket{ioc};
+    socket.connect(
+        {asio::ip::address_v4::loopback(),
+         static_cast<asio::ip::port_type>(port)});
+
+    skye::request req{http::verb::get, "/", 11};
+    req.keep_alive(false);
+    http::write(socket, req);
+
+    boost::beast::flat_buffer buffer;
+    skye::response res;
+    http::read(socket, buffer, res);
+
+    return res.body();
+}
+
+} // namespace
+
+TEST_CASE("PreforkServer", "[skye][prefork]")
+{
+    using namespace std::chrono_literals;
+
+    constexpr auto kPort = 8085;
+    constexpr int kNumRequest = 8;
+
+    // Respond with the worker process id
+    auto handler = [](skye::request req) -> asio::awaitable<skye::response> {
+        skye::response res{http::status::ok, req.version()};
+        res.body() = std::to_string(::getpid());
+        co_return res;
+    };
+
+    skye::prefork_options options;
+    options.num_worker = 2;
+    options.restart_delay = 10ms;
+    options.stop_timeout = 2s;
+
+    skye::PreforkServer server{
+        asio::ip::tcp::endpoint{asio::ip::address_v4::loopback(), kPort},
+        {},
+        options,
+        handler};
+
+    std::thread supervisor{[&server]() { server.run(); }};
+
+    std::set<std::string> pids;
+    for (int i = 0; i < kNumRequest; ++i) {
+        pids.insert(get(kPort));
+    }
+
+    // Every request is handled in a worker process
+    REQUIRE(!pids.empty());
+    REQUIRE(pids.count(std::to_string(::getpid())) == 0);
+
+    // Sessions end with the connection, the counts are final once the client
+    // has read the response. Allow the worker a moment to add them.
+    auto wait_for = [&server](auto pred) {
+        for (int i = 0; (i < 200) && !pred(server.metrics()); ++i) {
+            std::this_thread::sleep_for(10ms);
+        }
+        return pred(server.metrics());
+    };
+
+    REQUIRE(wait_for([](const skye::PreforkMetrics& m) {
+        return m.num_request == kNumRequest;
+    }));
+
+    auto metrics = server.metrics();
+    REQUIRE(metrics.num_worker == 2);
+    REQUIRE(metrics.num_session == kNumRequest);
+    REQUIRE(metrics.bytes_read > 0);
+    REQUIRE(metrics.bytes_write > 0);
+
+    // Crash a worker, the supervisor starts a new one
+    ::kill(std::stoi(*pids.begin()), SIGKILL);
+
+    REQUIRE(wait_for([](const skye::PreforkMetrics& m) {
+        return (m.num_restart == 1) && (m.num_worker == 2);
+    }));
+
+    REQUIRE(!get(kPort).empty());
+
+    server.stop();
+    supervisor.join();
+
+    metrics = server.metrics();
+    REQUIRE(metrics.num_worker == 0);
+    REQUIRE(metrics.num_request == kNumRequest + 1);
+}
+
+#if defined(__linux__)
+
+TEST_CASE("PreforkServer_reuse_port", "[skye][prefork]")
+{
+    using namespace std::chrono_literals;
+
+    constexpr auto kPort = 8088;
+    constexpr int kNumRequest = 8;
+
+    auto handler = [](skye::request req) -> asio::awaitable<skye::response> {
+        skye::response res{http::status::ok, req.version()};
+        res.body() = std::to_string(::getpid());
+        co_return res;
+    };
+
+    // Each worker binds its own SO_REUSEPORT listener
+    skye::listen_options listen;
+    listen.reuse_port = true;
+
+    skye::prefork_options options;
+    options.num_worker = 2;
+    options.stop_timeout = 2s;
+
+    skye::PreforkServer server{
+        asio::ip::tcp::endpoint{asio::ip::address_v4::loopback(), kPort},
+        listen,
+        options,
+        handler};
+
+    std::thread supervisor{[&server]() { server.run(); }};
+
+    // The port is closed until the first worker has bound it
+    std::set<std::string> pids;
+    for (int i = 0; (i < 200) && pids.empty(); ++i) {
+        try {
+            pids.insert(get(kPort));
+        } catch (const boost::system::system_error&) {
+            std::this_thread::sleep_for(10ms);
+        }
+    }
+
+    for (int i = 0; i < kNumRequest; ++i) {
+        pids.insert(get(kPort));
+    }
+
+    REQUIRE(!pids.empty());
+    REQUIRE(pids.count(std::to_string(::getpid())) == 0);
+
+    server.stop();
+    supervisor.join();
+
+    REQUIRE(server.metrics().num_worker == 0);
+}
+
+#endif // __linux__
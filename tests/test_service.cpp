@@ -8,9 +8,13 @@
 #include <boost/beast/http.hpp>
 #include <catch2/catch_test_macros.hpp>
 
+#include <atomic>
 #include <chrono>
+#include <filesystem>
+#include <fstream>
 #include <future>
 #include <string>
+#include <string_view>
 #include <thread>
 
 namespace asio = boost::asio;
@@ -269,7 +273,8 @@ TEST_CASE("integration", "[skye][service]")
             REQUIRE(!ec);
 
             co_await asio::async_write(
-                socket, asio::buffer("GET / HTTP/1.1\r\n\r\n"),
+                socket,
+            asio::buffer(std::string_view{"GET / HTTP/1.1\r\n\r\n"}),
                 asio::redirect_error(asio::use_awaitable, ec));
 
             REQUIRE(!ec);
@@ -301,3 +306,276 @@ TEST_CASE("integration", "[skye][service]")
     REQUIRE(ioc.run() > 0);
     REQUIRE(num_client == 2);
 }
+
+#if !defined(_WIN32)
+
+TEST_CASE("async_run_local", "[skye][service]")
+{
+    using local = asio::local::stream_protocol;
+
+    auto handler = [](skye::request req) -> asio::awaitable<skye::response> {
+        skye::response res{http::status::ok, req.version()};
+        res.body() = std::string{req.target()};
+        co_return res;
+    };
+
+    local::endpoint endpoint;
+
+    SECTION("path")
+    {
+        // A stale socket file from a previous run is replaced
+        const auto path =
+            std::filesystem::temp_directory_path() / "skye-test.sock";
+        std::filesystem::remove(path);
+
+        endpoint = local::endpoint{path.string()};
+
+        asio::io_context stale_ctx;
+        local::acceptor stale{stale_ctx, endpoint};
+        stale.close();
+        REQUIRE(std::filesystem::exists(path));
+    }
+
+    SECTION("abstract")
+    {
+        endpoint = local::endpoint{std::string_view{"\0skye-test", 10}};
+    }
+
+    asio::io_context ioc;
+
+    skye::async_run(ioc, endpoint, handler);
+
+    // Run the listen coroutine up to its first accept
+    ioc.poll();
+
+    auto client = [&]() -> asio::awaitable<skye::response> {
+        local::socket socket{co_await asio::this_coro::executor};
+        co_await socket.async_connect(endpoint, asio::use_awaitable);
+
+        skye::request req{http::verb::get, "/local", 11};
+        co_await http::async_write(socket, req, asio::use_awaitable);
+
+        boost::beast::flat_buffer buffer;
+        skye::response res;
+        co_await http::async_read(socket, buffer, res, asio::use_awaitable);
+
+        co_return res;
+    };
+
+    skye::response res;
+    co_spawn(ioc, client(), [&](std::exception_ptr ptr, skye::response r) {
+        REQUIRE(!ptr);
+        res = std::move(r);
+        ioc.stop();
+    });
+
+    ioc.run();
+
+    REQUIRE(res.result() == http::status::ok);
+    REQUIRE(res.body() == "/local");
+}
+
+TEST_CASE("async_run_local_in_use", "[skye][service]")
+{
+    using local = asio::local::stream_protocol;
+
+    auto handler = [](skye::request req) -> asio::awaitable<skye::response> {
+        co_return skye::response{http::status::ok, req.version()};
+    };
+
+    const auto path =
+        std::filesystem::temp_directory_path() / "skye-test-in-use.sock";
+    std::filesystem::remove(path);
+
+    const local::endpoint endpoint{path.string()};
+
+    asio::io_context ioc;
+
+    SECTION("file")
+    {
+        // Never remove a file that is not a socket
+        std::ofstream{path} << "keep";
+
+        skye::async_run(ioc, endpoint, handler);
+        REQUIRE_THROWS(ioc.poll());
+
+        REQUIRE(std::filesystem::is_regular_file(path));
+    }
+
+    SECTION("live")
+    {
+        // Never take over the socket of a running server
+        local::acceptor live{ioc, endpoint};
+
+        skye::async_run(ioc, endpoint, handler);
+        REQUIRE_THROWS(ioc.poll());
+
+        local::socket client{ioc};
+        REQUIRE_NOTHROW(client.connect(endpoint));
+    }
+
+    std::filesystem::remove(path);
+}
+
+#endif // !_WIN32
+
+TEST_CASE("listen_options", "[skye][service]")
+{
+    using namespace std::chrono_literals;
+    using tcp = asio::ip::tcp;
+
+    constexpr auto kPort = 8082;
+    constexpr int kBufferSize = 1 << 16;
+
+    skye::listen_options options;
+    options.backlog = 16;
+    options.receive_buffer_size = kBufferSize;
+    options.send_buffer_size = kBufferSize;
+    options.defer_accept = 1;
+    options.fast_open = 16;
+    options.incoming_cpu = 0;
+
+    SECTION("open_listener")
+    {
+        asio::io_context ioc;
+        tcp::acceptor acceptor{ioc};
+        skye::detail::open_listener(
+            acceptor, tcp::endpoint{asio::ip::address_v4::loopback(), 0},
+            options);
+
+        REQUIRE(acceptor.is_open());
+
+        // Linux doubles the requested size for bookkeeping overhead
+        asio::socket_base::receive_buffer_size receive_buffer_size;
+        acceptor.get_option(receive_buffer_size);
+        REQUIRE(receive_buffer_size.value() >= kBufferSize);
+
+        asio::socket_base::send_buffer_size send_buffer_size;
+        acceptor.get_option(send_buffer_size);
+        REQUIRE(send_buffer_size.value() >= kBufferSize);
+    }
+
+    SECTION("async_run")
+    {
+        auto handler =
+            [](skye::request req) -> asio::awaitable<skye::response> {
+            co_return skye::response{http::status::ok, req.version()};
+        };
+
+        asio::io_context ioc;
+
+        skye::async_run(ioc, kPort, options, handler);
+
+        // Run the listen coroutine up to its first accept
+        ioc.poll();
+
+        auto client = [&]() -> asio::awaitable<skye::response> {
+            tcp::socket socket{co_await asio::this_coro::executor};
+            co_await socket.async_connect(
+                {asio::ip::address_v4::loopback(), kPort},
+                asio::use_awaitable);
+
+            skye::request req{http::verb::get, "/", 11};
+            co_await http::async_write(socket, req, asio::use_awaitable);
+
+            boost::beast::flat_buffer buffer;
+            skye::response res;
+            co_await http::async_read(
+                socket, buffer, res, asio::use_awaitable);
+
+            co_return res;
+        };
+
+        skye::response res;
+        co_spawn(
+            ioc, client(), [&](std::exception_ptr ptr, skye::response r) {
+                REQUIRE(!ptr);
+                res = std::move(r);
+                ioc.stop();
+            });
+
+        REQUIRE(ioc.run_for(2s) > 0);
+        REQUIRE(res.result() == http::status::ok);
+    }
+}
+
+#if defined(SKYE_CANCEL_ON_DISCONNECT)
+
+TEST_CASE("cancel_on_disconnect", "[skye][service]")
+{
+    using namespace std::chrono_literals;
+    using tcp = boost::asio::ip::tcp;
+
+    constexpr auto kPort = 8082;
+
+    // Slow handler that runs in the thread pool
+    std::atomic<bool> handler_cancelled = false;
+    auto handler = [&handler_cancelled](
+                       skye::request req) -> asio::awaitable<skye::response> {
+        asio::steady_timer timer{co_await asio::this_coro::executor, 10s};
+
+        boost::system::error_code ec;
+        co_await timer.async_wait(
+            asio::redirect_error(asio::use_awaitable, ec));
+
+        handler_cancelled = (ec == asio::error::operation_aborted);
+
+        co_return skye::response{http::status::ok, req.version()};
+    };
+
+    asio::thread_pool pool{1};
+    asio::io_context ioc;
+
+    skye::async_run(ioc, kPort, skye::make_co_handler(pool, handler));
+
+    auto client = [&handler_cancelled]() -> asio::awaitable<void> {
+        const tcp::endpoint endpoint{
+            asio::ip::make_address("127.0.0.1"),
+            static_cast<asio::ip::port_type>(kPort)};
+
+        tcp::socket socket{co_await asio::this_coro::executor};
+
+        boost::system::error_code ec;
+        for (int i = 0; i < 5; ++i) {
+            co_await socket.async_connect(
+                endpoint, asio::redirect_error(asio::use_awaitable, ec));
+            if (!ec) {
+                break;
+            }
+
+            asio::steady_timer timer{socket.get_executor(), 100ms};
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+
+        REQUIRE(!ec);
+
+        co_await asio::async_write(
+            socket,
+            asio::buffer(std::string_view{"GET / HTTP/1.1\r\n\r\n"}),
+            asio::redirect_error(asio::use_awaitable, ec));
+
+        REQUIRE(!ec);
+
+        // Give up on the request while the handler is still running
+        asio::steady_timer timer{socket.get_executor(), 100ms};
+        co_await timer.async_wait(asio::use_awaitable);
+
+        socket.close();
+
+        for (int i = 0; (i < 20) && !handler_cancelled; ++i) {
+            timer.expires_after(100ms);
+            co_await timer.async_wait(asio::use_awaitable);
+        }
+    };
+
+    co_spawn(ioc, client(), [&ioc](auto ptr) {
+        REQUIRE(!ptr);
+        ioc.stop();
+    });
+
+    ioc.run();
+
+    REQUIRE(handler_cancelled);
+}
+
+#endif // SKYE_CANCEL_ON_DISCONNECT
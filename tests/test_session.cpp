@@ -1,11 +1,27 @@
+#include <skye/capture.hpp>
 #include <skye/session.hpp>
+#include <skye/shared_body.hpp>
+#include <skye/trace.hpp>
 
 #include "mock_sock.hpp"
 #include "test.hpp"
 
 #include <boost/asio.hpp>
+#include <boost/beast/core/buffers_to_string.hpp>
+#include <boost/beast/core/flat_buffer.hpp>
+#include <boost/beast/http/empty_body.hpp>
+#include <boost/beast/http/vector_body.hpp>
 #include <catch2/catch_test_macros.hpp>
 
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <string_view>
+#include <type_traits>
 #include <vector>
 
 namespace asio = boost::asio;
@@ -117,6 +133,61 @@ TEST_CASE("async_write", "[test][MockSock]")
     }
 }
 
+TEST_CASE("async_read_some_fragment", "[test][MockSock]")
+{
+    using buffer = std::string;
+    using tcp_socket = test::MockSock<buffer, asio::io_context::executor_type>;
+
+    asio::io_context ctx;
+    tcp_socket s{ctx.get_executor()};
+
+    const auto data = test::make_random_string<buffer>(1000);
+    s.set_rx(data);
+    s.set_read_size(7);
+
+    buffer buf(data.size(), 0);
+
+    auto handler = [](boost::system::error_code ec,
+                      std::size_t bytes_transferred) {
+        REQUIRE(!ec);
+        REQUIRE(bytes_transferred == 1000);
+    };
+
+    asio::async_read(s, asio::buffer(buf), handler);
+
+    REQUIRE(data == buf);
+    REQUIRE(s.num_read() == 143);
+}
+
+TEST_CASE("async_write_fragment", "[test][MockSock]")
+{
+    using buffer = std::string;
+    using tcp_socket = test::MockSock<buffer, asio::io_context::executor_type>;
+
+    asio::io_context ctx;
+    tcp_socket s{ctx.get_executor()};
+    s.set_write_size(100);
+
+    const auto header = test::make_random_string<buffer>(150);
+    const auto body = test::make_random_string<buffer>(850);
+
+    auto handler = [](boost::system::error_code ec,
+                      std::size_t bytes_transferred) {
+        REQUIRE(!ec);
+        REQUIRE(bytes_transferred == 1000);
+    };
+
+    const std::array<asio::const_buffer, 2> buffers{
+        asio::buffer(header), asio::buffer(body)};
+    asio::async_write(s, buffers, handler);
+
+    REQUIRE(s.get_tx() == header + body);
+    REQUIRE(s.num_write() == 10);
+
+    s.clear_tx();
+    REQUIRE(s.get_tx().empty());
+}
+
 TEST_CASE("session_ok", "[skye][session]")
 {
     using buffer = std::string;
@@ -159,6 +230,109 @@ TEST_CASE("session_ok", "[skye][session]")
     REQUIRE(handler_called == 1);
 }
 
+TEST_CASE("session_fragment", "[skye][session]")
+{
+    using buffer = std::string;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using tcp_socket = default_token::as_default_on_t<
+        test::MockSock<buffer, asio::io_context::executor_type>>;
+
+    const buffer data = "POST /echo HTTP/1.1\r\n"
+                        "Host: localhost\r\n"
+                        "Content-Type: text/plain\r\n"
+                        "Content-Length: 5\r\n\r\n"
+                        "hello"
+                        "GET / HTTP/1.0\r\n\r\n";
+
+    auto handler = [](skye::request req) -> asio::awaitable<skye::response> {
+        skye::response res(http::status::ok, req.version());
+        res.body() = req.body();
+
+        co_return res;
+    };
+
+    // One byte at a time splits every header line, the result is the same
+    for (const std::size_t size : {1, 3, 16, 1024}) {
+        asio::io_context ctx;
+        tcp_socket s{ctx.get_executor()};
+        s.set_rx(data);
+        s.set_read_size(size);
+        s.set_write_size(size);
+
+        co_spawn(
+            ctx.get_executor(), skye::session(s, handler, false),
+            [](auto ptr) { REQUIRE(!ptr); });
+
+        REQUIRE(ctx.run() > 0);
+
+        REQUIRE(s.get_tx().starts_with("HTTP/1.1 200 OK\r\n"));
+        REQUIRE(s.get_tx().find("\r\n\r\nhelloHTTP/1.0 200 OK\r\n") !=
+                buffer::npos);
+        REQUIRE(s.num_read() >= (data.size() + size - 1) / size);
+        REQUIRE(s.num_write() >= s.get_tx().size() / size);
+    }
+}
+
+TEST_CASE("session_request_metrics", "[skye][session]")
+{
+    using buffer = std::string;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using tcp_socket = default_token::as_default_on_t<
+        test::MockSock<buffer, asio::io_context::executor_type>>;
+
+    asio::io_context ctx;
+    tcp_socket s{ctx.get_executor()};
+
+    const buffer data = "GET /a?b=1 HTTP/1.1\r\n\r\n"
+                        "POST /c HTTP/1.1\r\nConnection: close\r\n\r\n";
+    s.set_rx(data);
+
+    auto handler = [](skye::request req) -> asio::awaitable<skye::response> {
+        skye::response res(http::status::not_found, req.version());
+        co_return res;
+    };
+
+    // One call per request plus one for the session
+    struct Reporter {
+        void operator()(const skye::RequestMetrics& m) const
+        {
+            requests->push_back(m);
+        }
+
+        void operator()(const skye::SessionMetrics& /*m*/) const
+        {
+            ++*num_session;
+        }
+
+        std::vector<skye::RequestMetrics>* requests;
+        int* num_session;
+    };
+
+    std::vector<skye::RequestMetrics> requests;
+    int num_session = 0;
+    const Reporter reporter{&requests, &num_session};
+
+    co_spawn(
+        ctx.get_executor(), skye::session(s, handler, reporter),
+        [](auto ptr) { REQUIRE(!ptr); });
+
+    REQUIRE(ctx.run() > 0);
+
+    REQUIRE(num_session == 1);
+    REQUIRE(requests.size() == 2);
+
+    REQUIRE(requests[0].num_request == 1);
+    REQUIRE(requests[0].method == http::verb::get);
+    REQUIRE(requests[0].target() == "/a?b=1");
+    REQUIRE(requests[0].status == 404);
+    REQUIRE(requests[0].bytes_write > 0);
+    REQUIRE(requests[0].end_time >= requests[0].start_time);
+
+    REQUIRE(requests[1].num_request == 2);
+    REQUIRE(requests[1].method == http::verb::post);
+    REQUIRE(requests[1].target() == "/c");
+}
+
 TEST_CASE("session_error", "[skye][session]")
 {
     using buffer = std::string;
@@ -232,4 +406,362 @@ TEST_CASE("session_error_post", "[skye][session]")
     REQUIRE(reporter_called);
     REQUIRE(metrics.num_request == 0);
     REQUIRE(!handler_called);
-}
\ No newline at end of file
+}
+
+TEST_CASE("session_shared_body", "[skye][session]")
+{
+    using buffer = std::string;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using tcp_socket = default_token::as_default_on_t<
+        test::MockSock<buffer, asio::io_context::executor_type>>;
+
+    asio::io_context ctx;
+    tcp_socket s{ctx.get_executor()};
+
+    const buffer data = "GET / HTTP/1.1\r\n\r\nGET / HTTP/1.0\r\n\r\n";
+    s.set_rx(data);
+
+    const skye::shared_buffer body{test::make_random_string<buffer>(1024)};
+
+    auto handler =
+        [&body](skye::request req) -> asio::awaitable<skye::shared_response> {
+        skye::shared_response res(http::status::ok, req.version());
+        res.body() = body;
+
+        // The response refers to the cached bytes, no copy
+        REQUIRE(res.body().data() == body.data());
+
+        co_return res;
+    };
+
+    skye::SessionMetrics metrics;
+    auto reporter = [&metrics](const skye::SessionMetrics& m) { metrics = m; };
+
+    co_spawn(ctx, skye::session(s, handler, reporter), [](auto ptr) {
+        REQUIRE(!ptr);
+    });
+
+    REQUIRE(ctx.run() > 0);
+
+    REQUIRE(metrics.num_request == 2);
+    REQUIRE(s.get_tx().ends_with(body.view()));
+}
+
+TEST_CASE("shared_body_read", "[skye][shared_body]")
+{
+    using buffer = std::string;
+
+    const auto body = test::make_random_string<buffer>(1024);
+    const buffer data = "POST / HTTP/1.1\r\n"
+                        "Content-Length: " +
+                        std::to_string(body.size()) + "\r\n\r\n" + body;
+
+    http::request_parser<skye::shared_body> parser;
+
+    // Header and body are consumed in separate calls
+    boost::system::error_code ec;
+    std::size_t offset = 0;
+    while (!ec && !parser.is_done()) {
+        offset += parser.put(asio::buffer(data) + offset, ec);
+    }
+
+    REQUIRE(!ec);
+    REQUIRE(parser.is_done());
+    REQUIRE(parser.get().body().view() == body);
+}
+
+TEST_CASE("session_empty_body", "[skye][session]")
+{
+    using buffer = std::string;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using tcp_socket = default_token::as_default_on_t<
+        test::MockSock<buffer, asio::io_context::executor_type>>;
+    using request = http::request<http::empty_body>;
+    using response = http::response<http::vector_body<std::byte>>;
+
+    // GET only handler, request body type deduced from the signature
+    int handler_called = 0;
+    auto handler = [&handler_called](request req) -> asio::awaitable<response> {
+        ++handler_called;
+
+        response res{http::status::ok, req.version()};
+        res.body().assign(4, std::byte{'a'});
+
+        co_return res;
+    };
+
+    static_assert(
+        std::is_same_v<skye::handler_request_t<decltype(handler)>, request>);
+    static_assert(
+        std::is_same_v<skye::handler_response_t<decltype(handler)>, response>);
+
+    {
+        asio::io_context ctx;
+        tcp_socket s{ctx.get_executor()};
+        s.set_rx("GET / HTTP/1.0\r\n\r\n");
+
+        co_spawn(ctx, skye::session(s, handler, false), [](auto ptr) {
+            REQUIRE(!ptr);
+        });
+
+        REQUIRE(ctx.run() > 0);
+
+        REQUIRE(handler_called == 1);
+        REQUIRE(s.get_tx().ends_with("aaaa"));
+    }
+
+    // A request with a body is an error, the handler is not called
+    {
+        asio::io_context ctx;
+        tcp_socket s{ctx.get_executor()};
+        s.set_rx("POST / HTTP/1.0\r\nContent-Length: 4\r\n\r\nbody");
+
+        co_spawn(ctx, skye::session(s, handler, false), [](auto ptr) {
+            REQUIRE(!ptr);
+        });
+
+        REQUIRE(ctx.run() > 0);
+
+        REQUIRE(handler_called == 1);
+        REQUIRE(s.get_tx().empty());
+    }
+}
+
+TEST_CASE("session_phase_timing", "[skye][session]")
+{
+    using namespace std::chrono_literals;
+
+    using buffer = std::string;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using tcp_socket = default_token::as_default_on_t<
+        test::MockSock<buffer, asio::io_context::executor_type>>;
+
+    asio::io_context ctx;
+    tcp_socket s{ctx.get_executor()};
+
+    const buffer data = "POST / HTTP/1.1\r\nContent-Length: 5\r\n\r\nhello"
+                        "GET / HTTP/1.0\r\n\r\n";
+    s.set_rx(data);
+
+    auto handler = [](skye::request req) -> asio::awaitable<skye::response> {
+        asio::steady_timer timer{co_await asio::this_coro::executor, 5ms};
+        co_await timer.async_wait(asio::use_awaitable);
+
+        skye::response res(http::status::ok, req.version());
+        res.body() = req.body();
+
+        co_return res;
+    };
+
+    skye::SessionMetrics metrics;
+    auto reporter = [&metrics](const skye::SessionMetrics& m) { metrics = m; };
+
+    co_spawn(ctx, skye::session(s, handler, reporter), [](auto ptr) {
+        REQUIRE(!ptr);
+    });
+
+    REQUIRE(ctx.run() > 0);
+
+    REQUIRE(metrics.num_request == 2);
+    REQUIRE(metrics.bytes_read == static_cast<int>(data.size()));
+    REQUIRE(s.get_tx().find("hello") != buffer::npos);
+
+    if constexpr (skye::kEnablePhaseTiming) {
+        // Coarse clock resolution is a few milliseconds
+        REQUIRE(metrics.phases.handler >= 5ms);
+    } else {
+        REQUIRE(metrics.phases.handler == 0ns);
+        REQUIRE(metrics.phases.wait == 0ns);
+    }
+}
+
+TEST_CASE("session_trace", "[skye][trace]")
+{
+    using buffer = std::string;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using tcp_socket = default_token::as_default_on_t<
+        test::MockSock<buffer, asio::io_context::executor_type>>;
+
+    asio::io_context ctx;
+    tcp_socket s{ctx.get_executor()};
+
+    s.set_rx("GET / HTTP/1.1\r\n\r\nGET / HTTP/1.0\r\n\r\n");
+
+    auto handler = [](skye::request req) -> asio::awaitable<skye::response> {
+        co_return skye::response{http::status::ok, req.version()};
+    };
+
+    skye::trace_start();
+
+    co_spawn(ctx, skye::session(s, handler, false), [](auto ptr) {
+        REQUIRE(!ptr);
+    });
+
+    REQUIRE(ctx.run() > 0);
+
+    skye::trace_stop();
+
+    const std::string json = skye::trace_to_json();
+    REQUIRE(json.starts_with("{\"traceEvents\":["));
+    REQUIRE(json.ends_with("]}"));
+
+    const auto count = [&json](std::string_view str) {
+        int n = 0;
+        for (auto pos = json.find(str); pos != std::string::npos;
+             pos = json.find(str, pos + 1)) {
+            ++n;
+        }
+        return n;
+    };
+
+    if constexpr (skye::kEnableTrace) {
+        // Every span is closed, including the read that hits end of stream
+        REQUIRE(count("\"ph\":\"b\"") == count("\"ph\":\"e\""));
+        REQUIRE(count("\"name\":\"session\"") == 2);
+        REQUIRE(count("\"name\":\"handler\"") == 4);
+        REQUIRE(count("\"name\":\"read\"") == 4);
+        REQUIRE(json.find("\"args\":{\"request\":2}") != std::string::npos);
+    } else {
+        REQUIRE(count("\"ph\":\"b\"") == 0);
+    }
+}
+
+TEST_CASE("session_capture", "[skye][capture]")
+{
+    using buffer = std::string;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using tcp_socket = default_token::as_default_on_t<
+        test::MockSock<buffer, asio::io_context::executor_type>>;
+
+    const buffer data = "GET / HTTP/1.1\r\n\r\n"
+                        "POST / HTTP/1.1\r\nContent-Length: 4\r\n\r\nbody"
+                        "GET / HTTP/1.0\r\n\r\n";
+
+    auto handler = [](skye::request req) -> asio::awaitable<skye::response> {
+        co_return skye::response{http::status::ok, req.version()};
+    };
+
+    std::FILE* file = std::tmpfile();
+    REQUIRE(file != nullptr);
+
+    skye::capture_start(file);
+
+    // Two connections, the second one in small reads
+    asio::io_context ctx;
+    for (const std::size_t size : {0, 10}) {
+        tcp_socket s{ctx.get_executor()};
+        s.set_rx(data);
+        s.set_read_size(size);
+
+        co_spawn(
+            ctx, skye::session(skye::capture_stream{s}, handler, false),
+            [](auto ptr) { REQUIRE(!ptr); });
+    }
+
+    REQUIRE(ctx.run() > 0);
+
+    skye::capture_stop();
+
+    std::rewind(file);
+    const auto records = skye::capture_read(file);
+    std::fclose(file);
+
+    for (const std::uint32_t id : {1, 2}) {
+        buffer rx;
+        int num_record = 0;
+        bool closed = false;
+        for (const auto& record : records) {
+            if (record.id != id) {
+                continue;
+            }
+
+            REQUIRE(!closed);
+            closed = record.data.empty();
+
+            rx += record.data;
+            ++num_record;
+        }
+
+        REQUIRE(closed);
+        REQUIRE(rx == data);
+        REQUIRE(num_record == ((id == 1) ? 2 : 9));
+    }
+
+    REQUIRE(std::is_sorted(
+        records.begin(), records.end(),
+        [](const auto& a, const auto& b) { return a.time < b.time; }));
+}
+
+#if defined(SKYE_CANCEL_ON_DISCONNECT)
+
+TEST_CASE("wait_disconnect", "[skye][session]")
+{
+    using buffer = std::string;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using tcp_socket = default_token::as_default_on_t<
+        test::MockSock<buffer, asio::io_context::executor_type>>;
+
+    asio::io_context ctx;
+    tcp_socket s{ctx.get_executor()};
+
+    // A pipelined request arrives before the client closes
+    const buffer data = "GET /next HTTP/1.1\r\n\r\n";
+    s.set_rx(data);
+    s.set_read_size(8);
+
+    boost::beast::flat_buffer read_buffer;
+    bool done = false;
+    auto wait = [&]() -> asio::awaitable<void> {
+        co_await skye::detail::wait_disconnect(s, read_buffer);
+        done = true;
+    };
+
+    co_spawn(ctx, wait(), [](auto ptr) { REQUIRE(!ptr); });
+
+    REQUIRE(ctx.run() > 0);
+
+    // Completes on end of stream and keeps the bytes for the next read
+    REQUIRE(done);
+    REQUIRE(boost::beast::buffers_to_string(read_buffer.data()) == data);
+}
+
+TEST_CASE("session_cancel_on_disconnect", "[skye][session]")
+{
+    using namespace std::chrono_literals;
+
+    using buffer = std::string;
+    using default_token = asio::as_tuple_t<asio::use_awaitable_t<>>;
+    using tcp_socket = default_token::as_default_on_t<
+        test::MockSock<buffer, asio::io_context::executor_type>>;
+
+    asio::io_context ctx;
+    tcp_socket s{ctx.get_executor()};
+
+    // Keep alive request, then the client goes away
+    s.set_rx("GET / HTTP/1.1\r\n\r\n");
+
+    bool handler_cancelled = false;
+    auto handler = [&handler_cancelled](
+                       skye::request req) -> asio::awaitable<skye::response> {
+        asio::steady_timer timer{co_await asio::this_coro::executor, 10s};
+
+        boost::system::error_code ec;
+        co_await timer.async_wait(
+            asio::redirect_error(asio::use_awaitable, ec));
+
+        handler_cancelled = (ec == asio::error::operation_aborted);
+
+        co_return skye::response{http::status::ok, req.version()};
+    };
+
+    co_spawn(ctx, skye::session(s, handler), [](auto ptr) { REQUIRE(!ptr); });
+
+    REQUIRE(ctx.run_for(5s) > 0);
+    REQUIRE(ctx.stopped());
+
+    // Nobody to send the response to
+    REQUIRE(handler_cancelled);
+    REQUIRE(s.get_tx().empty());
+}
+
+#endif // SKYE_CANCEL_ON_DISCONNECT
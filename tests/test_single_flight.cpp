@@ -0,0 +1,258 @@
+#include <skye/shared_body.hpp>
+#include <skye/single_flight.hpp>
+
+#include "test.hpp"
+
+#include <boost/asio.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <chrono>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+TEST_CASE("single_flight", "[skye][single_flight]")
+{
+    using namespace std::chrono_literals;
+
+    constexpr auto kNumRequest = 8;
+    constexpr auto kHttpVersion = 11;
+
+    const auto body = test::make_random_string<std::string>(1024);
+
+    int handler_called = 0;
+    auto handler = [&](skye::request req) -> asio::awaitable<skye::response> {
+        ++handler_called;
+
+        // Stay in flight long enough for the other requests to join
+        asio::steady_timer timer{co_await asio::this_coro::executor, 10ms};
+        co_await timer.async_wait(asio::use_awaitable);
+
+        skye::response res{http::status::ok, req.version()};
+        res.body() = body;
+
+        co_return res;
+    };
+
+    auto single_flight = skye::make_single_flight(handler);
+
+    asio::io_context ioc;
+
+    // The string body is moved into a shared body once
+    std::vector<skye::shared_response> responses;
+
+    auto client = [&](http::verb method) -> asio::awaitable<void> {
+        responses.push_back(co_await single_flight(
+            skye::request{method, "/same", kHttpVersion}));
+    };
+
+    for (int i = 0; i < kNumRequest; ++i) {
+        co_spawn(ioc, client(http::verb::get), [](auto ptr) {
+            REQUIRE(!ptr);
+        });
+    }
+
+    REQUIRE(ioc.run() > 0);
+
+    REQUIRE(handler_called == 1);
+    REQUIRE(responses.size() == kNumRequest);
+    for (const auto& res : responses) {
+        REQUIRE(res.result() == http::status::ok);
+        REQUIRE(res.body().view() == body);
+
+        // Every waiter refers to the same body bytes, none were copied
+        REQUIRE(res.body().data() == responses.front().body().data());
+    }
+
+    // Requests that are not in flight at the same time each call the handler
+    co_spawn(ioc, client(http::verb::get), [](auto ptr) { REQUIRE(!ptr); });
+    ioc.restart();
+    REQUIRE(ioc.run() > 0);
+
+    REQUIRE(handler_called == 2);
+
+    // POST requests are never coalesced by the default key
+    for (int i = 0; i < kNumRequest; ++i) {
+        co_spawn(ioc, client(http::verb::post), [](auto ptr) {
+            REQUIRE(!ptr);
+        });
+    }
+
+    ioc.restart();
+    REQUIRE(ioc.run() > 0);
+
+    REQUIRE(handler_called == 2 + kNumRequest);
+}
+
+TEST_CASE("single_flight_error", "[skye][single_flight]")
+{
+    using namespace std::chrono_literals;
+
+    constexpr auto kNumRequest = 4;
+
+    auto handler = [](skye::request) -> asio::awaitable<skye::response> {
+        asio::steady_timer timer{co_await asio::this_coro::executor, 10ms};
+        co_await timer.async_wait(asio::use_awaitable);
+
+        throw std::runtime_error{"handler failed"};
+        co_return skye::response{};
+    };
+
+    auto single_flight = skye::make_single_flight(handler);
+
+    asio::io_context ioc;
+
+    int num_error = 0;
+    for (int i = 0; i < kNumRequest; ++i) {
+        co_spawn(
+            ioc,
+            single_flight(skye::request{skye::http::verb::get, "/", 11}),
+            [&num_error](auto ptr, auto) {
+                if (ptr) {
+                    ++num_error;
+                }
+            });
+    }
+
+    REQUIRE(ioc.run() > 0);
+
+    // The leader and every waiter see the handler exception
+    REQUIRE(num_error == kNumRequest);
+}
+
+TEST_CASE("single_flight_shared_body", "[skye][single_flight]")
+{
+    using namespace std::chrono_literals;
+
+    constexpr auto kNumRequest = 4;
+
+    auto handler =
+        [](skye::request req) -> asio::awaitable<skye::shared_response> {
+        asio::steady_timer timer{co_await asio::this_coro::executor, 10ms};
+        co_await timer.async_wait(asio::use_awaitable);
+
+        skye::shared_response res{http::status::ok, req.version()};
+        res.body() =
+            skye::shared_buffer{test::make_random_string<std::string>(1024)};
+
+        co_return res;
+    };
+
+    auto single_flight = skye::make_single_flight(handler);
+
+    asio::io_context ioc;
+
+    std::vector<skye::shared_response> responses;
+    for (int i = 0; i < kNumRequest; ++i) {
+        co_spawn(
+            ioc, single_flight(skye::request{http::verb::get, "/", 11}),
+            [&responses](auto ptr, auto res) {
+                REQUIRE(!ptr);
+                responses.push_back(std::move(res));
+            });
+    }
+
+    REQUIRE(ioc.run() > 0);
+
+    // Every waiter refers to the same body bytes
+    REQUIRE(responses.size() == kNumRequest);
+    for (const auto& res : responses) {
+        REQUIRE(res.body().size() == 1024);
+        REQUIRE(res.body().data() == responses.front().body().data());
+    }
+}
+
+TEST_CASE("single_flight_start_order", "[skye][single_flight]")
+{
+    using namespace std::chrono_literals;
+
+    int handler_called = 0;
+    auto handler = [&](skye::request req) -> asio::awaitable<skye::response> {
+        ++handler_called;
+
+        asio::steady_timer timer{co_await asio::this_coro::executor, 10ms};
+        co_await timer.async_wait(asio::use_awaitable);
+
+        co_return skye::response{http::status::ok, req.version()};
+    };
+
+    auto single_flight = skye::make_single_flight(handler);
+
+    asio::io_context ioc;
+
+    // The session may start the awaitables in any order, e.g. when the handler
+    // is spawned onto its own coroutine. The first one to run leads.
+    auto first = single_flight(skye::request{http::verb::get, "/", 11});
+    auto second = single_flight(skye::request{http::verb::get, "/", 11});
+
+    int num_ok = 0;
+    auto on_done = [&num_ok](auto ptr, auto res) {
+        REQUIRE(!ptr);
+        REQUIRE(res.result() == http::status::ok);
+        ++num_ok;
+    };
+
+    co_spawn(ioc, std::move(second), on_done);
+    co_spawn(ioc, std::move(first), on_done);
+
+    REQUIRE(ioc.run() > 0);
+
+    REQUIRE(handler_called == 1);
+    REQUIRE(num_ok == 2);
+}
+
+TEST_CASE("single_flight_cancel_leader", "[skye][single_flight]")
+{
+    using namespace std::chrono_literals;
+
+    constexpr auto kNumRequest = 4;
+
+    int handler_called = 0;
+    auto handler = [&](skye::request req) -> asio::awaitable<skye::response> {
+        ++handler_called;
+
+        asio::steady_timer timer{co_await asio::this_coro::executor, 10ms};
+        co_await timer.async_wait(asio::use_awaitable);
+
+        co_return skye::response{http::status::ok, req.version()};
+    };
+
+    auto single_flight = skye::make_single_flight(handler);
+
+    asio::io_context ioc;
+
+    // The leader goes away, e.g. its client disconnects
+    asio::cancellation_signal signal;
+    bool leader_error = false;
+    co_spawn(
+        ioc, single_flight(skye::request{http::verb::get, "/", 11}),
+        asio::bind_cancellation_slot(
+            signal.slot(),
+            [&leader_error](auto ptr, auto) { leader_error = ptr != nullptr; }));
+
+    int num_ok = 0;
+    for (int i = 1; i < kNumRequest; ++i) {
+        co_spawn(
+            ioc, single_flight(skye::request{http::verb::get, "/", 11}),
+            [&num_ok](auto ptr, auto res) {
+                REQUIRE(!ptr);
+                REQUIRE(res.result() == http::status::ok);
+                ++num_ok;
+            });
+    }
+
+    asio::steady_timer timer{ioc, 1ms};
+    timer.async_wait([&signal](auto) {
+        signal.emit(asio::cancellation_type::terminal);
+    });
+
+    REQUIRE(ioc.run() > 0);
+
+    // One waiter took over and the rest joined it
+    REQUIRE(leader_error);
+    REQUIRE(num_ok == kNumRequest - 1);
+    REQUIRE(handler_called == 2);
+}
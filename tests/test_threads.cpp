@@ -0,0 +1,147 @@
+#include <skye/threads.hpp>
+
+#include <boost/asio.hpp>
+#include <boost/beast/core.hpp>
+#include <boost/beast/http.hpp>
+#include <catch2/catch_test_macros.hpp>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+#if defined(__linux__)
+#include <sched.h>
+#endif
+
+namespace asio = boost::asio;
+namespace http = boost::beast::http;
+
+namespace {
+
+// Per thread state, not copyable
+struct ThreadHandler {
+    std::size_t index{};
+    std::thread::id owner{std::this_thread::get_id()};
+    std::unique_ptr<int> num_request{std::make_unique<int>(0)};
+
+    asio::awaitable<skye::response> operator()(skye::request req)
+    {
+        ++*num_request;
+
+        int cpu = -1;
+#if defined(__linux__)
+        cpu = ::sched_getcpu();
+#endif
+
+        // index owner cpu
+        skye::response res{http::status::ok, req.version()};
+        res.body() = std::to_string(index) + " " +
+                     std::to_string(owner == std::this_thread::get_id()) +
+                     " " + std::to_string(cpu);
+        co_return res;
+    }
+};
+
+} // namespace
+
+TEST_CASE("ServerThreads", "[skye][threads]")
+{
+    using tcp = asio::ip::tcp;
+
+    constexpr auto kPort = 8084;
+    constexpr int kNumThread = 2;
+    constexpr int kNumRequest = 8;
+
+    const auto cpus = skye::detail::allowed_cpus();
+    REQUIRE(!cpus.empty());
+
+    std::atomic<int> num_factory{0};
+
+    skye::thread_options threads;
+    threads.num_thread = kNumThread;
+
+    skye::ServerThreads group{
+        tcp::endpoint{asio::ip::address_v4::loopback(), kPort},
+        {},
+        threads,
+        [&num_factory](std::size_t index) {
+            ++num_factory;
+            return ThreadHandler{index};
+        }};
+
+    REQUIRE(group.size() == kNumThread);
+    for (std::size_t i = 0; i < group.size(); ++i) {
+        REQUIRE(std::ranges::find(cpus, group.cpu(i)) != cpus.end());
+    }
+
+    asio::io_context ioc;
+    for (int i = 0; i < kNumRequest; ++i) {
+        tcp::socket socket{ioc};
+        socket.connect({asio::ip::address_v4::loopback(), kPort});
+
+        http::write(socket, skye::request{http::verb::get, "/", 11});
+
+        boost::beast::flat_buffer buffer;
+        skye::response res;
+        http::read(socket, buffer, res);
+
+        // Handler ran on the thread that built it, pinned to its CPU
+        std::size_t index = 0;
+        int owner = 0;
+        int cpu = 0;
+        const int n = std::sscanf(
+            res.body().c_str(), "%zu %d %d", &index, &owner, &cpu);
+        REQUIRE(n == 3);
+        REQUIRE(index < group.size());
+        REQUIRE(owner == 1);
+#if defined(__linux__)
+        REQUIRE(cpu == group.cpu(index));
+#endif
+    }
+
+    REQUIRE(num_factory == kNumThread);
+
+    group.stop();
+    REQUIRE_NOTHROW(group.join());
+}
+
+TEST_CASE("ServerThreads_error", "[skye][threads]")
+{
+    using namespace std::chrono_literals;
+    using tcp = asio::ip::tcp;
+
+    constexpr auto kPort = 8089;
+
+    skye::thread_options threads;
+    threads.num_thread = 2;
+
+    skye::ServerThreads group{
+        tcp::endpoint{asio::ip::address_v4::loopback(), kPort},
+        {},
+        threads,
+        [](std::size_t /*index*/) {
+            return [](skye::request) -> asio::awaitable<skye::response> {
+                throw std::runtime_error{"handler failed"};
+                co_return skye::response{};
+            };
+        }};
+
+    std::promise<void> failed;
+    group.on_error([&failed]() { failed.set_value(); });
+
+    asio::io_context ioc;
+    tcp::socket socket{ioc};
+    socket.connect({asio::ip::address_v4::loopback(), kPort});
+    http::write(socket, skye::request{http::verb::get, "/", 11});
+
+    // One thread failed, every thread stops and the owner is told
+    REQUIRE(
+        failed.get_future().wait_for(5s) == std::future_status::ready);
+    REQUIRE_THROWS(group.join());
+}